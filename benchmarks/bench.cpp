@@ -0,0 +1,412 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Microbenchmarks of the request/response hot path.
+//
+// Usage: jsonrpc-bench [filter] [seconds per benchmark]
+// Only the benchmarks whose name contains filter are run. For every benchmark the throughput
+// (ops/s, and MB/s of JSON or binary data handled) and the number of heap allocations per
+// operation are printed.
+
+#include "../include/jsonrpc-lean/client.h"
+#include "../include/jsonrpc-lean/framing.h"
+#include "../include/jsonrpc-lean/jsonformathandler.h"
+#include "../include/jsonrpc-lean/jsonreader.h"
+#include "../include/jsonrpc-lean/jsonwriter.h"
+#include "../include/jsonrpc-lean/server.h"
+#include "../include/jsonrpc-lean/util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every allocation made by the process goes through here, so that they can be counted. The whole
+// set of replaceable operators is replaced, so that nothing is allocated by the standard library's
+// operator new and freed here or the other way around. Allocate and Free are kept out of line:
+// once inlined into a caller of operator new, GCC takes the std::free for a mismatched delete.
+
+namespace {
+    std::atomic<uint64_t> allocationCount(0);
+
+#if defined(__GNUC__)
+#define JSONRPC_BENCH_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define JSONRPC_BENCH_NOINLINE __declspec(noinline)
+#else
+#define JSONRPC_BENCH_NOINLINE
+#endif
+
+    // nullptr if out of memory
+    JSONRPC_BENCH_NOINLINE void* Allocate(size_t size) noexcept {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size == 0 ? 1 : size);
+    }
+
+    JSONRPC_BENCH_NOINLINE void Free(void* ptr) noexcept {
+        std::free(ptr);
+    }
+
+    void* AllocateOrThrow(size_t size) {
+        if (void* ptr = Allocate(size)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+
+#ifdef __cpp_aligned_new
+    JSONRPC_BENCH_NOINLINE void* AllocateAligned(size_t size, std::align_val_t alignment) noexcept {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        const size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+#ifdef _WIN32
+        return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+        void* ptr = nullptr;
+        return posix_memalign(&ptr, align, size == 0 ? 1 : size) == 0 ? ptr : nullptr;
+#endif
+    }
+
+    JSONRPC_BENCH_NOINLINE void FreeAligned(void* ptr) noexcept {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+
+    void* AllocateAlignedOrThrow(size_t size, std::align_val_t alignment) {
+        if (void* ptr = AllocateAligned(size, alignment)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+#endif
+}
+
+void* operator new(size_t size) { return AllocateOrThrow(size); }
+void* operator new[](size_t size) { return AllocateOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+
+void operator delete(void* ptr) noexcept { Free(ptr); }
+void operator delete[](void* ptr) noexcept { Free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { Free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { Free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { Free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { Free(ptr); }
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return AllocateAlignedOrThrow(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocateAlignedOrThrow(size, alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, alignment); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+#endif
+
+namespace {
+
+    using namespace jsonrpc;
+
+    // Keeps the compiler from optimizing a result away
+    template<typename T>
+    void Consume(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    struct Options {
+        std::string myFilter;
+        double mySeconds = 0.5;
+    };
+
+    // Runs op until mySeconds have passed (at least once) and prints the results; bytes is the
+    // size of the data handled by one op
+    void Run(const Options& options, const std::string& name, size_t bytes, const std::function<void()>& op) {
+        if (name.find(options.myFilter) == std::string::npos) {
+            return;
+        }
+
+        typedef std::chrono::steady_clock Clock;
+
+        // warm up caches, pools and lazily created state
+        for (int i = 0; i < 10; ++i) {
+            op();
+        }
+
+        const auto limit = std::chrono::duration<double>(options.mySeconds);
+        uint64_t ops = 0;
+        uint64_t batch = 1;
+        const uint64_t allocationsBefore = allocationCount.load();
+        const auto start = Clock::now();
+        std::chrono::duration<double> elapsed(0);
+        while (elapsed < limit) {
+            for (uint64_t i = 0; i < batch; ++i) {
+                op();
+            }
+            ops += batch;
+            batch *= 2;
+            elapsed = Clock::now() - start;
+        }
+        const uint64_t allocations = allocationCount.load() - allocationsBefore;
+
+        const double seconds = elapsed.count();
+        std::printf("%-40s %12.0f ops/s %10.1f MB/s %8.2f allocs/op\n",
+            name.c_str(),
+            ops / seconds,
+            bytes * ops / seconds / (1024 * 1024),
+            static_cast<double>(allocations) / ops);
+    }
+
+    // Payloads
+
+    struct Payload {
+        std::string myName;
+        Request::Parameters myParameters;
+        std::string myRequest;
+        std::string myResponse;
+    };
+
+    Value MakeDeepStruct(int depth) {
+        Value::Struct data;
+        data["name"] = Value("level " + std::to_string(depth));
+        data["count"] = Value(depth);
+        if (depth > 0) {
+            data["child"] = MakeDeepStruct(depth - 1);
+        }
+        return Value(std::move(data));
+    }
+
+    std::vector<Payload> MakePayloads() {
+        std::vector<Payload> payloads;
+
+        payloads.emplace_back();
+        payloads.back().myName = "tiny";
+        payloads.back().myParameters.emplace_back(int32_t(1));
+        payloads.back().myParameters.emplace_back(int32_t(2));
+
+        payloads.emplace_back();
+        payloads.back().myName = "wide";
+        Value::Array array;
+        for (int32_t i = 0; i < 1000; ++i) {
+            array.emplace_back(i * 7919);
+        }
+        payloads.back().myParameters.emplace_back(std::move(array));
+
+        payloads.emplace_back();
+        payloads.back().myName = "deep";
+        payloads.back().myParameters.emplace_back(MakeDeepStruct(32));
+
+        payloads.emplace_back();
+        payloads.back().myName = "binary";
+        std::string binary(64 * 1024, '\0');
+        for (size_t i = 0; i < binary.size(); ++i) {
+            binary[i] = static_cast<char>(i * 31);
+        }
+        payloads.back().myParameters.emplace_back(std::move(binary), true);
+
+        for (auto& payload : payloads) {
+            JsonWriter requestWriter;
+            Request::Write("echo", payload.myParameters, Value(int32_t(1)), requestWriter);
+            auto request = requestWriter.GetData();
+            payload.myRequest.assign(request->GetData(), request->GetSize());
+
+            JsonWriter responseWriter;
+            Response(Value(payload.myParameters.front()), Value(int32_t(1))).Write(responseWriter);
+            auto response = responseWriter.GetData();
+            payload.myResponse.assign(response->GetData(), response->GetSize());
+        }
+
+        return payloads;
+    }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (argc > 1) {
+        options.myFilter = argv[1];
+    }
+    if (argc > 2) {
+        options.mySeconds = std::atof(argv[2]);
+    }
+
+    const auto payloads = MakePayloads();
+
+    JsonFormatHandler formatHandler;
+    Server server;
+    server.RegisterFormatHandler(formatHandler);
+    server.GetDispatcher().AddMethod("echo", [](const Value& value) { return Value(value); });
+    server.GetDispatcher().AddMethod("add", [](int32_t a, int32_t b) { return a + b; });
+    Client client(formatHandler);
+
+    for (auto& payload : payloads) {
+        Run(options, "reader/GetRequest/" + payload.myName, payload.myRequest.size(), [&]() {
+            JsonReader reader(payload.myRequest);
+            Consume(reader.GetRequest());
+        });
+    }
+
+    for (auto& payload : payloads) {
+        Run(options, "reader/stream/GetRequest/" + payload.myName, payload.myRequest.size(), [&]() {
+            JsonStreamReader reader(payload.myRequest);
+            Consume(reader.GetRequest());
+        });
+    }
+
+    {
+        Request::Parameters parameters;
+        parameters.emplace_back(int32_t(1));
+        parameters.emplace_back(int32_t(2));
+        const Value id(int32_t(1));
+        Run(options, "dispatcher/Invoke/add", 0, [&]() {
+            Consume(server.GetDispatcher().Invoke("add", parameters, id));
+        });
+
+        Dispatcher measured;
+        measured.AddMethod("add", [](int32_t a, int32_t b) { return a + b; });
+        measured.EnableMetrics();
+        Run(options, "dispatcher/Invoke/add-metrics", 0, [&]() {
+            Consume(measured.Invoke("add", parameters, id));
+        });
+    }
+
+    for (auto& payload : payloads) {
+        Run(options, "dispatcher/Invoke/echo/" + payload.myName, 0, [&]() {
+            Consume(server.GetDispatcher().Invoke("echo", payload.myParameters, Value(int32_t(1))));
+        });
+    }
+
+    for (auto& payload : payloads) {
+        const Response response(Value(payload.myParameters.front()), Value(int32_t(1)));
+        Run(options, "writer/Response/" + payload.myName, payload.myResponse.size(), [&]() {
+            JsonWriter writer;
+            response.Write(writer);
+            Consume(writer.GetData());
+        });
+    }
+
+    for (auto& payload : payloads) {
+        Run(options, "client/BuildRequestData/" + payload.myName, payload.myRequest.size(), [&]() {
+            Consume(client.BuildRequestData("echo", payload.myParameters));
+        });
+    }
+
+    for (auto& payload : payloads) {
+        Run(options, "client/ParseResponse/" + payload.myName, payload.myResponse.size(), [&]() {
+            Consume(client.ParseResponse(payload.myResponse));
+        });
+    }
+
+    for (auto& payload : payloads) {
+        Run(options, "server/HandleRequest/" + payload.myName, payload.myRequest.size(), [&]() {
+            Consume(server.HandleRequest(payload.myRequest));
+        });
+    }
+
+    {
+        // the cost of timing the phases, without that of keeping the events
+        struct CountingSink : TraceSink {
+            void OnEvent(const TraceEvent&) override { ++myCount; }
+            size_t myCount = 0;
+        } sink;
+        server.SetTraceSink(&sink);
+        const auto& payload = payloads.front();
+        Run(options, "server/HandleRequest/" + payload.myName + "-traced", payload.myRequest.size(), [&]() {
+            Consume(server.HandleRequest(payload.myRequest));
+        });
+        server.SetTraceSink(nullptr);
+    }
+
+    {
+        // a repeated request to a cached method: found by its parameters, spliced as written before
+        const auto& payload = payloads[1];
+        server.GetDispatcher().AddMethod("echo-cached", [](const Request::Parameters& params) {
+            return Value(params.front());
+        }).SetCache(1024);
+        JsonWriter requestWriter;
+        Request::Write("echo-cached", payload.myParameters, Value(int32_t(1)), requestWriter);
+        const std::string request(requestWriter.GetData()->GetData(), requestWriter.GetData()->GetSize());
+        Run(options, "server/HandleRequest/" + payload.myName + "-cached", request.size(), [&]() {
+            Consume(server.HandleRequest(request));
+        });
+    }
+
+    for (auto& payload : payloads) {
+        std::string response;
+        Run(options, "server/HandleRequestInto/" + payload.myName, payload.myRequest.size(), [&]() {
+            response.clear();
+            Consume(server.HandleRequestInto(payload.myRequest, response));
+        });
+    }
+
+    // 16 requests per stream, received in reads of 4 KiB
+    for (auto& payload : payloads) {
+        std::string stream;
+        for (int i = 0; i < 16; ++i) {
+            FrameWriter::Write(Framing::NEWLINE, payload.myRequest.data(), payload.myRequest.size(), stream);
+        }
+        FramedConnection connection(server, Framing::NEWLINE);
+        std::string response;
+        Run(options, "server/FramedConnection/" + payload.myName, stream.size(), [&]() {
+            response.clear();
+            for (size_t offset = 0; offset < stream.size(); ) {
+                size_t capacity;
+                char* buffer = connection.GetReceiveBuffer(capacity);
+                const size_t size = std::min(capacity, std::min<size_t>(4096, stream.size() - offset));
+                memcpy(buffer, stream.data() + offset, size);
+                connection.Received(size, response);
+                offset += size;
+            }
+            Consume(response.size());
+        });
+    }
+
+    {
+        const std::string& binary = payloads.back().myParameters.front().AsString();
+        const std::string encoded = util::Base64Encode(binary);
+        Run(options, "util/Base64Encode/64k", binary.size(), [&]() {
+            Consume(util::Base64Encode(binary));
+        });
+        Run(options, "util/Base64Decode/64k", encoded.size(), [&]() {
+            Consume(util::Base64Decode(encoded));
+        });
+
+        // unwrapped, into a buffer that is reused
+        const std::string unwrapped = util::Base64Encode(binary, false);
+        std::string decoded(util::Base64DecodedMaxSize(unwrapped.size()), '\0');
+        Run(options, "util/Base64Decode/64k-unwrapped", unwrapped.size(), [&]() {
+            Consume(util::Base64Decode(unwrapped.data(), unwrapped.size(), &decoded[0]));
+        });
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Serves newline-delimited JSON-RPC on a TCP port (Linux only), e.g.
+//   echo '{"jsonrpc":"2.0","method":"add","id":1,"params":[3,2]}' | nc -q1 127.0.0.1 8080
+
+#include "../include/jsonrpc-lean/epollserver.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+	const uint16_t port = static_cast<uint16_t>(argc > 1 ? std::atoi(argv[1]) : 8080);
+
+	jsonrpc::Server server;
+	jsonrpc::JsonFormatHandler jsonFormatHandler;
+	server.RegisterFormatHandler(jsonFormatHandler);
+
+	auto& dispatcher = server.GetDispatcher();
+	dispatcher.AddMethod("add", [](int32_t a, int32_t b) { return a + b; });
+	dispatcher.AddMethod("concat", [](const std::string& a, const std::string& b) { return a + b; });
+
+	// wait for Ctrl-C on this thread, the reactor threads must not handle it
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	try {
+		jsonrpc::EpollServer epollServer(server);
+		epollServer.ListenTcp("127.0.0.1", port);
+		epollServer.Start();
+		std::cout << "listening on 127.0.0.1:" << port << std::endl;
+
+		int signal;
+		sigwait(&signals, &signal);
+		epollServer.Stop();
+	} catch (const std::exception& ex) {
+		std::cerr << "Error: " << ex.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_ARENA_H
+#define JSONRPC_LEAN_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+
+namespace jsonrpc {
+    namespace util {
+
+        // Monotonic allocator: memory is handed out from large blocks and is only given back
+        // all at once, by Release() or the destructor. Not thread safe.
+        class Arena {
+        public:
+            explicit Arena(size_t blockSize = 8 * 1024)
+                : myBlockSize(blockSize) {
+            }
+
+            // The first allocations are served from buffer, which must outlive the arena
+            Arena(void* buffer, size_t size, size_t blockSize = 8 * 1024)
+                : myCurrent(static_cast<char*>(buffer)),
+                myEnd(static_cast<char*>(buffer) + size),
+                myBuffer(static_cast<char*>(buffer)),
+                myBufferSize(size),
+                myBlockSize(blockSize) {
+            }
+
+            ~Arena() {
+                Release();
+            }
+
+            Arena(const Arena&) = delete;
+            Arena& operator=(const Arena&) = delete;
+
+            void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+                char* result = Align(myCurrent, alignment);
+                if (result == nullptr || result + size > myEnd) {
+                    AddBlock(size + alignment);
+                    result = Align(myCurrent, alignment);
+                }
+                myCurrent = result + size;
+                return result;
+            }
+
+            void Release() {
+                while (myBlocks != nullptr) {
+                    Block* next = myBlocks->myNext;
+                    free(myBlocks);
+                    myBlocks = next;
+                }
+                myCurrent = myBuffer;
+                myEnd = myBuffer + myBufferSize;
+            }
+
+        private:
+            struct Block {
+                Block* myNext;
+            };
+
+            static char* Align(char* ptr, size_t alignment) {
+                if (ptr == nullptr) {
+                    return nullptr;
+                }
+                const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+                return ptr + ((alignment - address % alignment) % alignment);
+            }
+
+            void AddBlock(size_t minSize) {
+                const size_t size = sizeof(Block) + (minSize > myBlockSize ? minSize : myBlockSize);
+                Block* block = static_cast<Block*>(malloc(size));
+                if (block == nullptr) {
+                    throw std::bad_alloc();
+                }
+                block->myNext = myBlocks;
+                myBlocks = block;
+                myCurrent = reinterpret_cast<char*>(block + 1);
+                myEnd = reinterpret_cast<char*>(block) + size;
+            }
+
+            char* myCurrent = nullptr;
+            char* myEnd = nullptr;
+            char* myBuffer = nullptr;
+            size_t myBufferSize = 0;
+            size_t myBlockSize;
+            Block* myBlocks = nullptr;
+        };
+
+        // Standard allocator that takes its memory from an Arena, or from the global heap when
+        // it has none (the default). Copies of a container fall back to the global heap, so
+        // copying arena backed data is the way to make it outlive the arena.
+        template<typename T>
+        class ArenaAllocator {
+        public:
+            typedef T value_type;
+            typedef std::false_type propagate_on_container_copy_assignment;
+            typedef std::true_type propagate_on_container_move_assignment;
+            typedef std::true_type propagate_on_container_swap;
+
+            ArenaAllocator() noexcept : myArena(nullptr) {}
+            explicit ArenaAllocator(Arena* arena) noexcept : myArena(arena) {}
+
+            template<typename U>
+            ArenaAllocator(const ArenaAllocator<U>& other) noexcept : myArena(other.GetArena()) {}
+
+            T* allocate(size_t n) {
+                if (myArena != nullptr) {
+                    return static_cast<T*>(myArena->Allocate(n * sizeof(T), alignof(T)));
+                }
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(T* ptr, size_t) noexcept {
+                if (myArena == nullptr) {
+                    ::operator delete(ptr);
+                }
+            }
+
+            ArenaAllocator select_on_container_copy_construction() const {
+                return ArenaAllocator();
+            }
+
+            Arena* GetArena() const { return myArena; }
+
+            template<typename U>
+            bool operator==(const ArenaAllocator<U>& other) const { return myArena == other.GetArena(); }
+
+            template<typename U>
+            bool operator!=(const ArenaAllocator<U>& other) const { return myArena != other.GetArena(); }
+
+        private:
+            Arena* myArena;
+        };
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_ARENA_H
@@ -0,0 +1,314 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_ASYNCCLIENT_H
+#define JSONRPC_LEAN_ASYNCCLIENT_H
+
+#include "fault.h"
+#include "formathandler.h"
+#include "formatteddata.h"
+#include "reader.h"
+#include "request.h"
+#include "response.h"
+#include "value.h"
+#include "writer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Client that keeps several calls in flight on one connection. Every call gets an id and
+    // waits in a table until a response with that id is passed to HandleResponseData, in any
+    // order and possibly inside a batch. The transport is up to the caller: requests are handed
+    // to the send function, responses are fed back in. Timeouts are checked when the caller
+    // calls ExpireCalls (e.g. from its event loop, see GetNextDeadline).
+    // All members may be called from any thread; callbacks run on the thread that completes the
+    // call, never with the client's lock held.
+    class AsyncClient {
+    public:
+        typedef std::function<void(std::shared_ptr<FormattedData>)> SendFunction;
+        typedef std::function<void(Response)> Callback;
+        typedef std::chrono::steady_clock Clock;
+        typedef int32_t CallId;
+
+        // Fault codes of the calls completed locally, outside the range reserved by JSON-RPC
+        enum LocalCodes : int32_t {
+            TIMEOUT = -31001,
+            CANCELLED = -31002,
+        };
+
+        struct BatchCall {
+            std::string myMethodName;
+            Request::Parameters myParameters;
+            Callback myCallback;
+        };
+
+        // A zero timeout means that calls do not time out unless given one
+        AsyncClient(FormatHandler& formatHandler, SendFunction send, Clock::duration defaultTimeout = Clock::duration::zero())
+            : myFormatHandler(formatHandler),
+            mySend(std::move(send)),
+            myDefaultTimeout(defaultTimeout) {
+        }
+
+        AsyncClient(const AsyncClient&) = delete;
+        AsyncClient& operator=(const AsyncClient&) = delete;
+
+        // Sends the request; callback gets the response (a fault response on error, time out or
+        // cancellation). If send throws, the call is dropped and the exception propagates.
+        CallId Call(const std::string& methodName, const Request::Parameters& params, Callback callback) {
+            return Call(methodName, params, std::move(callback), myDefaultTimeout);
+        }
+
+        CallId Call(const std::string& methodName, const Request::Parameters& params, Callback callback, Clock::duration timeout) {
+            const CallId id = Register(std::move(callback), timeout);
+
+            auto writer = myFormatHandler.CreateWriter();
+            Request::Write(methodName, params, id, *writer);
+            Send(writer->GetData(), &id, 1);
+            return id;
+        }
+
+        // Same as Call, the result (or the fault, as an exception) is delivered through a future
+        std::future<Value> CallFuture(const std::string& methodName, const Request::Parameters& params = {}) {
+            auto promise = std::make_shared<std::promise<Value>>();
+            auto future = promise->get_future();
+            Call(methodName, params, [promise](Response response) {
+                try {
+                    response.ThrowIfFault();
+                    promise->set_value(std::move(response.GetResult()));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+            return future;
+        }
+
+        // Sends all calls as one batch; returns their ids in the same order
+        std::vector<CallId> CallBatch(std::vector<BatchCall> calls) {
+            std::vector<CallId> ids;
+            if (calls.empty()) {
+                return ids;
+            }
+
+            ids.reserve(calls.size());
+            try {
+                for (auto& call : calls) {
+                    ids.push_back(Register(std::move(call.myCallback), myDefaultTimeout));
+                }
+            } catch (...) {
+                Drop(ids.data(), ids.size());
+                throw;
+            }
+
+            auto writer = myFormatHandler.CreateWriter();
+            writer->StartBatch();
+            for (size_t i = 0; i < calls.size(); ++i) {
+                Request::Write(calls[i].myMethodName, calls[i].myParameters, ids[i], *writer);
+            }
+            writer->EndBatch();
+            Send(writer->GetData(), ids.data(), ids.size());
+            return ids;
+        }
+
+        void Notify(const std::string& methodName, const Request::Parameters& params = {}) {
+            auto writer = myFormatHandler.CreateWriter();
+            Request::Write(methodName, params, false, *writer);
+            mySend(writer->GetData());
+        }
+
+        // Completes the calls answered in aResponseData (a response or a batch of them) and
+        // returns how many there were. Responses with an unknown id (e.g. late ones, for calls that
+        // timed out) are ignored, as are invalid entries of a batch.
+        size_t HandleResponseData(const std::string& aResponseData) {
+            auto reader = myFormatHandler.CreateReader(aResponseData);
+            if (!reader->IsBatch()) {
+                return Complete(reader->GetResponse()) ? 1 : 0;
+            }
+
+            size_t count = 0;
+            const size_t size = reader->GetBatchSize();
+            for (size_t i = 0; i < size; ++i) {
+                try {
+                    if (Complete(reader->GetResponse(i))) {
+                        ++count;
+                    }
+                } catch (const Fault&) {
+                }
+            }
+            return count;
+        }
+
+        // Completes the call with a CANCELLED fault; false if it was not in flight anymore
+        bool Cancel(CallId id) {
+            Callback callback;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (!Take(id, callback)) {
+                    return false;
+                }
+            }
+            callback(Response(CANCELLED, "Call cancelled", Value(id)));
+            return true;
+        }
+
+        // Cancels every call in flight, e.g. when the connection is lost
+        void CancelAll() {
+            std::vector<std::pair<CallId, Callback>> calls;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                calls.reserve(myCalls.size());
+                for (auto& call : myCalls) {
+                    calls.emplace_back(call.first, std::move(call.second.myCallback));
+                }
+                myCalls.clear();
+                myDeadlines.clear();
+            }
+            for (auto& call : calls) {
+                call.second(Response(CANCELLED, "Call cancelled", Value(call.first)));
+            }
+        }
+
+        // Completes the calls whose deadline is not after now with a TIMEOUT fault and returns
+        // how many there were
+        size_t ExpireCalls(Clock::time_point now = Clock::now()) {
+            std::vector<std::pair<CallId, Callback>> expired;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                while (!myDeadlines.empty() && myDeadlines.begin()->first <= now) {
+                    const CallId id = myDeadlines.begin()->second;
+                    Callback callback;
+                    Take(id, callback);
+                    expired.emplace_back(id, std::move(callback));
+                }
+            }
+            for (auto& call : expired) {
+                call.second(Response(TIMEOUT, "Call timed out", Value(call.first)));
+            }
+            return expired.size();
+        }
+
+        // When ExpireCalls has something to do next; Clock::time_point::max() if nothing
+        Clock::time_point GetNextDeadline() const {
+            std::lock_guard<std::mutex> lock(myMutex);
+            return myDeadlines.empty() ? Clock::time_point::max() : myDeadlines.begin()->first;
+        }
+
+        size_t GetPendingCount() const {
+            std::lock_guard<std::mutex> lock(myMutex);
+            return myCalls.size();
+        }
+
+    private:
+        typedef std::multimap<Clock::time_point, CallId> Deadlines;
+
+        struct PendingCall {
+            Callback myCallback;
+            bool myHasDeadline;
+            Deadlines::iterator myDeadline;
+        };
+
+        CallId Register(Callback callback, Clock::duration timeout) {
+            std::lock_guard<std::mutex> lock(myMutex);
+
+            // ids wrap around, skipping those still in flight
+            CallId id;
+            do {
+                id = myNextId;
+                myNextId = myNextId == std::numeric_limits<CallId>::max() ? 0 : myNextId + 1;
+            } while (myCalls.find(id) != myCalls.end());
+
+            PendingCall& call = myCalls[id];
+            call.myCallback = std::move(callback);
+            call.myHasDeadline = timeout > Clock::duration::zero();
+            if (call.myHasDeadline) {
+                call.myDeadline = myDeadlines.emplace(Clock::now() + timeout, id);
+            }
+            return id;
+        }
+
+        void Send(std::shared_ptr<FormattedData> data, const CallId* ids, size_t count) {
+            try {
+                mySend(std::move(data));
+            } catch (...) {
+                Drop(ids, count);
+                throw;
+            }
+        }
+
+        // Removes calls without completing them
+        void Drop(const CallId* ids, size_t count) {
+            std::lock_guard<std::mutex> lock(myMutex);
+            Callback callback;
+            for (size_t i = 0; i < count; ++i) {
+                Take(ids[i], callback);
+            }
+        }
+
+        // Called with myMutex held
+        bool Take(CallId id, Callback& callback) {
+            auto call = myCalls.find(id);
+            if (call == myCalls.end()) {
+                return false;
+            }
+            if (call->second.myHasDeadline) {
+                myDeadlines.erase(call->second.myDeadline);
+            }
+            callback = std::move(call->second.myCallback);
+            myCalls.erase(call);
+            return true;
+        }
+
+        bool Complete(Response response) {
+            const Value& id = response.GetId();
+            if (!id.IsInteger32()) {
+                return false;
+            }
+
+            Callback callback;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (!Take(id.AsInteger32(), callback)) {
+                    return false;
+                }
+            }
+            callback(std::move(response));
+            return true;
+        }
+
+        FormatHandler& myFormatHandler;
+        SendFunction mySend;
+        Clock::duration myDefaultTimeout;
+
+        mutable std::mutex myMutex;
+        std::unordered_map<CallId, PendingCall> myCalls;
+        Deadlines myDeadlines;
+        CallId myNextId = 0;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_ASYNCCLIENT_H
@@ -0,0 +1,280 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_BASE64SIMD_H
+#define JSONRPC_LEAN_BASE64SIMD_H
+
+// Vectorized base64 blocks for util::Base64Encode and util::Base64Decode, which handle line
+// wrapping, padding and everything the blocks turn down. The SSSE3 and AVX2 versions are chosen
+// at run time from what the CPU supports; define JSONRPC_LEAN_NO_SIMD to leave them out.
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(JSONRPC_LEAN_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define JSONRPC_LEAN_BASE64_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define JSONRPC_LEAN_TARGET(features)
+#else
+#define JSONRPC_LEAN_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+namespace jsonrpc {
+    namespace util {
+        namespace detail {
+
+            // Encodes whole blocks of 3 bytes from in (size bytes, of which readable may be read) to
+            // out and returns how many bytes were encoded
+            typedef size_t(*Base64EncodeBlocks)(const char* in, size_t size, size_t readable, char* out);
+
+            // Decodes blocks of 4 characters from in to out (capacity bytes) as long as they are all
+            // in the alphabet and returns how many characters were decoded
+            typedef size_t(*Base64DecodeBlocks)(const char* in, size_t size, char* out, size_t capacity);
+
+            struct Base64Kernels {
+                Base64EncodeBlocks myEncode = nullptr;
+                Base64DecodeBlocks myDecode = nullptr;
+            };
+
+#ifdef JSONRPC_LEAN_BASE64_SIMD
+
+            // Encoding: the 3 input bytes of every 4 output characters are spread over a 32 bit lane
+            // and the 4 6-bit indices moved in place with two multiplies, then turned into characters
+            // by adding the offset of their range of the alphabet.
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline __m128i Base64EncodeIndices(__m128i in) {
+                in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+                const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+                const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+                const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+                const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+                return _mm_or_si128(t1, t3);
+            }
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline __m128i Base64EncodeCharacters(__m128i indices) {
+                // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+                __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+                const __m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+                range = _mm_or_si128(range, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+                const __m128i offsets = _mm_setr_epi8(
+                    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+                return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+            }
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline size_t Base64EncodeBlocksSsse3(const char* in, size_t size, size_t readable, char* out) {
+                size_t done = 0;
+                // 12 bytes are used out of each 16 loaded
+                while (done + 12 <= size && done + 16 <= readable) {
+                    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), Base64EncodeCharacters(Base64EncodeIndices(data)));
+                    done += 12;
+                    out += 16;
+                }
+                return done;
+            }
+
+            JSONRPC_LEAN_TARGET("avx2")
+            inline size_t Base64EncodeBlocksAvx2(const char* in, size_t size, size_t readable, char* out) {
+                const __m256i shuffle = _mm256_set_epi8(
+                    10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                    10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+                const __m256i offsets = _mm256_setr_epi8(
+                    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+                size_t done = 0;
+                // each 128 bit lane gets 12 of the 24 bytes
+                while (done + 24 <= size && done + 28 <= readable) {
+                    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+                    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done + 12));
+                    __m256i data = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+
+                    data = _mm256_shuffle_epi8(data, shuffle);
+                    const __m256i t0 = _mm256_and_si256(data, _mm256_set1_epi32(0x0fc0fc00));
+                    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+                    const __m256i t2 = _mm256_and_si256(data, _mm256_set1_epi32(0x003f03f0));
+                    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+                    const __m256i indices = _mm256_or_si256(t1, t3);
+
+                    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+                    const __m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+                    range = _mm256_or_si256(range, _mm256_and_si256(isUpper, _mm256_set1_epi8(13)));
+                    const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+                    done += 24;
+                    out += 32;
+                }
+
+                // what is left may still fill SSSE3 blocks
+                return done + Base64EncodeBlocksSsse3(in + done, size - done, readable - done, out);
+            }
+
+            // Decoding: every character is checked against the ranges of the alphabet, which also
+            // gives the offset that turns it into its 6-bit value; 4 values are then packed into 3
+            // bytes with two multiply-adds. A block with any other character is left to the caller.
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline bool Base64DecodeValues(__m128i chars, __m128i& values) {
+                const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('Z' + 1)));
+                const __m128i isLower = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('z' + 1)));
+                const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+                const __m128i isPlus = _mm_cmpeq_epi8(chars, _mm_set1_epi8('+'));
+                const __m128i isSlash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+
+                const __m128i valid = _mm_or_si128(_mm_or_si128(isUpper, isLower), _mm_or_si128(isDigit, _mm_or_si128(isPlus, isSlash)));
+                if (_mm_movemask_epi8(valid) != 0xffff) {
+                    return false;
+                }
+
+                __m128i offsets = _mm_and_si128(isUpper, _mm_set1_epi8(-'A'));
+                offsets = _mm_or_si128(offsets, _mm_and_si128(isLower, _mm_set1_epi8(26 - 'a')));
+                offsets = _mm_or_si128(offsets, _mm_and_si128(isDigit, _mm_set1_epi8(52 - '0')));
+                offsets = _mm_or_si128(offsets, _mm_and_si128(isPlus, _mm_set1_epi8(62 - '+')));
+                offsets = _mm_or_si128(offsets, _mm_and_si128(isSlash, _mm_set1_epi8(63 - '/')));
+                values = _mm_add_epi8(chars, offsets);
+                return true;
+            }
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline __m128i Base64PackValues(__m128i values) {
+                const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+                const __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+                return _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            }
+
+            JSONRPC_LEAN_TARGET("ssse3")
+            inline size_t Base64DecodeBlocksSsse3(const char* in, size_t size, char* out, size_t capacity) {
+                size_t done = 0;
+                size_t written = 0;
+                // 12 bytes are used out of each 16 stored
+                while (done + 16 <= size && written + 16 <= capacity) {
+                    __m128i values;
+                    if (!Base64DecodeValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done)), values)) {
+                        break;
+                    }
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), Base64PackValues(values));
+                    done += 16;
+                    written += 12;
+                }
+                return done;
+            }
+
+            JSONRPC_LEAN_TARGET("avx2")
+            inline size_t Base64DecodeBlocksAvx2(const char* in, size_t size, char* out, size_t capacity) {
+                size_t done = 0;
+                size_t written = 0;
+                while (done + 32 <= size && written + 32 <= capacity) {
+                    const __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + done));
+
+                    const __m256i isUpper = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), chars));
+                    const __m256i isLower = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), chars));
+                    const __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+                    const __m256i isPlus = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('+'));
+                    const __m256i isSlash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+
+                    const __m256i valid = _mm256_or_si256(_mm256_or_si256(isUpper, isLower), _mm256_or_si256(isDigit, _mm256_or_si256(isPlus, isSlash)));
+                    if (_mm256_movemask_epi8(valid) != -1) {
+                        break;
+                    }
+
+                    __m256i offsets = _mm256_and_si256(isUpper, _mm256_set1_epi8(-'A'));
+                    offsets = _mm256_or_si256(offsets, _mm256_and_si256(isLower, _mm256_set1_epi8(26 - 'a')));
+                    offsets = _mm256_or_si256(offsets, _mm256_and_si256(isDigit, _mm256_set1_epi8(52 - '0')));
+                    offsets = _mm256_or_si256(offsets, _mm256_and_si256(isPlus, _mm256_set1_epi8(62 - '+')));
+                    offsets = _mm256_or_si256(offsets, _mm256_and_si256(isSlash, _mm256_set1_epi8(63 - '/')));
+                    const __m256i values = _mm256_add_epi8(chars, offsets);
+
+                    const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+                    const __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+                    const __m256i bytes = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(
+                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+                    // the 12 bytes of each lane next to each other
+                    const __m256i packed = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), packed);
+                    done += 32;
+                    written += 24;
+                }
+
+                return done + Base64DecodeBlocksSsse3(in + done, size - done, out + written, capacity - written);
+            }
+
+            inline void GetCpuFeatures(bool& ssse3, bool& avx2) {
+#if defined(_MSC_VER) && !defined(__clang__)
+                int info[4];
+                __cpuid(info, 0);
+                const int maxLeaf = info[0];
+                __cpuid(info, 1);
+                ssse3 = (info[2] & (1 << 9)) != 0;
+                const bool osxsave = (info[2] & (1 << 27)) != 0;
+                avx2 = false;
+                if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+                    __cpuidex(info, 7, 0);
+                    avx2 = (info[1] & (1 << 5)) != 0;
+                }
+#else
+                __builtin_cpu_init();
+                ssse3 = __builtin_cpu_supports("ssse3") != 0;
+                avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+            }
+
+            inline Base64Kernels SelectBase64Kernels() {
+                bool ssse3 = false;
+                bool avx2 = false;
+                GetCpuFeatures(ssse3, avx2);
+
+                Base64Kernels kernels;
+                if (avx2) {
+                    kernels.myEncode = &Base64EncodeBlocksAvx2;
+                    kernels.myDecode = &Base64DecodeBlocksAvx2;
+                } else if (ssse3) {
+                    kernels.myEncode = &Base64EncodeBlocksSsse3;
+                    kernels.myDecode = &Base64DecodeBlocksSsse3;
+                }
+                return kernels;
+            }
+
+            inline const Base64Kernels& GetBase64Kernels() {
+                static const Base64Kernels kernels = SelectBase64Kernels();
+                return kernels;
+            }
+
+#else
+
+            inline const Base64Kernels& GetBase64Kernels() {
+                static const Base64Kernels kernels;
+                return kernels;
+            }
+
+#endif
+
+        } // namespace detail
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_BASE64SIMD_H
@@ -0,0 +1,100 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_BINARY_H
+#define JSONRPC_LEAN_BINARY_H
+
+#include "compat.h"
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace jsonrpc {
+
+    // Immutable bytes in a reference counted buffer. Copies and slices refer to the same buffer,
+    // which is freed with the last of them.
+    class Binary {
+    public:
+        Binary() = default;
+
+        // Copies size bytes from data
+        Binary(const char* data, size_t size) {
+            if (size != 0) {
+                char* buffer;
+                *this = Allocate(size, buffer);
+                memcpy(buffer, data, size);
+            }
+        }
+
+        // Takes over the string's characters without copying them
+        explicit Binary(std::string data) : mySize(data.size()) {
+            auto owner = std::make_shared<std::string>(std::move(data));
+            myData = std::shared_ptr<const char>(owner, owner->data());
+        }
+
+        // Refers to size bytes at data, kept alive by data (e.g. an aliasing shared_ptr into a
+        // buffer owned by the caller)
+        Binary(std::shared_ptr<const char> data, size_t size) : myData(std::move(data)), mySize(size) {}
+
+        // A buffer of size bytes for the caller to fill through data before the Binary is shared
+        static Binary Allocate(size_t size, char*& data) {
+            std::shared_ptr<char> buffer(new char[size], std::default_delete<char[]>());
+            data = buffer.get();
+            return Binary(std::move(buffer), size);
+        }
+
+        const char* GetData() const { return myData.get(); }
+        size_t GetSize() const { return mySize; }
+        bool IsEmpty() const { return mySize == 0; }
+
+        const char* begin() const { return myData.get(); }
+        const char* end() const { return myData.get() + mySize; }
+
+        string_view GetView() const { return string_view(myData.get(), mySize); }
+
+        std::string ToString() const { return std::string(myData.get(), mySize); }
+
+        // The size bytes (at most) from offset on, sharing this buffer
+        Binary Slice(size_t offset, size_t size = std::string::npos) const {
+            if (offset > mySize) {
+                throw std::out_of_range("Binary slice out of range");
+            }
+            if (size > mySize - offset) {
+                size = mySize - offset;
+            }
+            return Binary(std::shared_ptr<const char>(myData, myData.get() + offset), size);
+        }
+
+    private:
+        std::shared_ptr<const char> myData;
+        size_t mySize = 0;
+    };
+
+    inline bool operator==(const Binary& lhs, const Binary& rhs) {
+        return lhs.GetSize() == rhs.GetSize()
+            && (lhs.IsEmpty() || lhs.GetData() == rhs.GetData() || memcmp(lhs.GetData(), rhs.GetData(), lhs.GetSize()) == 0);
+    }
+
+    inline bool operator!=(const Binary& lhs, const Binary& rhs) {
+        return !(lhs == rhs);
+    }
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_BINARY_H
@@ -0,0 +1,70 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_CACHEDVALUE_H
+#define JSONRPC_LEAN_CACHEDVALUE_H
+
+#include "compat.h"
+#include "value.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace jsonrpc {
+
+    // A value that is written many times, e.g. a cached result (see ResponseCache). It never
+    // changes, so it may be shared by any number of threads. A writer encodes it once per format
+    // and then copies the encoded bytes (see Writer::WriteCached).
+    class CachedValue {
+    public:
+        enum Encoding {
+            JSON,
+            MSGPACK,
+            ENCODING_COUNT
+        };
+
+        explicit CachedValue(Value value) : myValue(std::move(value)) {}
+
+        CachedValue(const CachedValue&) = delete;
+        CachedValue& operator=(const CachedValue&) = delete;
+
+        const Value& GetValue() const { return myValue; }
+
+        // The value in the given encoding. The first call encodes it with encode(value, bytes),
+        // and the later calls return those bytes.
+        template<typename Encode>
+        string_view GetEncoding(Encoding encoding, Encode encode) const {
+            if (!myIsEncoded[encoding].load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (!myIsEncoded[encoding].load(std::memory_order_relaxed)) {
+                    encode(myValue, myEncodings[encoding]);
+                    myIsEncoded[encoding].store(true, std::memory_order_release);
+                }
+            }
+            return string_view(myEncodings[encoding].data(), myEncodings[encoding].size());
+        }
+
+    private:
+        const Value myValue;
+        mutable std::mutex myMutex;
+        mutable std::atomic<bool> myIsEncoded[ENCODING_COUNT] = {};
+        mutable std::string myEncodings[ENCODING_COUNT];
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_CACHEDVALUE_H
@@ -30,6 +30,7 @@
 #include "jsonformatteddata.h"
 #include "dispatcher.h"
 
+#include <atomic>
 #include <functional>
 #include <string>
 #include <memory>
@@ -91,7 +92,7 @@ namespace jsonrpc {
 
         std::shared_ptr<FormattedData> BuildRequestDataInternal(const std::string& methodName, const Request::Parameters& params) {
             auto writer = myFormatHandler.CreateWriter();
-            const auto id = myId++;
+            const int32_t id = myId.fetch_add(1, std::memory_order_relaxed);
             Request::Write(methodName, params, id, *writer);
             return writer->GetData();
         }
@@ -116,7 +117,7 @@ namespace jsonrpc {
         }
 
         FormatHandler& myFormatHandler;
-        int32_t myId;
+        std::atomic<int32_t> myId; // Build*Data may be called from several threads
     };
 
 } // namespace jsonrpc
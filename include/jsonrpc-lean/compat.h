@@ -0,0 +1,87 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_COMPAT_H
+#define JSONRPC_LEAN_COMPAT_H
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+
+#include <string_view>
+
+namespace jsonrpc {
+    using std::string_view;
+} // namespace jsonrpc
+
+#else
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace jsonrpc {
+
+    // The subset of C++17 std::string_view used by jsonrpc-lean
+    class string_view {
+    public:
+        typedef const char* const_iterator;
+        typedef std::size_t size_type;
+
+        string_view() : myData(nullptr), mySize(0) {}
+        string_view(const char* data) : myData(data), mySize(strlen(data)) {}
+        string_view(const char* data, size_type size) : myData(data), mySize(size) {}
+        string_view(const std::string& str) : myData(str.data()), mySize(str.size()) {}
+
+        const char* data() const { return myData; }
+        size_type size() const { return mySize; }
+        size_type length() const { return mySize; }
+        bool empty() const { return mySize == 0; }
+
+        const_iterator begin() const { return myData; }
+        const_iterator end() const { return myData + mySize; }
+
+        const char& operator[](size_type i) const { return myData[i]; }
+
+        int compare(string_view other) const {
+            const size_type size = mySize < other.mySize ? mySize : other.mySize;
+            const int result = size == 0 ? 0 : memcmp(myData, other.myData, size);
+            if (result != 0) {
+                return result;
+            }
+            return mySize < other.mySize ? -1 : (mySize > other.mySize ? 1 : 0);
+        }
+
+        friend bool operator==(string_view a, string_view b) {
+            return a.mySize == b.mySize && (a.mySize == 0 || memcmp(a.myData, b.myData, a.mySize) == 0);
+        }
+
+        friend bool operator!=(string_view a, string_view b) { return !(a == b); }
+        friend bool operator<(string_view a, string_view b) { return a.compare(b) < 0; }
+
+        friend std::ostream& operator<<(std::ostream& os, string_view str) {
+            return os.write(str.myData, str.mySize);
+        }
+
+    private:
+        const char* myData;
+        size_type mySize;
+    };
+
+} // namespace jsonrpc
+
+#endif
+
+#endif // JSONRPC_LEAN_COMPAT_H
@@ -20,9 +20,13 @@
 #ifndef JSONRPC_LEAN_DISPATCHER_H
 #define JSONRPC_LEAN_DISPATCHER_H
 
+#include "compat.h"
 #include "fault.h"
+#include "metrics.h"
+#include "rcu.h"
 #include "request.h"
 #include "response.h"
+#include "responsecache.h"
 #include "value.h"
 
 //#if __cplusplus <= 201103L
@@ -33,26 +37,249 @@
 //} // namespace std
 //#endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
 namespace jsonrpc {
 
+    // The response to an exception thrown by a method
+    inline Response MakeFaultResponse(std::exception_ptr error, const Value& id) {
+        try {
+            std::rethrow_exception(error);
+        }
+        catch (const Fault& fault) {
+            return Response(fault.GetCode(), fault.GetString(), Value(id));
+        }
+        catch (const std::out_of_range&) {
+            InvalidParametersFault fault;
+            return Response(fault.GetCode(), fault.GetString(), Value(id));
+        }
+        catch (const std::exception& ex) {
+            return Response(0, ex.what(), Value(id));
+        }
+        catch (...) {
+            return Response(0, "unknown error", Value(id));
+        }
+    }
+
+    // Finishes a call to an asynchronous method, from any thread. Copies refer to the same call and
+    // only the first result counts. If every copy is gone without a result, the call fails with an
+    // internal error.
+    class Completion {
+    public:
+        typedef std::function<void(Response)> Callback;
+
+        Completion(Callback callback, Value id) : myState(std::make_shared<State>(std::move(callback), std::move(id))) {}
+
+        void operator()(Value result) const {
+            if (myState->Claim()) {
+                myState->myCallback(Response(std::move(result), std::move(myState->myId)));
+            }
+        }
+
+        // error is turned into a fault response, like an exception thrown by a synchronous method
+        void Fail(std::exception_ptr error) const {
+            if (myState->Claim()) {
+                myState->myCallback(MakeFaultResponse(error, myState->myId));
+            }
+        }
+
+    private:
+        struct State {
+            State(Callback callback, Value id) : myCallback(std::move(callback)), myId(std::move(id)) {}
+
+            ~State() {
+                if (Claim()) {
+                    try {
+                        InternalErrorFault fault("Method did not complete");
+                        myCallback(Response(fault.GetCode(), fault.GetString(), std::move(myId)));
+                    } catch (...) {
+                        // nowhere to report it
+                    }
+                }
+            }
+
+            bool Claim() {
+                return !myIsDone.exchange(true);
+            }
+
+            Callback myCallback;
+            Value myId;
+            std::atomic<bool> myIsDone{ false };
+        };
+
+        std::shared_ptr<State> myState;
+    };
+
+    // Calls a method with the parameters of a request
+    class MethodInvoker {
+    public:
+        virtual ~MethodInvoker() {}
+        virtual Value Invoke(const Request::Parameters& params) const = 0;
+    };
+
+    template<typename> struct FunctionSignature;
+
+    template<typename ReturnType, typename... ParameterTypes>
+    struct FunctionSignature < ReturnType(*)(ParameterTypes...) > {
+        typedef ReturnType Type(ParameterTypes...);
+    };
+
+    template<typename ReturnType, typename T, typename... ParameterTypes>
+    struct FunctionSignature < ReturnType(T::*)(ParameterTypes...) > {
+        typedef ReturnType Type(ParameterTypes...);
+    };
+
+    template<typename ReturnType, typename T, typename... ParameterTypes>
+    struct FunctionSignature < ReturnType(T::*)(ParameterTypes...) const > {
+        typedef ReturnType Type(ParameterTypes...);
+    };
+
+    template<typename MethodType, bool isClass>
+    struct MethodSignature {};
+
+    template<typename MethodType>
+    struct MethodSignature < MethodType, false > {
+        typedef typename FunctionSignature<MethodType>::Type Type;
+    };
+
+    template<typename MethodType>
+    struct MethodSignature < MethodType, true > {
+        typedef typename FunctionSignature <
+            decltype(&MethodType::operator()) > ::Type Type;
+    };
+
+    // What a typed method gets for a parameter of type T: AsType<T>() of the request parameter
+    template<typename T>
+    struct MethodArgument {
+        static typename ValueAsType<T>::Type Get(const Value& value) {
+            return value.AsType<T>();
+        }
+    };
+
+    // A String parameter refers to the String held by the Value if it has one. Otherwise it gets
+    // a copy that lives as long as the call, which for a short string does not allocate, where
+    // AsString would allocate one that lives as long as the Value.
+    template<>
+    struct MethodArgument<Value::String> {
+        class Type {
+        public:
+            explicit Type(const Value& value) : myString(value.GetStoredString()) {
+                if (myString == nullptr) {
+                    const auto str = value.AsStringView();
+                    myCopy.assign(str.data(), str.size());
+                }
+            }
+
+            operator const Value::String&() const {
+                return myString != nullptr ? *myString : myCopy;
+            }
+
+        private:
+            const Value::String* myString;
+            Value::String myCopy;
+        };
+
+        static Type Get(const Value& value) {
+            return Type(value);
+        }
+    };
+
+    // A method that takes the request parameters as they are
+    template<typename... ParameterTypes>
+    struct TakesRequestParameters : std::false_type {};
+
+    template<typename ParameterType>
+    struct TakesRequestParameters<ParameterType>
+        : std::is_same<typename std::decay<ParameterType>::type, Request::Parameters> {};
+
+    // Invoker generated for the exact signature of a method: the parameters are unpacked straight
+    // into the call and the result converted to a Value, with no type erasure besides the one
+    // virtual Invoke
+    template<typename Function, typename Signature>
+    class TypedMethodInvoker;
+
+    template<typename Function, typename ReturnType, typename... ParameterTypes>
+    class TypedMethodInvoker<Function, ReturnType(ParameterTypes...)> final : public MethodInvoker {
+    public:
+        explicit TypedMethodInvoker(Function function) : myFunction(std::move(function)) {}
+
+        Value Invoke(const Request::Parameters& params) const override {
+            return Call(params, redi::index_sequence_for < ParameterTypes... > {},
+                TakesRequestParameters<ParameterTypes...>());
+        }
+
+    private:
+        template<std::size_t... index>
+        Value Call(const Request::Parameters& params, redi::index_sequence<index...>, std::false_type) const {
+            if (params.size() != sizeof...(ParameterTypes)) {
+                throw InvalidParametersFault();
+            }
+            return Return(std::is_void<ReturnType>(),
+                MethodArgument<typename std::decay<ParameterTypes>::type>::Get(params[index])...);
+        }
+
+        Value Call(const Request::Parameters& params, redi::index_sequence<0>, std::true_type) const {
+            return Return(std::is_void<ReturnType>(), params);
+        }
+
+        template<typename... ArgumentTypes>
+        Value Return(std::false_type, ArgumentTypes&&... args) const {
+            return myFunction(std::forward<ArgumentTypes>(args)...);
+        }
+
+        template<typename... ArgumentTypes>
+        Value Return(std::true_type, ArgumentTypes&&... args) const {
+            myFunction(std::forward<ArgumentTypes>(args)...);
+            return Value();
+        }
+
+        mutable Function myFunction;
+    };
+
+    class Dispatcher;
+
+    // Once the method was added to a Dispatcher, its calls use an immutable snapshot of the
+    // wrapper: changing a setting publishes a new one, calls already running keep the old one.
+    // The settings must not be changed by several threads at once.
     class MethodWrapper {
     public:
         typedef std::function<Value(const Request::Parameters&)> Method;
 
-        explicit MethodWrapper(Method method) : myMethod(method) {}
+        // Starts the call and returns; the result is given to the Completion later. The parameters
+        // are only valid until the method returns, anything needed afterwards must be copied.
+        typedef std::function<void(const Request::Parameters&, Completion)> AsyncMethod;
+
+        explicit MethodWrapper(Method method)
+            : myInvoker(new TypedMethodInvoker<Method, Value(const Request::Parameters&)>(std::move(method))) {
+        }
+
+        explicit MethodWrapper(std::unique_ptr<const MethodInvoker> invoker) : myInvoker(std::move(invoker)) {}
+        explicit MethodWrapper(AsyncMethod method) : myAsyncMethod(std::make_shared<const AsyncMethod>(std::move(method))) {}
 
         MethodWrapper(const MethodWrapper&) = delete;
         MethodWrapper& operator=(const MethodWrapper&) = delete;
 
+        bool IsAsync() const { return myAsyncMethod != nullptr; }
+
         bool IsHidden() const { return myIsHidden; }
-        void SetHidden(bool hidden = true) { myIsHidden = hidden; }
+        void SetHidden(bool hidden = true) {
+            myIsHidden = hidden;
+            Changed();
+        }
 
         MethodWrapper& SetHelpText(std::string help) {
             myHelpText = std::move(help);
+            Changed();
             return *this;
         }
 
@@ -61,62 +288,146 @@ namespace jsonrpc {
         template<typename... ParameterTypes>
         MethodWrapper& AddSignature(Value::Type returnType, ParameterTypes... parameterTypes) {
             mySignatures.emplace_back(std::initializer_list < Value::Type > {returnType, parameterTypes...});
+            Changed();
             return *this;
         }
 
         const std::vector<std::vector<Value::Type>>&
             GetSignatures() const { return mySignatures; }
 
-        Value operator()(const Request::Parameters& params) const {
-            return myMethod(params);
+        // Lets the method be called with named parameters: names are the names of its parameters,
+        // in order
+        MethodWrapper& SetParameterNames(std::vector<std::string> names) {
+            myParameterPositions.clear();
+            myParameterPositions.reserve(names.size());
+            for (size_t i = 0; i < names.size(); ++i) {
+                myParameterPositions.emplace_back(names[i], i);
+            }
+            std::sort(myParameterPositions.begin(), myParameterPositions.end());
+            myParameterNames = std::move(names);
+            Changed();
+            return *this;
         }
 
-    private:
-        Method myMethod;
-        bool myIsHidden = false;
-        std::string myHelpText;
-        std::vector<std::vector<Value::Type>> mySignatures;
-    };
+        const std::vector<std::string>& GetParameterNames() const { return myParameterNames; }
 
-    template<typename> struct ToStdFunction;
+        // nullptr unless the Dispatcher records metrics (see Dispatcher::EnableMetrics)
+        const std::shared_ptr<MethodMetrics>& GetMetrics() const { return myMetrics; }
+        void SetMetrics(std::shared_ptr<MethodMetrics> metrics) {
+            myMetrics = std::move(metrics);
+            Changed();
+        }
 
-    template<typename ReturnType, typename... ParameterTypes>
-    struct ToStdFunction < ReturnType(*)(ParameterTypes...) > {
-        typedef std::function<ReturnType(ParameterTypes...)> Type;
-    };
+        // Opt-in for a method whose result only depends on its parameters: the results are cached
+        // (see ResponseCache) and written from their cached encoding. Faults are not cached.
+        // capacity 0 turns the cache off.
+        MethodWrapper& SetCache(size_t capacity, std::chrono::milliseconds timeToLive = std::chrono::milliseconds::zero()) {
+            myCache = capacity == 0 ? nullptr : std::make_shared<ResponseCache>(capacity, timeToLive);
+            Changed();
+            return *this;
+        }
 
-    template<typename ReturnType, typename T, typename... ParameterTypes>
-    struct ToStdFunction < ReturnType(T::*)(ParameterTypes...) > {
-        typedef std::function<ReturnType(ParameterTypes...)> Type;
-    };
+        // nullptr unless SetCache was called
+        const std::shared_ptr<ResponseCache>& GetCache() const { return myCache; }
 
-    template<typename ReturnType, typename T, typename... ParameterTypes>
-    struct ToStdFunction < ReturnType(T::*)(ParameterTypes...) const > {
-        typedef std::function<ReturnType(ParameterTypes...)> Type;
-    };
+        // Puts the named parameters of request in the order of the parameter names; a parameter
+        // that is not given is nil. Unknown or repeated names are invalid parameters.
+        void ArrangeParameters(Request& request) const {
+            if (!request.HasNamedParameters()) {
+                return;
+            }
+            if (myParameterNames.empty()) {
+                throw InvalidParametersFault("Method does not take named parameters");
+            }
 
-    template<typename MethodType, bool isClass>
-    struct StdFunction {};
+            auto& names = request.GetParameterNames();
+            auto& values = request.GetParameters();
+            Request::Parameters parameters(myParameterNames.size());
+            util::SmallVector<bool, 16> isSet(myParameterNames.size(), false);
+            for (size_t i = 0; i < names.size(); ++i) {
+                const size_t position = FindParameter(names[i]);
+                if (position == myParameterNames.size() || isSet[position]) {
+                    throw InvalidParametersFault();
+                }
+                parameters[position] = std::move(values[i]);
+                isSet[position] = true;
+            }
+            request.SetParameters(std::move(parameters));
+        }
 
-    template<typename MethodType>
-    struct StdFunction < MethodType, false > {
-        typedef typename ToStdFunction<MethodType>::Type Type;
-    };
+        Value operator()(const Request::Parameters& params) const {
+            return myInvoker->Invoke(params);
+        }
 
-    template<typename MethodType>
-    struct StdFunction < MethodType, true > {
-        typedef typename ToStdFunction <
-            decltype(&MethodType::operator()) > ::Type Type;
+        void operator()(const Request::Parameters& params, Completion completion) const {
+            (*myAsyncMethod)(params, std::move(completion));
+        }
+
+    private:
+        friend class Dispatcher;
+
+        MethodWrapper(std::shared_ptr<const MethodInvoker> invoker, std::shared_ptr<const AsyncMethod> asyncMethod)
+            : myInvoker(std::move(invoker)), myAsyncMethod(std::move(asyncMethod)) {
+        }
+
+        // The snapshot shares the method, metrics and cache, and copies the rest
+        std::shared_ptr<const MethodWrapper> MakeSnapshot() const {
+            std::shared_ptr<MethodWrapper> snapshot(new MethodWrapper(myInvoker, myAsyncMethod));
+            snapshot->myIsHidden = myIsHidden;
+            snapshot->myHelpText = myHelpText;
+            snapshot->mySignatures = mySignatures;
+            snapshot->myParameterNames = myParameterNames;
+            snapshot->myParameterPositions = myParameterPositions;
+            snapshot->myMetrics = myMetrics;
+            snapshot->myCache = myCache;
+            return snapshot;
+        }
+
+        // Publishes a new snapshot if the method was added to a Dispatcher
+        void Changed();
+
+        // Position of the parameter, or the number of parameters if there is none by that name
+        size_t FindParameter(string_view name) const {
+            auto position = std::lower_bound(myParameterPositions.begin(), myParameterPositions.end(), name,
+                [](const std::pair<std::string, size_t>& entry, string_view key) {
+                    return string_view(entry.first) < key;
+                });
+            if (position == myParameterPositions.end() || string_view(position->first) != name) {
+                return myParameterNames.size();
+            }
+            return position->second;
+        }
+
+        std::shared_ptr<const MethodInvoker> myInvoker;
+        std::shared_ptr<const AsyncMethod> myAsyncMethod;
+        bool myIsHidden = false;
+        std::string myHelpText;
+        std::vector<std::vector<Value::Type>> mySignatures;
+        std::vector<std::string> myParameterNames;
+        std::vector<std::pair<std::string, size_t>> myParameterPositions; // sorted by name
+        std::shared_ptr<MethodMetrics> myMetrics;
+        std::shared_ptr<ResponseCache> myCache;
+
+        // set by the Dispatcher the method was added to, guarded by its mutex
+        Dispatcher* myDispatcher = nullptr;
+        std::shared_ptr<const MethodWrapper> mySnapshot;
     };
 
+    // Invoke may be called from any number of threads, also while methods are added or removed:
+    // it reads an immutable snapshot of the method table (see util::RcuPointer) and never locks.
+    // Adding and removing methods, or changing their settings (see MethodWrapper), is serialized
+    // and publishes a new snapshot; a removed method stays alive until the calls already using it
+    // have returned (a call is one read section).
     class Dispatcher {
     public:
         std::vector<std::string> GetMethodNames(bool includeHidden = false) const {
+            std::lock_guard<std::mutex> lock(myMutex);
+
             std::vector<std::string> names;
             names.reserve(myMethods.size());
 
             for (auto& method : myMethods) {
-                if (includeHidden || !method.second.IsHidden()) {
+                if (includeHidden || !method.second->IsHidden()) {
                     names.emplace_back(method.first);
                 }
             }
@@ -125,112 +436,420 @@ namespace jsonrpc {
         }
 
         MethodWrapper& GetMethod(const std::string& name) {
-            return myMethods.at(name);
+            std::lock_guard<std::mutex> lock(myMutex);
+            return *myMethods.at(name);
         }
 
         MethodWrapper& AddMethod(std::string name, MethodWrapper::Method method) {
-            auto result = myMethods.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(std::move(name)),
-                std::forward_as_tuple(std::move(method)));
-            if (!result.second) {
-                throw std::invalid_argument(name + ": method already added");
-            }
-            return result.first->second;
+            return AddMethodWrapper(std::move(name), std::make_shared<MethodWrapper>(std::move(method)));
         }
 
-        template<typename MethodType>
-        MethodWrapper&
-        //typename std::enable_if<!std::is_convertible<MethodType, std::function<Value(const Request::Parameters&)>>::value && !std::is_member_pointer<MethodType>::value, MethodWrapper>::type&
-        AddMethod(std::string name, MethodType method) {
-            //static_assert(!std::is_bind_expression<MethodType>::value,
-            //    "Use AddMethod with 3 arguments to add member method");
-            typename StdFunction<MethodType, std::is_class<MethodType>::value>::Type function(std::move(method));
-            return AddMethodInternal(std::move(name), std::move(function));
-        }
-
-        template<typename T>
-        MethodWrapper& AddMethod(std::string name, Value(T::*method)(const Request::Parameters&), T& instance) {
-            return AddMethod(std::move(name), std::bind(method, &instance, std::placeholders::_1));
+        MethodWrapper& AddAsyncMethod(std::string name, MethodWrapper::AsyncMethod method) {
+            return AddMethodWrapper(std::move(name), std::make_shared<MethodWrapper>(std::move(method)));
         }
 
-        template<typename T>
-        MethodWrapper& AddMethod(std::string name, Value(T::*method)(const Request::Parameters&) const, T& instance) {
-            return AddMethod(std::move(name), std::bind(method, &instance, std::placeholders::_1));
+        // Typed method: the parameters are converted to its parameter types (see Value::AsType) and
+        // its result to a Value. A method taking const Request::Parameters& gets them as they are.
+        template<typename MethodType>
+        MethodWrapper& AddMethod(std::string name, MethodType method) {
+            typedef typename MethodSignature<MethodType, std::is_class<MethodType>::value>::Type Signature;
+            return AddTypedMethod<Signature>(std::move(name), std::move(method));
         }
 
         template<typename ReturnType, typename T, typename... ParameterTypes>
         MethodWrapper& AddMethod(std::string name, ReturnType(T::*method)(ParameterTypes...), T& instance) {
-            std::function<ReturnType(ParameterTypes...)> function = [&instance, method](ParameterTypes&&... params) -> ReturnType {
+            return AddTypedMethod<ReturnType(ParameterTypes...)>(std::move(name), [&instance, method](ParameterTypes... params) -> ReturnType {
                 return (instance.*method)(std::forward<ParameterTypes>(params)...);
-            };
-            return AddMethodInternal(std::move(name), std::move(function));
+            });
         }
 
         template<typename ReturnType, typename T, typename... ParameterTypes>
         MethodWrapper& AddMethod(std::string name, ReturnType(T::*method)(ParameterTypes...) const, T& instance) {
-            std::function<ReturnType(ParameterTypes...)> function = [&instance, method](ParameterTypes&&... params) -> ReturnType {
+            return AddTypedMethod<ReturnType(ParameterTypes...)>(std::move(name), [&instance, method](ParameterTypes... params) -> ReturnType {
                 return (instance.*method)(std::forward<ParameterTypes>(params)...);
-            };
-            return AddMethodInternal(std::move(name), std::move(function));
+            });
+        }
+
+        // Opt-in: every call of every method (also the ones added later) is counted and timed, see
+        // MethodMetrics. Must be called before requests are handled.
+        void EnableMetrics() {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myHasMetrics = true;
+            for (auto& method : myMethods) {
+                if (!method.second->myMetrics) {
+                    method.second->myMetrics = std::make_shared<MethodMetrics>();
+                    method.second->mySnapshot = nullptr;
+                }
+            }
+            Publish();
+        }
+
+        // Statistics of every method, by name; empty unless metrics are enabled
+        std::map<std::string, MethodStatistics> GetStatistics() const {
+            std::vector<std::pair<std::string, std::shared_ptr<MethodMetrics>>> metrics;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                for (auto& method : myMethods) {
+                    if (method.second->GetMetrics()) {
+                        metrics.emplace_back(method.first, method.second->GetMetrics());
+                    }
+                }
+            }
+
+            std::map<std::string, MethodStatistics> statistics;
+            for (auto& entry : metrics) {
+                statistics.emplace(entry.first, entry.second->GetStatistics());
+            }
+            return statistics;
+        }
+
+        // Adds a hidden method (not timed itself) that returns the statistics of the other methods
+        // as a struct by method name, with the latencies in microseconds, e.g.
+        // {"add": {"calls": 10, "faults": 1, "faults_by_code": {"-32602": 1},
+        //          "latency_us": {"mean": 1.2, "p50": 1.0, "p90": 2.0, "p99": 8.1, "p99.9": 8.1, "max": 8.1}}}
+        MethodWrapper& AddStatisticsMethod(std::string name = "rpc.stats") {
+            auto method = std::make_shared<MethodWrapper>(MethodWrapper::Method([this](const Request::Parameters&) {
+                return StatisticsToValue(GetStatistics());
+            }));
+            method->SetHidden();
+            std::lock_guard<std::mutex> lock(myMutex);
+            return AddMethodWrapperLocked(std::move(name), std::move(method), false);
         }
 
         void RemoveMethod(const std::string& name) {
-            myMethods.erase(name);
+            std::lock_guard<std::mutex> lock(myMutex);
+            if (myMethods.erase(name) != 0) {
+                Publish();
+            }
         }
 
-        Response Invoke(const std::string& name, const Request::Parameters& parameters, const Value& id) const {
-            try {
-                auto method = myMethods.find(name);
-                if (method == myMethods.end()) {
-                    throw MethodNotFoundFault("Method not found: " + name);
+        // Asynchronous methods are waited for
+        Response Invoke(string_view name, const Request::Parameters& parameters, const Value& id) const {
+            auto table = myTable.Read();
+            auto method = FindMethod(table.Get(), name);
+            if (method && method->IsAsync()) {
+                return InvokeAndWait(*method, parameters, id);
+            }
+            return InvokeSync(method, name, parameters, id);
+        }
+
+        // Named parameters are put in order first (see MethodWrapper::SetParameterNames)
+        Response Invoke(Request& request) const {
+            auto table = myTable.Read();
+            auto method = FindMethod(table.Get(), request.GetMethodName());
+            if (method && request.HasNamedParameters()) {
+                try {
+                    method->ArrangeParameters(request);
+                }
+                catch (...) {
+                    return MakeFaultResponse(std::current_exception(), request.GetId());
                 }
-                return{ method->second(parameters), Value(id) };
             }
-            catch (const Fault& fault) {
-                return Response(fault.GetCode(), fault.GetString(), Value(id));
+            if (method && method->IsAsync()) {
+                return InvokeAndWait(*method, request.GetParameters(), request.GetId());
+            }
+            return InvokeSync(method, request.GetMethodName(), request.GetParameters(), request.GetId());
+        }
+
+        // callback gets the response once the method has completed, which for a synchronous method
+        // is before InvokeAsync returns, and for an asynchronous one whenever and on whatever thread
+        // it calls its Completion
+        void InvokeAsync(string_view name, const Request::Parameters& parameters, const Value& id, Completion::Callback callback) const {
+            auto table = myTable.Read();
+            auto method = FindMethod(table.Get(), name);
+            if (!method || !method->IsAsync()) {
+                callback(InvokeSync(method, name, parameters, id));
+                return;
+            }
+
+            const auto start = method->GetMetrics() ? MethodMetrics::Clock::now() : MethodMetrics::Clock::time_point();
+            if (auto& cache = method->GetCache()) {
+                const auto hash = ResponseCache::Hash(parameters);
+                if (auto result = cache->Find(hash, parameters)) {
+                    Response response(std::move(result), Value(id));
+                    if (method->GetMetrics()) {
+                        method->GetMetrics()->Record(start, response);
+                    }
+                    callback(std::move(response));
+                    return;
+                }
+
+                // the parameters are only valid until the method returns
+                auto key = std::make_shared<Request::Parameters>(parameters);
+                callback = [cache, hash, key, callback](Response response) {
+                    if (!response.IsFault()) {
+                        response = Response(cache->Insert(hash, std::move(*key), std::move(response.GetResult())), Value(response.GetId()));
+                    }
+                    callback(std::move(response));
+                };
             }
-            catch (const std::out_of_range&) {
-                InvalidParametersFault fault;
-                return Response(fault.GetCode(), fault.GetString(), Value(id));
+
+            if (method->GetMetrics()) {
+                // timed until the method completes; the metrics outlive a method removed meanwhile
+                callback = [metrics = method->GetMetrics(), start, callback](Response response) {
+                    metrics->Record(start, response);
+                    callback(std::move(response));
+                };
             }
-            catch (const std::exception& ex) {
-                return Response(0, ex.what(), Value(id));
+
+            Completion completion(std::move(callback), Value(id));
+            try {
+                (*method)(parameters, completion);
             }
             catch (...) {
-                return Response(0, "unknown error", Value(id));
+                completion.Fail(std::current_exception());
             }
         }
 
+        void InvokeAsync(Request& request, Completion::Callback callback) const {
+            auto table = myTable.Read();
+            auto method = FindMethod(table.Get(), request.GetMethodName());
+            if (method && request.HasNamedParameters()) {
+                try {
+                    method->ArrangeParameters(request);
+                }
+                catch (...) {
+                    callback(MakeFaultResponse(std::current_exception(), request.GetId()));
+                    return;
+                }
+            }
+            InvokeAsync(request.GetMethodName(), request.GetParameters(), request.GetId(), std::move(callback));
+        }
+
     private:
-        template<typename ReturnType, typename... ParameterTypes>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<ReturnType(ParameterTypes...)> method) {
-            return AddMethodInternal(std::move(name), std::move(method), redi::index_sequence_for < ParameterTypes... > {});
+        struct IndexEntry {
+            size_t hash = 0;
+            const std::string* name = nullptr;
+            const MethodWrapper* method = nullptr;
+        };
+
+        struct Table {
+            std::vector<std::pair<std::string, std::shared_ptr<const MethodWrapper>>> myMethods;
+            std::vector<IndexEntry> myIndex;
+        };
+
+        template<typename Signature, typename Function>
+        MethodWrapper& AddTypedMethod(std::string name, Function function) {
+            return AddMethodWrapper(std::move(name), std::make_shared<MethodWrapper>(
+                std::unique_ptr<const MethodInvoker>(new TypedMethodInvoker<Function, Signature>(std::move(function)))));
         }
 
-        template<typename... ParameterTypes>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<void(ParameterTypes...)> method) {
-            std::function<Value(ParameterTypes...)> returnMethod = [method](ParameterTypes&&... params) -> Value {
-                method(std::forward<ParameterTypes>(params)...);
-                return Value();
-            };
-            return AddMethodInternal(std::move(name), std::move(returnMethod), redi::index_sequence_for < ParameterTypes... > {});
+        // FNV-1a
+        static size_t Hash(string_view name) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (auto c : name) {
+                hash ^= static_cast<uint8_t>(c);
+                hash *= 1099511628211ULL;
+            }
+            return static_cast<size_t>(hash);
         }
 
-        template<typename ReturnType, typename... ParameterTypes, std::size_t... index>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<ReturnType(ParameterTypes...)> method, redi::index_sequence<index...>) {
-            MethodWrapper::Method realMethod = [method](const Request::Parameters& params) -> Value {
-                if (params.size() != sizeof...(ParameterTypes)) {
-                    throw InvalidParametersFault();
+        MethodWrapper& AddMethodWrapper(std::string name, std::shared_ptr<MethodWrapper> wrapper) {
+            std::lock_guard<std::mutex> lock(myMutex);
+            return AddMethodWrapperLocked(std::move(name), std::move(wrapper), myHasMetrics);
+        }
+
+        MethodWrapper& AddMethodWrapperLocked(std::string name, std::shared_ptr<MethodWrapper> wrapper, bool hasMetrics) {
+            if (hasMetrics) {
+                wrapper->myMetrics = std::make_shared<MethodMetrics>();
+            }
+            auto result = myMethods.emplace(std::move(name), std::move(wrapper));
+            if (!result.second) {
+                throw std::invalid_argument(result.first->first + ": method already added");
+            }
+            result.first->second->myDispatcher = this;
+            Publish();
+            return *result.first->second;
+        }
+
+        friend class MethodWrapper;
+
+        void Republish(MethodWrapper& method) {
+            std::lock_guard<std::mutex> lock(myMutex);
+            method.mySnapshot = nullptr;
+            Publish();
+        }
+
+        static Response InvokeSync(const MethodWrapper* method, string_view name, const Request::Parameters& parameters, const Value& id) {
+            if (method != nullptr && method->GetMetrics()) {
+                const auto start = MethodMetrics::Clock::now();
+                Response response = Call(method, name, parameters, id);
+                method->GetMetrics()->Record(start, response);
+                return response;
+            }
+            return Call(method, name, parameters, id);
+        }
+
+        static Response Call(const MethodWrapper* method, string_view name, const Request::Parameters& parameters, const Value& id) {
+            try {
+                if (method == nullptr) {
+                    throw MethodNotFoundFault("Method not found: " + std::string(name.data(), name.size()));
+                }
+                if (auto& cache = method->GetCache()) {
+                    const auto hash = ResponseCache::Hash(parameters);
+                    auto result = cache->Find(hash, parameters);
+                    if (!result) {
+                        result = cache->Insert(hash, Request::Parameters(parameters), (*method)(parameters));
+                    }
+                    return{ std::move(result), Value(id) };
+                }
+                return{ (*method)(parameters), Value(id) };
+            }
+            catch (...) {
+                return MakeFaultResponse(std::current_exception(), id);
+            }
+        }
+
+        static Response InvokeAndWait(const MethodWrapper& method, const Request::Parameters& parameters, const Value& id) {
+            if (method.GetMetrics()) {
+                const auto start = MethodMetrics::Clock::now();
+                Response response = CallAndWait(method, parameters, id);
+                method.GetMetrics()->Record(start, response);
+                return response;
+            }
+            return CallAndWait(method, parameters, id);
+        }
+
+        static Response CallAndWait(const MethodWrapper& method, const Request::Parameters& parameters, const Value& id) {
+            auto& cache = method.GetCache();
+            uint64_t hash = 0;
+            if (cache) {
+                hash = ResponseCache::Hash(parameters);
+                if (auto result = cache->Find(hash, parameters)) {
+                    return{ std::move(result), Value(id) };
                 }
-                return method(params[index].AsType<typename std::decay<ParameterTypes>::type>()...);
+            }
+
+            // shared with the completion, which may still be running when the wait is over
+            struct Result {
+                std::mutex myMutex;
+                std::condition_variable myDone;
+                std::unique_ptr<Response> myResponse;
             };
-            return AddMethod(std::move(name), std::move(realMethod));
+            auto result = std::make_shared<Result>();
+
+            {
+                // not kept past this block, so that a method that drops its completion still ends the wait
+                Completion completion([result](Response response) {
+                    std::lock_guard<std::mutex> lock(result->myMutex);
+                    result->myResponse.reset(new Response(std::move(response)));
+                    result->myDone.notify_one();
+                }, Value(id));
+
+                try {
+                    method(parameters, completion);
+                }
+                catch (...) {
+                    completion.Fail(std::current_exception());
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(result->myMutex);
+            result->myDone.wait(lock, [&result]() { return result->myResponse != nullptr; });
+            auto& response = *result->myResponse;
+            if (cache && !response.IsFault()) {
+                return{ cache->Insert(hash, Request::Parameters(parameters), std::move(response.GetResult())), Value(id) };
+            }
+            return std::move(response);
+        }
+
+        // The method is valid as long as the read section of table; a long call there only holds
+        // back the deletion of the tables published meanwhile, and may itself add or remove methods
+        static const MethodWrapper* FindMethod(const Table* table, string_view name) {
+            if (table == nullptr) {
+                return nullptr;
+            }
+
+            auto& index = table->myIndex;
+            const size_t hash = Hash(name);
+            const size_t mask = index.size() - 1;
+            for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+                auto& entry = index[slot];
+                if (entry.method == nullptr) {
+                    return nullptr;
+                }
+                if (entry.hash == hash && string_view(*entry.name) == name) {
+                    return entry.method;
+                }
+            }
+        }
+
+        // The lookup table is an open-addressing hash table over the methods, kept at most half
+        // full. A new one is built and published whenever a method is added, removed or changed,
+        // so it is effectively frozen once registration is over and Invoke never allocates. Only
+        // the changed methods get a new snapshot. Called with myMutex held.
+        void Publish() {
+            size_t capacity = 8;
+            while (capacity < 2 * myMethods.size()) {
+                capacity *= 2;
+            }
+
+            std::unique_ptr<Table> table(new Table());
+            table->myMethods.reserve(myMethods.size());
+            table->myIndex.resize(capacity);
+            const size_t mask = capacity - 1;
+            for (auto& method : myMethods) {
+                if (!method.second->mySnapshot) {
+                    method.second->mySnapshot = method.second->MakeSnapshot();
+                }
+                table->myMethods.emplace_back(method.first, method.second->mySnapshot);
+                auto& entry = table->myMethods.back();
+
+                const size_t hash = Hash(entry.first);
+                size_t slot = hash & mask;
+                while (table->myIndex[slot].method != nullptr) {
+                    slot = (slot + 1) & mask;
+                }
+                table->myIndex[slot].hash = hash;
+                table->myIndex[slot].name = &entry.first;
+                table->myIndex[slot].method = entry.second.get();
+            }
+            myTable.Publish(std::move(table));
+        }
+
+        static Value StatisticsToValue(const std::map<std::string, MethodStatistics>& statistics) {
+            auto microseconds = [](uint64_t nanoseconds) { return Value(nanoseconds / 1000.0); };
+
+            Value::Struct methods;
+            for (auto& entry : statistics) {
+                auto& method = entry.second;
+                Value::Struct faults;
+                for (auto& fault : method.myFaultCounts) {
+                    faults.emplace(std::to_string(fault.first), Value(static_cast<int64_t>(fault.second)));
+                }
+
+                auto& histogram = method.myLatency;
+                Value::Struct latency;
+                latency.emplace("mean", Value(method.myCallCount == 0 ? 0.0 : method.myTotalNanoseconds / 1000.0 / method.myCallCount));
+                latency.emplace("p50", microseconds(histogram.GetPercentile(50)));
+                latency.emplace("p90", microseconds(histogram.GetPercentile(90)));
+                latency.emplace("p99", microseconds(histogram.GetPercentile(99)));
+                latency.emplace("p99.9", microseconds(histogram.GetPercentile(99.9)));
+                latency.emplace("max", microseconds(histogram.GetMax()));
+
+                Value::Struct fields;
+                fields.emplace("calls", Value(static_cast<int64_t>(method.myCallCount)));
+                fields.emplace("faults", Value(static_cast<int64_t>(method.myFaultCount)));
+                fields.emplace("faults_by_code", Value(std::move(faults)));
+                fields.emplace("latency_us", Value(std::move(latency)));
+                methods.emplace(entry.first, Value(std::move(fields)));
+            }
+            return Value(std::move(methods));
         }
 
-        std::map<std::string, MethodWrapper> myMethods;
+        // registration side, guarded by myMutex; Invoke only reads myTable
+        mutable std::mutex myMutex;
+        std::map<std::string, std::shared_ptr<MethodWrapper>> myMethods;
+        bool myHasMetrics = false;
+        util::RcuPointer<Table> myTable;
     };
 
+    inline void MethodWrapper::Changed() {
+        if (myDispatcher != nullptr) {
+            myDispatcher->Republish(*this);
+        }
+    }
+
 } // namespace jsonrpc
 
 #endif // JSONRPC_LEAN_DISPATCHER_H
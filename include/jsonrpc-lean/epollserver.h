@@ -0,0 +1,603 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_EPOLLSERVER_H
+#define JSONRPC_LEAN_EPOLLSERVER_H
+
+#ifndef __linux__
+#error "epollserver.h is only available on Linux"
+#endif
+
+#include "framing.h"
+#include "jsonformathandler.h"
+#include "server.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+namespace jsonrpc {
+
+    // Serves a Server over TCP and Unix domain stream sockets from a number of reactor threads, each
+    // running its own epoll loop over the connections it accepted. TCP listeners are opened once per
+    // thread with SO_REUSEPORT, so the kernel spreads the connections over the threads; a Unix domain
+    // listener is shared by all of them. Every connection carries framed messages (see FramedConnection)
+    // and may pipeline requests: they are handled in the order received and their responses are sent
+    // in that order. A connection is not read from while too many response bytes wait to be sent to it.
+    //
+    // Methods run on the reactor thread of their connection; an asynchronous method keeps that thread
+    // waiting until it completes. Errors of the sockets set up are thrown as std::system_error.
+    class EpollServer {
+    public:
+        static const size_t DEFAULT_MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+
+        explicit EpollServer(Server& server) : myServer(server) {}
+
+        ~EpollServer() {
+            Stop();
+        }
+
+        EpollServer(const EpollServer&) = delete;
+        EpollServer& operator=(const EpollServer&) = delete;
+
+        // The options below must be set before Start
+        // Number of reactor threads; 0 (the default) is one per hardware thread
+        void SetThreadCount(size_t count) {
+            myThreadCount = count;
+        }
+
+        void SetFraming(Framing framing, std::string contentType = APPLICATION_JSON) {
+            myFraming = framing;
+            myContentType = std::move(contentType);
+        }
+
+        // Connections sending a bigger message are closed
+        void SetMaxMessageSize(size_t size) {
+            myMaxMessageSize = size;
+        }
+
+        // A connection is not read from while more response bytes than this wait to be sent, and is
+        // read again once half of them have been sent. It is checked after every read, so the
+        // responses to the requests of one read may go over it.
+        void SetMaxPendingOutput(size_t size) {
+            myMaxPendingOutput = size;
+        }
+
+        // Listens on host (empty for any address) and port (0 for any free one); returns the port
+        uint16_t ListenTcp(const std::string& host, uint16_t port) {
+            addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+            addrinfo* addresses = nullptr;
+            const std::string service = std::to_string(port);
+            const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &addresses);
+            if (error != 0) {
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                    std::string("getaddrinfo: ") + gai_strerror(error));
+            }
+            std::unique_ptr<addrinfo, void(*)(addrinfo*)> guard(addresses, freeaddrinfo);
+
+            Listener listener;
+            memcpy(&listener.myAddress, addresses->ai_addr, addresses->ai_addrlen);
+            listener.myAddressSize = addresses->ai_addrlen;
+            listener.myFds.push_back(OpenTcpListener(listener));
+
+            // with port 0, the other threads must listen on the port picked for the first one
+            if (getsockname(listener.myFds.front(), reinterpret_cast<sockaddr*>(&listener.myAddress), &listener.myAddressSize) != 0) {
+                const int savedErrno = errno;
+                close(listener.myFds.front());
+                throw std::system_error(savedErrno, std::system_category(), "getsockname");
+            }
+
+            myListeners.push_back(std::move(listener));
+            const auto& address = myListeners.back().myAddress;
+            return ntohs(address.ss_family == AF_INET6
+                ? reinterpret_cast<const sockaddr_in6&>(address).sin6_port
+                : reinterpret_cast<const sockaddr_in&>(address).sin_port);
+        }
+
+        // Listens on a Unix domain socket created at path (which must not exist yet); it is
+        // removed again by Stop
+        void ListenUnix(const std::string& path) {
+            sockaddr_un address = {};
+            if (path.size() >= sizeof(address.sun_path)) {
+                throw std::system_error(std::make_error_code(std::errc::filename_too_long), "ListenUnix");
+            }
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+            const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw std::system_error(errno, std::system_category(), "socket");
+            }
+            if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+                const int savedErrno = errno;
+                close(fd);
+                throw std::system_error(savedErrno, std::system_category(), "ListenUnix");
+            }
+
+            Listener listener;
+            listener.myFds.push_back(fd);
+            listener.myPath = path;
+            myListeners.push_back(std::move(listener));
+        }
+
+        // Starts the reactor threads
+        void Start() {
+            size_t threadCount = myThreadCount;
+            if (threadCount == 0) {
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            std::vector<std::unique_ptr<Reactor>> reactors;
+            for (size_t i = 0; i < threadCount; ++i) {
+                reactors.emplace_back(new Reactor(*this));
+                for (auto& listener : myListeners) {
+                    if (!listener.myPath.empty()) {
+                        reactors.back()->AddListener(listener.myFds.front(), true);
+                        continue;
+                    }
+                    if (i == listener.myFds.size()) {
+                        listener.myFds.push_back(OpenTcpListener(listener));
+                    }
+                    reactors.back()->AddListener(listener.myFds[i], false);
+                }
+            }
+
+            myReactors = std::move(reactors);
+            for (auto& reactor : myReactors) {
+                Reactor* r = reactor.get();
+                myThreads.emplace_back([r]() { r->Run(); });
+            }
+        }
+
+        // Stops the reactor threads and closes the connections and listeners
+        void Stop() {
+            for (auto& reactor : myReactors) {
+                reactor->Wake();
+            }
+            for (auto& thread : myThreads) {
+                thread.join();
+            }
+            myThreads.clear();
+            myReactors.clear();
+
+            for (auto& listener : myListeners) {
+                for (int fd : listener.myFds) {
+                    close(fd);
+                }
+                if (!listener.myPath.empty()) {
+                    unlink(listener.myPath.c_str());
+                }
+            }
+            myListeners.clear();
+        }
+
+        size_t GetConnectionCount() const {
+            return myConnectionCount.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // A TCP listener has one socket per reactor, a Unix domain one a single shared socket
+        struct Listener {
+            std::vector<int> myFds;
+            sockaddr_storage myAddress = {};
+            socklen_t myAddressSize = 0;
+            std::string myPath;
+        };
+
+        static int OpenTcpListener(const Listener& listener) {
+            const int fd = socket(listener.myAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw std::system_error(errno, std::system_category(), "socket");
+            }
+            const int on = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+                bind(fd, reinterpret_cast<const sockaddr*>(&listener.myAddress), listener.myAddressSize) != 0 ||
+                listen(fd, SOMAXCONN) != 0) {
+                const int savedErrno = errno;
+                close(fd);
+                throw std::system_error(savedErrno, std::system_category(), "ListenTcp");
+            }
+            return fd;
+        }
+
+        class Reactor {
+        public:
+            explicit Reactor(EpollServer& owner) : myOwner(owner) {
+                myEpollFd = epoll_create1(EPOLL_CLOEXEC);
+                if (myEpollFd < 0) {
+                    throw std::system_error(errno, std::system_category(), "epoll_create1");
+                }
+                myWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (myWakeFd < 0) {
+                    const int savedErrno = errno;
+                    close(myEpollFd);
+                    throw std::system_error(savedErrno, std::system_category(), "eventfd");
+                }
+                Watch(myWakeFd, EPOLLIN);
+                OpenReserve();
+            }
+
+            ~Reactor() {
+                for (auto& entry : myConnections) {
+                    close(entry.first);
+                    myOwner.myConnectionCount.fetch_sub(1, std::memory_order_relaxed);
+                }
+                if (myReserveFd >= 0) {
+                    close(myReserveFd);
+                }
+                close(myWakeFd);
+                close(myEpollFd);
+            }
+
+            Reactor(const Reactor&) = delete;
+            Reactor& operator=(const Reactor&) = delete;
+
+            // exclusive: the listener is shared with the other reactors, only one of them is woken up
+            void AddListener(int fd, bool exclusive) {
+                const uint32_t events = static_cast<uint32_t>(EPOLLIN) | (exclusive ? static_cast<uint32_t>(EPOLLEXCLUSIVE) : 0u);
+                ListenSocket listener{ fd, events, false };
+                Watch(fd, listener.myEvents);
+                myListenSockets.push_back(listener);
+            }
+
+            void Wake() {
+                const uint64_t one = 1;
+                while (write(myWakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+                }
+            }
+
+            void Run() {
+                epoll_event events[64];
+                for (;;) {
+                    // paused listeners come back on time even while events keep arriving
+                    int timeout = -1;
+                    if (myPausedCount > 0) {
+                        const auto now = Clock::now();
+                        if (now >= myResumeTime) {
+                            ResumeListeners();
+                        }
+                        if (myPausedCount > 0) {
+                            // rounded up, so that the wait does not end just before the deadline
+                            timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                myResumeTime - now).count()) + 1;
+                        }
+                    }
+
+                    const int count = epoll_wait(myEpollFd, events, 64, timeout);
+                    if (count < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        return;
+                    }
+
+                    for (int i = 0; i < count; ++i) {
+                        const int fd = events[i].data.fd;
+                        if (fd == myWakeFd) {
+                            return;
+                        }
+                        auto listener = std::find_if(myListenSockets.begin(), myListenSockets.end(),
+                            [fd](const ListenSocket& l) { return l.myFd == fd; });
+                        if (listener != myListenSockets.end()) {
+                            Accept(*listener);
+                            continue;
+                        }
+
+                        auto connection = myConnections.find(fd);
+                        if (connection != myConnections.end()) {
+                            Serve(*connection->second, events[i].events);
+                        }
+                    }
+                }
+            }
+
+        private:
+            typedef std::chrono::steady_clock Clock;
+
+            struct Connection {
+                Connection(EpollServer& owner, int fd)
+                    : myFd(fd),
+                    myFramed(owner.myServer, owner.myFraming, owner.myContentType, owner.myMaxMessageSize) {
+                }
+
+                int myFd;
+                FramedConnection myFramed;
+                std::string myOutput;
+                size_t mySent = 0;
+                uint32_t myEvents = EPOLLIN;
+                bool myIsReading = true;
+                bool myIsPaused = false;
+            };
+
+            struct ListenSocket {
+                int myFd;
+                uint32_t myEvents;
+                bool myIsPaused;
+            };
+
+            // reads per readiness event, so that a busy connection does not starve the others
+            static const int MAX_READS = 16;
+
+            // how long a listener that could not accept stays out of the epoll set
+            static const int ACCEPT_RETRY_MILLISECONDS = 100;
+
+            void Watch(int fd, uint32_t events) {
+                epoll_event event = {};
+                event.events = events;
+                event.data.fd = fd;
+                if (epoll_ctl(myEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                    throw std::system_error(errno, std::system_category(), "epoll_ctl");
+                }
+            }
+
+            void Accept(ListenSocket& listener) {
+                for (;;) {
+                    const int fd = accept4(listener.myFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) {
+                            continue;
+                        }
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            return;
+                        }
+                        if ((errno == EMFILE || errno == ENFILE) && myReserveFd >= 0) {
+                            // out of descriptors: the reserved one makes room to accept the connection
+                            // and close it at once, otherwise the listener would stay ready forever
+                            close(myReserveFd);
+                            const int dropped = accept4(listener.myFd, nullptr, nullptr, SOCK_CLOEXEC);
+                            if (dropped >= 0) {
+                                close(dropped);
+                            }
+                            myReserveFd = -1;
+                            OpenReserve();
+                            if (dropped >= 0) {
+                                continue;
+                            }
+                        }
+                        // the listener would stay ready (and the loop busy), so it is left out of the
+                        // epoll set until a connection closes or ACCEPT_RETRY_MILLISECONDS pass
+                        PauseListener(listener);
+                        return;
+                    }
+
+                    const int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // fails harmlessly on Unix sockets
+
+                    try {
+                        std::unique_ptr<Connection> connection(new Connection(myOwner, fd));
+                        Watch(fd, connection->myEvents);
+                        myConnections.emplace(fd, std::move(connection));
+                        myOwner.myConnectionCount.fetch_add(1, std::memory_order_relaxed);
+                    } catch (...) {
+                        close(fd);
+                    }
+                }
+            }
+
+            void Serve(Connection& connection, uint32_t events) {
+                try {
+                    if ((events & EPOLLERR) != 0) {
+                        Close(connection);
+                        return;
+                    }
+                    if ((events & (EPOLLIN | EPOLLHUP)) != 0 && connection.myIsReading && !connection.myIsPaused) {
+                        if (!Read(connection)) {
+                            Close(connection);
+                            return;
+                        }
+                    }
+                    if (!Write(connection)) {
+                        Close(connection);
+                        return;
+                    }
+                    Update(connection);
+                } catch (...) {
+                    // whatever handling a message throws (bad_alloc, a format handler's own
+                    // exception, ...) only costs its connection, never the reactor thread
+                    Close(connection);
+                }
+            }
+
+            // false if the connection failed
+            bool Read(Connection& connection) {
+                for (int i = 0; i < MAX_READS; ++i) {
+                    size_t capacity;
+                    char* buffer = connection.myFramed.GetReceiveBuffer(capacity);
+                    const ssize_t size = recv(connection.myFd, buffer, capacity, 0);
+                    if (size < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        return errno == EAGAIN || errno == EWOULDBLOCK;
+                    }
+                    if (size == 0 || !connection.myFramed.Received(size, connection.myOutput)) {
+                        // end of stream or unreadable framing: the responses so far are sent, then it is closed
+                        connection.myIsReading = false;
+                        return true;
+                    }
+                    if (connection.myOutput.size() - connection.mySent > myOwner.myMaxPendingOutput ||
+                        static_cast<size_t>(size) < capacity) {
+                        return true;
+                    }
+                }
+                return true;
+            }
+
+            // false if the connection failed
+            bool Write(Connection& connection) {
+                auto& output = connection.myOutput;
+                while (connection.mySent < output.size()) {
+                    const ssize_t size = send(connection.myFd, output.data() + connection.mySent,
+                        output.size() - connection.mySent, MSG_NOSIGNAL);
+                    if (size < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            break;
+                        }
+                        return false;
+                    }
+                    connection.mySent += size;
+                }
+
+                if (connection.mySent == output.size()) {
+                    output.clear();
+                    connection.mySent = 0;
+                } else if (connection.mySent >= output.size() / 2) {
+                    // the rest is moved to the front once it is smaller than what was sent
+                    output.erase(0, connection.mySent);
+                    connection.mySent = 0;
+                }
+                return true;
+            }
+
+            void Update(Connection& connection) {
+                const size_t pending = connection.myOutput.size() - connection.mySent;
+                if (!connection.myIsReading && pending == 0) {
+                    Close(connection);
+                    return;
+                }
+
+                if (pending > myOwner.myMaxPendingOutput) {
+                    connection.myIsPaused = true;
+                } else if (pending <= myOwner.myMaxPendingOutput / 2) {
+                    connection.myIsPaused = false;
+                }
+
+                uint32_t events = 0;
+                if (connection.myIsReading && !connection.myIsPaused) {
+                    events |= EPOLLIN;
+                }
+                if (pending > 0) {
+                    events |= EPOLLOUT;
+                }
+                if (events != connection.myEvents) {
+                    epoll_event event = {};
+                    event.events = events;
+                    event.data.fd = connection.myFd;
+                    if (epoll_ctl(myEpollFd, EPOLL_CTL_MOD, connection.myFd, &event) != 0) {
+                        Close(connection);
+                        return;
+                    }
+                    connection.myEvents = events;
+                }
+            }
+
+            void Close(Connection& connection) {
+                const int fd = connection.myFd;
+                close(fd);
+                myConnections.erase(fd);
+                myOwner.myConnectionCount.fetch_sub(1, std::memory_order_relaxed);
+                OpenReserve();
+                if (myPausedCount > 0) {
+                    ResumeListeners();
+                }
+            }
+
+            void PauseListener(ListenSocket& listener) {
+                if (!listener.myIsPaused && epoll_ctl(myEpollFd, EPOLL_CTL_DEL, listener.myFd, nullptr) == 0) {
+                    listener.myIsPaused = true;
+                    if (myPausedCount++ == 0) {
+                        ScheduleResume();
+                    }
+                }
+            }
+
+            void ScheduleResume() {
+                const int delay = ACCEPT_RETRY_MILLISECONDS; // a copy, so that the constant needs no definition
+                myResumeTime = Clock::now() + std::chrono::milliseconds(delay);
+            }
+
+            // Another thread may have taken the descriptor Accept freed, so this is retried
+            // whenever one may have become available again
+            void OpenReserve() {
+                if (myReserveFd < 0) {
+                    myReserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                }
+            }
+
+            void ResumeListeners() {
+                OpenReserve();
+                for (auto& listener : myListenSockets) {
+                    if (listener.myIsPaused) {
+                        epoll_event event = {};
+                        event.events = listener.myEvents;
+                        event.data.fd = listener.myFd;
+                        if (epoll_ctl(myEpollFd, EPOLL_CTL_ADD, listener.myFd, &event) == 0) {
+                            listener.myIsPaused = false;
+                            --myPausedCount;
+                        }
+                    }
+                }
+                if (myPausedCount > 0) {
+                    ScheduleResume();
+                }
+            }
+
+            EpollServer& myOwner;
+            int myEpollFd;
+            int myWakeFd;
+            int myReserveFd = -1;
+            std::vector<ListenSocket> myListenSockets;
+            size_t myPausedCount = 0;
+            Clock::time_point myResumeTime; // when the paused listeners are added back
+            std::unordered_map<int, std::unique_ptr<Connection>> myConnections;
+        };
+
+        Server& myServer;
+        size_t myThreadCount = 0;
+        Framing myFraming = Framing::NEWLINE;
+        std::string myContentType = APPLICATION_JSON;
+        size_t myMaxMessageSize = FrameReader::DEFAULT_MAX_MESSAGE_SIZE;
+        size_t myMaxPendingOutput = DEFAULT_MAX_PENDING_OUTPUT;
+
+        std::vector<Listener> myListeners;
+        std::vector<std::unique_ptr<Reactor>> myReactors;
+        std::vector<std::thread> myThreads;
+        std::atomic<size_t> myConnectionCount{ 0 };
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_EPOLLSERVER_H
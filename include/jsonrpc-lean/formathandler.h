@@ -20,11 +20,17 @@
 #ifndef JSONRPC_LEAN_FORMATHANDLER_H
 #define JSONRPC_LEAN_FORMATHANDLER_H
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
 namespace jsonrpc {
 
+    namespace util {
+        class OutputBuffer;
+        class StringOutput;
+    } // namespace util
+
     class Reader;
     class Writer;
 
@@ -37,6 +43,28 @@ namespace jsonrpc {
         virtual bool UsesId() = 0;
         virtual std::unique_ptr<Reader> CreateReader(const std::string& data) = 0;
         virtual std::unique_ptr<Writer> CreateWriter() = 0;
+
+        // Reader over a mutable, null-terminated buffer owned by the caller, which must outlive
+        // the reader and the values read from it. Formats without an in-place parser fall back to copying.
+        virtual std::unique_ptr<Reader> CreateInsituReader(char* data) {
+            return CreateReader(std::string(data));
+        }
+
+        // Same as above for size bytes of data followed by a NUL, for formats whose messages may
+        // contain NULs themselves
+        virtual std::unique_ptr<Reader> CreateInsituReader(char* data, size_t /*size*/) {
+            return CreateInsituReader(data);
+        }
+
+        // Writers into an output owned by the caller, which must outlive them.
+        // nullptr if the format does not support it (the output is then copied).
+        virtual std::unique_ptr<Writer> CreateWriter(util::StringOutput& /*output*/) {
+            return nullptr;
+        }
+
+        virtual std::unique_ptr<Writer> CreateWriter(util::OutputBuffer& /*output*/) {
+            return nullptr;
+        }
     };
 
 } // namespace jsonrpc
@@ -19,6 +19,8 @@
 #ifndef JSONRPC_LEAN_REQUEST_DATA_H
 #define JSONRPC_LEAN_REQUEST_DATA_H
 
+#include <cstddef>
+
 namespace jsonrpc {
 
     class FormattedData {
@@ -30,6 +32,19 @@ namespace jsonrpc {
         virtual size_t GetSize() = 0;
     };
 
+    // Refers to data owned by someone else
+    class FormattedDataView final : public FormattedData {
+    public:
+        FormattedDataView(const char* data, size_t size) : myData(data), mySize(size) {}
+
+        const char* GetData() override { return myData; }
+        size_t GetSize() override { return mySize; }
+
+    private:
+        const char* myData;
+        size_t mySize;
+    };
+
 } // namespace jsonrpc
 
 #endif // JSONRPC_LEAN_REQUEST_DATA_H
\ No newline at end of file
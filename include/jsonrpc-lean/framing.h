@@ -0,0 +1,391 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_FRAMING_H
+#define JSONRPC_LEAN_FRAMING_H
+
+#include "jsonformathandler.h"
+#include "server.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace jsonrpc {
+
+    // How messages are delimited on a byte stream
+    enum class Framing {
+        // One message per line (NDJSON); only for formats that never write a raw newline, like JSON
+        NEWLINE,
+        // "Content-Length: <size>\r\n" and other header lines, an empty line, then the message (as in LSP)
+        CONTENT_LENGTH,
+        // The size of the message as a 32 bit big-endian integer, then the message
+        LENGTH_PREFIX
+    };
+
+    // Cuts a byte stream into messages. The transport receives straight into the buffer returned by
+    // GetReceiveBuffer, so bytes are never copied out of it: a message is handed over in place once
+    // it is complete and every byte is looked at once, however the stream was split into reads.
+    // Not thread safe, use one per connection.
+    class FrameReader {
+    public:
+        static const size_t DEFAULT_MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+        static const size_t DEFAULT_RECEIVE_SIZE = 16 * 1024;
+        static const size_t MAX_HEADER_SIZE = 4096;
+
+        explicit FrameReader(Framing framing, size_t maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE)
+            : myFraming(framing),
+            myMaxMessageSize(maxMessageSize) {
+        }
+
+        FrameReader(const FrameReader&) = delete;
+        FrameReader& operator=(const FrameReader&) = delete;
+
+        // Room for the next read: at least DEFAULT_RECEIVE_SIZE bytes, or the rest of the message
+        // being received if that is bigger, so that it ends up contiguous without being moved
+        char* GetReceiveBuffer(size_t& capacity) {
+            size_t wanted = DEFAULT_RECEIVE_SIZE;
+            if (myFrameSize != NO_FRAME) {
+                wanted = std::max(wanted, myFrameSize - (myEnd - myBegin));
+            }
+            Reserve(wanted);
+            capacity = myCapacity - myEnd - 1;
+            return myBuffer.get() + myEnd;
+        }
+
+        // Marks size bytes of the receive buffer as received and calls handler(char* data, size_t size)
+        // for every message now complete. data is followed by a NUL and may be modified (e.g. parsed
+        // in place) until the handler returns. Returns false once the stream cannot be read any further
+        // (a message above the maximum size, a malformed header, or the handler returned false);
+        // the connection should then be closed.
+        template<typename Handler>
+        bool Received(size_t size, Handler&& handler) {
+            myEnd += size;
+            while (!myIsBroken && myBegin != myEnd) {
+                if (myFrameSize == NO_FRAME && !ReadHeader()) {
+                    break;
+                }
+                if (myEnd - myBegin < myFrameSize) {
+                    break;
+                }
+
+                char* data = myBuffer.get() + myBegin + myHeaderSize;
+                const size_t dataSize = myDataSize;
+                myBegin += myFrameSize;
+                myFrameSize = NO_FRAME;
+                myScanned = 0;
+
+                if (dataSize == 0) {
+                    continue;
+                }
+
+                // the byte after the message may be the start of the next one
+                struct Terminator {
+                    char* myPosition;
+                    char mySaved;
+                    ~Terminator() { *myPosition = mySaved; }
+                } terminator{ data + dataSize, data[dataSize] };
+                data[dataSize] = '\0';
+
+                if (!handler(data, dataSize)) {
+                    myIsBroken = true;
+                }
+            }
+            if (myBegin == myEnd) {
+                myBegin = myEnd = 0;
+            }
+            return !myIsBroken;
+        }
+
+        // Same as Received, for data received somewhere else; it is copied into the buffer once
+        template<typename Handler>
+        bool Consume(const char* data, size_t size, Handler&& handler) {
+            while (size > 0) {
+                size_t capacity;
+                char* buffer = GetReceiveBuffer(capacity);
+                const size_t count = std::min(size, capacity);
+                memcpy(buffer, data, count);
+                if (!Received(count, handler)) {
+                    return false;
+                }
+                data += count;
+                size -= count;
+            }
+            return !myIsBroken;
+        }
+
+        // Bytes received that are not part of a complete message yet
+        size_t GetPendingSize() const { return myEnd - myBegin; }
+
+    private:
+        static const size_t NO_FRAME = static_cast<size_t>(-1);
+
+        // Sets myHeaderSize, myDataSize and myFrameSize; false if more data is needed or the
+        // stream is broken
+        bool ReadHeader() {
+            const char* begin = myBuffer.get() + myBegin;
+            const size_t available = myEnd - myBegin;
+
+            switch (myFraming) {
+            case Framing::NEWLINE: {
+                auto newline = static_cast<const char*>(memchr(begin + myScanned, '\n', available - myScanned));
+                if (newline == nullptr) {
+                    myScanned = available;
+                    myIsBroken = available > myMaxMessageSize;
+                    return false;
+                }
+                size_t size = newline - begin;
+                myFrameSize = size + 1;
+                if (size > 0 && begin[size - 1] == '\r') {
+                    --size;
+                }
+                myHeaderSize = 0;
+                myDataSize = size;
+                break;
+            }
+
+            case Framing::CONTENT_LENGTH: {
+                // the header ends with an empty line; resume looking where the last read stopped
+                const char* end = nullptr;
+                for (size_t i = myScanned; i < available; ++i) {
+                    auto newline = static_cast<const char*>(memchr(begin + i, '\n', available - i));
+                    if (newline == nullptr) {
+                        break;
+                    }
+                    i = newline - begin;
+                    if (i >= 3 && newline[-1] == '\r' && newline[-2] == '\n' && newline[-3] == '\r') {
+                        end = newline + 1;
+                        break;
+                    }
+                }
+                if (end == nullptr) {
+                    myScanned = available;
+                    myIsBroken = available > MAX_HEADER_SIZE;
+                    return false;
+                }
+                myHeaderSize = end - begin;
+                if (!ReadContentLength(begin, end)) {
+                    myIsBroken = true;
+                    return false;
+                }
+                myFrameSize = myHeaderSize + myDataSize;
+                break;
+            }
+
+            case Framing::LENGTH_PREFIX: {
+                if (available < 4) {
+                    return false;
+                }
+                auto bytes = reinterpret_cast<const unsigned char*>(begin);
+                myHeaderSize = 4;
+                myDataSize = (static_cast<size_t>(bytes[0]) << 24) | (static_cast<size_t>(bytes[1]) << 16) |
+                    (static_cast<size_t>(bytes[2]) << 8) | static_cast<size_t>(bytes[3]);
+                myFrameSize = myHeaderSize + myDataSize;
+                break;
+            }
+            }
+
+            if (myDataSize > myMaxMessageSize) {
+                myIsBroken = true;
+                myFrameSize = NO_FRAME;
+                return false;
+            }
+            return true;
+        }
+
+        // Finds Content-Length among the header lines; the others (e.g. Content-Type) are ignored
+        bool ReadContentLength(const char* begin, const char* end) {
+            static const char NAME[] = "content-length";
+            const size_t nameSize = sizeof(NAME) - 1;
+            bool found = false;
+
+            for (const char* line = begin; line < end; ) {
+                const char* lineEnd = static_cast<const char*>(memchr(line, '\r', end - line));
+                const char* colon = static_cast<const char*>(memchr(line, ':', lineEnd - line));
+                if (colon != nullptr && static_cast<size_t>(colon - line) == nameSize &&
+                    std::equal(line, colon, NAME, [](char a, char b) { return (a | 0x20) == b; })) {
+                    const char* digit = colon + 1;
+                    while (digit < lineEnd && (*digit == ' ' || *digit == '\t')) {
+                        ++digit;
+                    }
+                    size_t size = 0;
+                    const char* digitsBegin = digit;
+                    for (; digit < lineEnd && *digit >= '0' && *digit <= '9'; ++digit) {
+                        size = size * 10 + (*digit - '0');
+                        if (size > myMaxMessageSize) {
+                            return false;
+                        }
+                    }
+                    while (digit < lineEnd && (*digit == ' ' || *digit == '\t')) {
+                        ++digit;
+                    }
+                    if (digit == digitsBegin || digit != lineEnd || found) {
+                        return false;
+                    }
+                    myDataSize = size;
+                    found = true;
+                }
+                line = lineEnd + 2;
+            }
+            return found;
+        }
+
+        // Makes room for size more bytes and the NUL after them. The pending bytes are moved to the
+        // front only when at least as many have been consumed since, otherwise the buffer grows.
+        void Reserve(size_t size) {
+            if (myCapacity - myEnd > size) {
+                return;
+            }
+
+            const size_t pending = myEnd - myBegin;
+            if (pending + size < myCapacity && myBegin >= pending) {
+                memmove(myBuffer.get(), myBuffer.get() + myBegin, pending);
+            } else {
+                const size_t capacity = std::max(myCapacity * 2, pending + size + 1);
+                std::unique_ptr<char[]> buffer(new char[capacity]);
+                if (pending > 0) {
+                    memcpy(buffer.get(), myBuffer.get() + myBegin, pending);
+                }
+                myBuffer = std::move(buffer);
+                myCapacity = capacity;
+            }
+            myBegin = 0;
+            myEnd = pending;
+        }
+
+        Framing myFraming;
+        size_t myMaxMessageSize;
+
+        std::unique_ptr<char[]> myBuffer;
+        size_t myCapacity = 0;
+        size_t myBegin = 0;
+        size_t myEnd = 0;
+
+        // of the message at myBegin, relative to it
+        size_t myScanned = 0;
+        size_t myHeaderSize = 0;
+        size_t myDataSize = 0;
+        size_t myFrameSize = NO_FRAME;
+
+        bool myIsBroken = false;
+    };
+
+    // Frames messages written to a std::string
+    class FrameWriter {
+    public:
+        // Call before the message is appended to output; returns what End needs
+        static size_t Begin(Framing framing, std::string& output) {
+            const size_t start = output.size();
+            if (framing == Framing::LENGTH_PREFIX) {
+                output.append(4, '\0');
+            }
+            return start;
+        }
+
+        // Call after the message is appended. Nothing is written for an empty message (e.g. the
+        // response to a notification). With CONTENT_LENGTH, the header is inserted before the message.
+        static void End(Framing framing, std::string& output, size_t start) {
+            const size_t headerSize = framing == Framing::LENGTH_PREFIX ? 4 : 0;
+            const size_t size = output.size() - start - headerSize;
+            if (size == 0) {
+                output.resize(start);
+                return;
+            }
+
+            switch (framing) {
+            case Framing::NEWLINE:
+                output.push_back('\n');
+                break;
+
+            case Framing::CONTENT_LENGTH: {
+                char header[48];
+                const int length = snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", size);
+                output.insert(start, header, length);
+                break;
+            }
+
+            case Framing::LENGTH_PREFIX:
+                output[start] = static_cast<char>((size >> 24) & 0xff);
+                output[start + 1] = static_cast<char>((size >> 16) & 0xff);
+                output[start + 2] = static_cast<char>((size >> 8) & 0xff);
+                output[start + 3] = static_cast<char>(size & 0xff);
+                break;
+            }
+        }
+
+        static void Write(Framing framing, const char* data, size_t size, std::string& output) {
+            const size_t start = Begin(framing, output);
+            output.append(data, size);
+            End(framing, output, start);
+        }
+    };
+
+    // Serves one stream connection: the requests received are handled by server as they complete
+    // (parsed in place, see Server::HandleRequestInsituInto) and their framed responses are
+    // appended to the output passed in, ready to be sent. Not thread safe, use one per connection.
+    class FramedConnection {
+    public:
+        FramedConnection(Server& server, Framing framing, std::string contentType = APPLICATION_JSON,
+            size_t maxMessageSize = FrameReader::DEFAULT_MAX_MESSAGE_SIZE)
+            : myServer(server),
+            myFraming(framing),
+            myContentType(std::move(contentType)),
+            myReader(framing, maxMessageSize) {
+        }
+
+        // See FrameReader
+        char* GetReceiveBuffer(size_t& capacity) {
+            return myReader.GetReceiveBuffer(capacity);
+        }
+
+        // Returns false if the connection should be closed (see FrameReader::Received, or no
+        // FormatHandler handles the content type)
+        bool Received(size_t size, std::string& output) {
+            return myReader.Received(size, [this, &output](char* data, size_t dataSize) {
+                return Handle(data, dataSize, output);
+            });
+        }
+
+        bool Consume(const char* data, size_t size, std::string& output) {
+            return myReader.Consume(data, size, [this, &output](char* message, size_t messageSize) {
+                return Handle(message, messageSize, output);
+            });
+        }
+
+    private:
+        bool Handle(char* data, size_t size, std::string& output) {
+            const size_t start = FrameWriter::Begin(myFraming, output);
+            if (!myServer.HandleRequestInsituInto(data, size, output, myContentType)) {
+                output.resize(start);
+                return false;
+            }
+            FrameWriter::End(myFraming, output, start);
+            return true;
+        }
+
+        Server& myServer;
+        Framing myFraming;
+        std::string myContentType;
+        FrameReader myReader;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_FRAMING_H
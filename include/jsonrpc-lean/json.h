@@ -36,6 +36,9 @@ namespace jsonrpc {
         const char ERROR_CODE_NAME[] = "code";
         const char ERROR_MESSAGE_NAME[] = "message";
 
+        // BINARY values are written as {"$binary": "<base64>"}
+        const char BINARY_NAME[] = "$binary";
+
     } // namespace json
 } // namespace jsonrpc
 
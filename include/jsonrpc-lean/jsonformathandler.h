@@ -22,6 +22,7 @@
 
 #include "formathandler.h"
 #include "jsonreader.h"
+#include "jsonstreamreader.h"
 #include "jsonwriter.h"
 
 #include <memory>
@@ -32,7 +33,17 @@ namespace jsonrpc {
 
     class JsonFormatHandler : public FormatHandler {
     public:
-        explicit JsonFormatHandler() {}
+        // With streamingReader set, requests are read by JsonStreamReader, which builds the
+        // Request::Parameters while parsing instead of going through a rapidjson::Document first;
+        // typed methods still convert those Values to their parameter types as usual.
+        // Its readers refer to the data they were created from, which must outlive them.
+        explicit JsonFormatHandler(bool streamingReader = false) : myStreamingReader(streamingReader) {}
+
+        // With detection off, strings that look like date-times are read as plain strings (see
+        // Reader::SetDateTimeDetection); set it before the handler is used
+        void SetDateTimeDetection(bool detect) {
+            myDetectDateTime = detect;
+        }
 
         // FormatHandler
         bool CanHandleRequest(const std::string& contentType) override {
@@ -48,15 +59,47 @@ namespace jsonrpc {
         }
 
         std::unique_ptr<Reader> CreateReader(const std::string& data) override {
-            return std::unique_ptr<Reader>(std::make_unique<JsonReader>(std::move(data)));
+            std::unique_ptr<Reader> reader;
+            if (myStreamingReader) {
+                reader = std::make_unique<JsonStreamReader>(data);
+            } else {
+                reader = std::make_unique<JsonReader>(data);
+            }
+            return Configure(std::move(reader));
+        }
+
+        std::unique_ptr<Reader> CreateInsituReader(char* data) override {
+            std::unique_ptr<Reader> reader;
+            if (myStreamingReader) {
+                reader = std::make_unique<JsonStreamReader>(data);
+            } else {
+                reader = std::make_unique<JsonReader>(data);
+            }
+            return Configure(std::move(reader));
         }
 
         std::unique_ptr<Writer> CreateWriter() override {
             return std::unique_ptr<Writer>(std::make_unique<JsonWriter>());
         }
 
+        std::unique_ptr<Writer> CreateWriter(util::StringOutput& output) override {
+            return std::unique_ptr<Writer>(std::make_unique<JsonBufferWriter<util::StringOutput>>(output));
+        }
+
+        std::unique_ptr<Writer> CreateWriter(util::OutputBuffer& output) override {
+            return std::unique_ptr<Writer>(std::make_unique<JsonBufferWriter<util::OutputBuffer>>(output));
+        }
+
     private:
+        std::unique_ptr<Reader> Configure(std::unique_ptr<Reader> reader) const {
+            if (!myDetectDateTime) {
+                reader->SetDateTimeDetection(false);
+            }
+            return reader;
+        }
 
+        bool myStreamingReader;
+        bool myDetectDateTime = true;
     };
 
 } // namespace jsonrpc
@@ -20,18 +20,21 @@
 #define JSONRPC_LEAN_JSONREQUESTDATA_H
 
 #include "formatteddata.h"
+#include "pool.h"
 
 #define RAPIDJSON_NO_SIZETYPEDEFINE
 namespace rapidjson { typedef ::std::size_t SizeType; }
 
-#include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 
 namespace jsonrpc {
 
     class JsonFormattedData final : public FormattedData {
     public:
-        JsonFormattedData() : Writer(myStringBuffer) {
+        // The buffer grows in blocks from the thread's cache (see util::CachedAllocator)
+        typedef rapidjson::GenericStringBuffer<rapidjson::UTF8<>, util::CachedAllocator> Buffer;
+
+        JsonFormattedData() : myStringBuffer(&myAllocator) {
 
         }
 
@@ -43,11 +46,14 @@ namespace jsonrpc {
             return myStringBuffer.GetSize();
         }
 
-        rapidjson::Writer<rapidjson::StringBuffer> Writer;
+        Buffer& GetBuffer() {
+            return myStringBuffer;
+        }
 
     private:
 
-        rapidjson::StringBuffer myStringBuffer;
+        util::CachedAllocator myAllocator;
+        Buffer myStringBuffer;
         
     };
 
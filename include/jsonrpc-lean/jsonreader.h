@@ -23,6 +23,7 @@
 #include "reader.h"
 #include "fault.h"
 #include "json.h"
+#include "pool.h"
 #include "request.h"
 #include "response.h"
 #include "util.h"
@@ -35,8 +36,56 @@ namespace rapidjson { typedef ::std::size_t SizeType; }
 #include <string>
 
 namespace jsonrpc {
+    namespace json {
 
-    class JsonReader final : public Reader {
+        // Documents take their memory (value chunks and the parse stack) from the thread's cache,
+        // so parsing does not allocate in steady state unless a message outgrows the cached blocks
+        typedef rapidjson::MemoryPoolAllocator<util::CachedAllocator> DocumentAllocator;
+        typedef rapidjson::GenericDocument<rapidjson::UTF8<>, DocumentAllocator, util::CachedAllocator> Document;
+        typedef Document::ValueType DocumentValue;
+
+        const size_t DOCUMENT_CHUNK_SIZE = 16 * 1024 - 64; // leaves room for the chunk headers
+        const size_t PARSE_STACK_CAPACITY = 1024;
+
+        // The Value of a JSON string: ISO 8601 date-times become DATE_TIME (if detectDateTime is set)
+        // and strings with an embedded NUL become BINARY. With borrow set the characters (null-terminated,
+        // and they must stay put) are referred to, otherwise they are copied to arena, or to the heap
+        // if there is none.
+        inline Value MakeStringValue(const char* str, size_t size, bool borrow, util::Arena* arena, bool detectDateTime = true) {
+            tm dt;
+            if (detectDateTime && util::ParseIso8601DateTime(str, size, dt)) {
+                return Value(dt, arena);
+            }
+
+            // NUL and non-ASCII bytes are looked for in one pass, merged with the copy if there is one
+            if (borrow) {
+                return Value::Borrow(string_view(str, size), util::ClassifyString(str, size));
+            }
+            if (arena != nullptr) {
+                char* copy = static_cast<char*>(arena->Allocate(size, 1));
+                const util::StringInfo info = util::CopyAndClassifyString(copy, str, size);
+                return Value::Borrow(string_view(copy, size), info);
+            }
+
+            const util::StringInfo info = util::ClassifyString(str, size);
+            return Value(std::string(str, size), info);
+        }
+
+        // The BINARY Value of the base64 text of a {"$binary": ...} object, decoded straight into
+        // the Value's buffer; text that is not base64 is invalid parameters
+        inline Value MakeBinaryValue(const char* base64, size_t size) {
+            char* data;
+            Binary binary = Binary::Allocate(util::Base64DecodedMaxSize(size), data);
+            size_t decodedSize;
+            if (!util::Base64DecodeStrict(base64, size, data, decodedSize)) {
+                throw InvalidParametersFault("Invalid base64 in a $binary value");
+            }
+            return Value(binary.Slice(0, decodedSize));
+        }
+
+    } // namespace json
+
+    class JsonReader final : public Reader, public util::Pooled {
     public:
         JsonReader(const std::string& data) {
             myDocument.Parse(data.c_str());
@@ -46,64 +95,83 @@ namespace jsonrpc {
             }
         }
 
+        // In-situ mode: data is a null-terminated buffer owned by the caller that is parsed (and
+        // modified) in place. String values are not copied, they refer to data (see Value::Borrow),
+        // so data must outlive the reader and every Value it returns.
+        explicit JsonReader(char* data) : myIsInsitu(true) {
+            myDocument.ParseInsitu(data);
+            if (myDocument.HasParseError()) {
+                throw ParseErrorFault(
+                    "Parse error: " + std::to_string(myDocument.GetParseError()));
+            }
+        }
+
         // Reader
         Request GetRequest() override {
-            if (!myDocument.IsObject()) {
-                throw InvalidRequestFault();
-            }
+            return GetRequest(myDocument);
+        }
 
-            ValidateJsonrpcVersion();
+        Response GetResponse() override {
+            return GetResponse(myDocument);
+        }
 
-            auto method = myDocument.FindMember(json::METHOD_NAME);
-            if (method == myDocument.MemberEnd() || !method->value.IsString()) {
-                throw InvalidRequestFault();
-            }
+        Value GetValue() override {
+            return GetValue(myDocument);
+        }
 
-            Request::Parameters parameters;
-            auto params = myDocument.FindMember(json::PARAMS_NAME);
-            if (params != myDocument.MemberEnd()) {
-                if (!params->value.IsArray()) {
-                    throw InvalidRequestFault();
-                }
+        bool IsBatch() override {
+            return myDocument.IsArray();
+        }
 
-                for (auto param = params->value.Begin(); param != params->value.End();
-                    ++param) {
-                    parameters.emplace_back(GetValue(*param));
-                }
+        size_t GetBatchSize() override {
+            return IsBatch() ? myDocument.Size() : 0;
+        }
+
+        Request GetRequest(size_t index) override {
+            if (index >= GetBatchSize()) {
+                throw InvalidRequestFault();
             }
+            return GetRequest(myDocument[index]);
+        }
 
-            auto id = myDocument.FindMember(json::ID_NAME);
-            if (id == myDocument.MemberEnd()) {
-                // Notification
-                return Request(method->value.GetString(), std::move(parameters), false);
+        Response GetResponse(size_t index) override {
+            if (index >= GetBatchSize()) {
+                throw InvalidRequestFault();
             }
+            return GetResponse(myDocument[index]);
+        }
 
-            return Request(method->value.GetString(), std::move(parameters),
-                GetId(id->value));
+        void SetArena(util::Arena* arena) override {
+            myArena = arena;
         }
 
-        Response GetResponse() override {
-            if (!myDocument.IsObject()) {
+        void SetDateTimeDetection(bool detect) override {
+            myDetectDateTime = detect;
+        }
+
+    private:
+        Response GetResponse(const json::DocumentValue& response) const {
+            if (!response.IsObject()) {
                 throw InvalidRequestFault();
             }
 
-            ValidateJsonrpcVersion();
+            ValidateJsonrpcVersion(response);
 
-            auto id = myDocument.FindMember(json::ID_NAME);
-            if (id == myDocument.MemberEnd()) {
+            auto id = response.FindMember(json::ID_NAME);
+            if (id == response.MemberEnd()) {
                 throw InvalidRequestFault();
             }
 
-            auto result = myDocument.FindMember(json::RESULT_NAME);
-            auto error = myDocument.FindMember(json::ERROR_NAME);
+            auto result = response.FindMember(json::RESULT_NAME);
+            auto error = response.FindMember(json::ERROR_NAME);
 
-            if (result != myDocument.MemberEnd()) {
-                if (error != myDocument.MemberEnd()) {
+            if (result != response.MemberEnd()) {
+                if (error != response.MemberEnd()) {
                     throw InvalidRequestFault();
                 }
                 return Response(GetValue(result->value), GetId(id->value));
-            } else if (error != myDocument.MemberEnd()) {
-                if (result != myDocument.MemberEnd()) {
+            } else if (error != response.MemberEnd()) {
+                if (result != response.MemberEnd()) {
                     throw InvalidRequestFault();
                 }
                 if (!error->value.IsObject()) {
@@ -125,21 +193,59 @@ namespace jsonrpc {
             }
         }
 
-        Value GetValue() override {
-            return GetValue(myDocument);
+        Request GetRequest(const json::DocumentValue& request) const {
+            if (!request.IsObject()) {
+                throw InvalidRequestFault();
+            }
+
+            ValidateJsonrpcVersion(request);
+
+            auto method = request.FindMember(json::METHOD_NAME);
+            if (method == request.MemberEnd() || !method->value.IsString()) {
+                throw InvalidRequestFault();
+            }
+
+            Request::Parameters parameters;
+            Request::ParameterNames names;
+            auto params = request.FindMember(json::PARAMS_NAME);
+            if (params != request.MemberEnd()) {
+                if (params->value.IsArray()) {
+                    for (auto param = params->value.Begin(); param != params->value.End();
+                        ++param) {
+                        parameters.emplace_back(GetValue(*param));
+                    }
+                } else if (params->value.IsObject()) {
+                    // by name, kept as a flat list for the dispatcher to put in order
+                    for (auto param = params->value.MemberBegin(); param != params->value.MemberEnd();
+                        ++param) {
+                        names.emplace_back(param->name.GetString(), param->name.GetStringLength());
+                        parameters.emplace_back(GetValue(param->value));
+                    }
+                } else {
+                    throw InvalidRequestFault();
+                }
+            }
+
+            auto id = request.FindMember(json::ID_NAME);
+            if (id == request.MemberEnd()) {
+                // Notification
+                return Request(method->value.GetString(), std::move(parameters), std::move(names), false);
+            }
+
+            return Request(method->value.GetString(), std::move(parameters), std::move(names),
+                GetId(id->value));
         }
 
-    private:
-        void ValidateJsonrpcVersion() const {
-            auto jsonrpc = myDocument.FindMember(json::JSONRPC_NAME);
-            if (jsonrpc == myDocument.MemberEnd()
+        void ValidateJsonrpcVersion(const json::DocumentValue& message) const {
+            auto jsonrpc = message.FindMember(json::JSONRPC_NAME);
+            if (jsonrpc == message.MemberEnd()
                 || !jsonrpc->value.IsString()
                 || strcmp(jsonrpc->value.GetString(), json::JSONRPC_VERSION_2_0) != 0) {
                 throw InvalidRequestFault();
             }
         }
 
-        Value GetValue(const rapidjson::Value& value) const {
+        Value GetValue(const json::DocumentValue& value) const {
             switch (value.GetType()) {
             case rapidjson::kNullType:
                 return Value();
@@ -147,7 +253,14 @@ namespace jsonrpc {
             case rapidjson::kTrueType:
                 return Value(value.GetBool());
             case rapidjson::kObjectType: {
-                Value::Struct data;
+                if (value.MemberCount() == 1) {
+                    auto member = value.MemberBegin();
+                    if (member->value.IsString() && strcmp(member->name.GetString(), json::BINARY_NAME) == 0) {
+                        return json::MakeBinaryValue(member->value.GetString(), member->value.GetStringLength());
+                    }
+                }
+
+                Value::Struct data{ Value::Struct::allocator_type(myArena) };
                 for (auto it = value.MemberBegin(); it != value.MemberEnd(); ++it) {
                     std::string name(it->name.GetString(), it->name.GetStringLength());
                     data.emplace(name, GetValue(it->value));
@@ -155,23 +268,15 @@ namespace jsonrpc {
                 return Value(std::move(data));
             }
             case rapidjson::kArrayType: {
-                Value::Array array;
+                Value::Array array{ Value::Array::allocator_type(myArena) };
                 array.reserve(value.Size());
                 for (auto it = value.Begin(); it != value.End(); ++it) {
                     array.emplace_back(GetValue(*it));
                 }
                 return Value(std::move(array));
             }
-            case rapidjson::kStringType: {
-                tm dt;
-                if (util::ParseIso8601DateTime(value.GetString(), dt)) {
-                    return Value(dt);
-                }
-
-                std::string str(value.GetString(), value.GetStringLength());
-                const bool binary = str.find('\0') != std::string::npos;
-                return Value(std::move(str), binary);
-            }
+            case rapidjson::kStringType:
+                return json::MakeStringValue(value.GetString(), value.GetStringLength(), myIsInsitu, myArena, myDetectDateTime);
             case rapidjson::kNumberType:
                 if (value.IsDouble()) {
                     return Value(value.GetDouble());
@@ -191,7 +296,7 @@ namespace jsonrpc {
             throw InternalErrorFault();
         }
 
-        Value GetId(const rapidjson::Value& id) const {
+        Value GetId(const json::DocumentValue& id) const {
             if (id.IsString()) {
                 return id.GetString();
             } else if (id.IsInt()) {
@@ -206,7 +311,13 @@ namespace jsonrpc {
         }
 
         std::string myData;
-        rapidjson::Document myDocument;
+        bool myIsInsitu = false;
+        bool myDetectDateTime = true;
+        util::Arena* myArena = nullptr;
+        util::CachedAllocator myBaseAllocator;
+        util::CachedAllocator myStackAllocator;
+        json::DocumentAllocator myAllocator{ json::DOCUMENT_CHUNK_SIZE, &myBaseAllocator };
+        json::Document myDocument{ &myAllocator, json::PARSE_STACK_CAPACITY, &myStackAllocator };
     };
 
 } // namespace jsonrpc
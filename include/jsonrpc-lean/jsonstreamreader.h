@@ -0,0 +1,456 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_JSONSTREAMREADER_H
+#define JSONRPC_LEAN_JSONSTREAMREADER_H
+
+#include "reader.h"
+#include "arena.h"
+#include "fault.h"
+#include "json.h"
+#include "pool.h"
+#include "jsonreader.h"
+#include "request.h"
+#include "response.h"
+#include "value.h"
+
+#define RAPIDJSON_NO_SIZETYPEDEFINE
+namespace rapidjson { typedef ::std::size_t SizeType; }
+
+#include <rapidjson/reader.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Reads requests with rapidjson's SAX parser: the Request::Parameters are built straight from
+    // the tokens, without an intermediate rapidjson::Document. There is no decoder per method
+    // signature: a typed method gets its arguments from those Values (see MethodArgument), which
+    // for numbers, booleans and short strings are held inline and cost no allocation. Responses
+    // and plain values are read through JsonReader.
+    // The data passed in is not copied and must outlive the reader.
+    class JsonStreamReader final : public Reader, public util::Pooled {
+    public:
+        explicit JsonStreamReader(const std::string& data) : myText(data.c_str()) {
+        }
+
+        // In-situ mode, see JsonReader(char*)
+        explicit JsonStreamReader(char* data) : myText(data), myInsituText(data) {
+        }
+
+        // Reader
+        Request GetRequest() override {
+            Parse();
+            if (myIsBatch) {
+                throw InvalidRequestFault();
+            }
+            return TakeRequest(myEntries.front());
+        }
+
+        Response GetResponse() override {
+            return GetDocumentReader().GetResponse();
+        }
+
+        Value GetValue() override {
+            return GetDocumentReader().GetValue();
+        }
+
+        bool IsBatch() override {
+            Parse();
+            return myIsBatch;
+        }
+
+        size_t GetBatchSize() override {
+            return IsBatch() ? myEntries.size() : 0;
+        }
+
+        Request GetRequest(size_t index) override {
+            if (index >= GetBatchSize()) {
+                throw InvalidRequestFault();
+            }
+            return TakeRequest(myEntries[index]);
+        }
+
+        Response GetResponse(size_t index) override {
+            return GetDocumentReader().GetResponse(index);
+        }
+
+        void SetArena(util::Arena* arena) override {
+            myArena = arena;
+        }
+
+        void SetDateTimeDetection(bool detect) override {
+            myDetectDateTime = detect;
+            if (myDocumentReader) {
+                myDocumentReader->SetDateTimeDetection(detect);
+            }
+        }
+
+    private:
+        struct Entry {
+            std::string myMethod;
+            Request::Parameters myParameters;
+            Request::ParameterNames myParameterNames;
+            Value myId = Value(false); // a notification, unless an id is found
+            bool myHasMethod = false;
+            bool myHasVersion = false;
+            bool myIsValid = true;
+            bool myHasValidParameters = true; // false if a $binary value is not base64
+            unsigned mySeenFields = 0;
+        };
+
+        // A container being built inside the parameters
+        struct Frame {
+            explicit Frame(util::Arena* arena, bool isStruct)
+                : myArray(Value::Array::allocator_type(arena)),
+                myStruct(Value::Struct::allocator_type(arena)),
+                myIsStruct(isStruct) {
+            }
+
+            Value::Array myArray;
+            Value::Struct myStruct;
+            std::string myKey;
+            bool myIsStruct;
+        };
+
+        enum class Field {
+            JSONRPC,
+            METHOD,
+            PARAMS,
+            ID,
+            OTHER
+        };
+
+        // rapidjson SAX handler, forwards to the reader
+        class Handler {
+        public:
+            explicit Handler(JsonStreamReader& reader) : myReader(reader) {}
+
+            bool Null() { return myReader.OnScalar(Value()); }
+            bool Bool(bool value) { return myReader.OnScalar(Value(value)); }
+            bool Int(int value) { return myReader.OnScalar(Value(static_cast<int32_t>(value))); }
+            bool Uint(unsigned value) { return myReader.OnScalar(MakeInteger(value)); }
+            bool Int64(int64_t value) { return myReader.OnScalar(MakeInteger(value)); }
+            bool Uint64(uint64_t value) {
+                if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+                    return myReader.OnScalar(Value(static_cast<double>(value)));
+                }
+                return myReader.OnScalar(MakeInteger(static_cast<int64_t>(value)));
+            }
+            bool Double(double value) { return myReader.OnScalar(Value(value), true); }
+            bool RawNumber(const char*, rapidjson::SizeType, bool) { return false; }
+            bool String(const char* str, rapidjson::SizeType length, bool) { return myReader.OnString(str, length); }
+            bool StartObject() { return myReader.OnStart(true); }
+            bool Key(const char* str, rapidjson::SizeType length, bool) { return myReader.OnKey(str, length); }
+            bool EndObject(rapidjson::SizeType) { return myReader.OnEnd(); }
+            bool StartArray() { return myReader.OnStart(false); }
+            bool EndArray(rapidjson::SizeType) { return myReader.OnEnd(); }
+
+        private:
+            // the same INTEGER_32/INTEGER_64 split as JsonReader
+            static Value MakeInteger(int64_t value) {
+                if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max()) {
+                    return Value(static_cast<int32_t>(value));
+                }
+                return Value(value);
+            }
+
+            JsonStreamReader& myReader;
+        };
+
+        void Parse() {
+            if (myIsParsed) {
+                return;
+            }
+            myIsParsed = true;
+
+            Handler handler(*this);
+            util::CachedAllocator stackAllocator;
+            rapidjson::GenericReader<rapidjson::UTF8<>, rapidjson::UTF8<>, util::CachedAllocator> reader(
+                &stackAllocator, json::PARSE_STACK_CAPACITY);
+            if (myInsituText != nullptr) {
+                rapidjson::InsituStringStream stream(myInsituText);
+                reader.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+            } else {
+                rapidjson::StringStream stream(myText);
+                reader.Parse(stream, handler);
+            }
+
+            if (reader.HasParseError()) {
+                throw ParseErrorFault(
+                    "Parse error: " + std::to_string(reader.GetParseErrorCode()));
+            }
+        }
+
+        JsonReader& GetDocumentReader() {
+            if (!myDocumentReader) {
+                if (myInsituText != nullptr && myIsParsed) {
+                    // the buffer was already modified in place
+                    throw InternalErrorFault();
+                }
+                myDocumentReader.reset(new JsonReader(std::string(myText)));
+                myDocumentReader->SetDateTimeDetection(myDetectDateTime);
+            }
+            return *myDocumentReader;
+        }
+
+        static Request TakeRequest(Entry& entry) {
+            if (!entry.myIsValid) {
+                throw InvalidRequestFault();
+            }
+            if (!entry.myHasValidParameters) {
+                throw InvalidParametersFault("Invalid base64 in a $binary value");
+            }
+            return Request(std::move(entry.myMethod), std::move(entry.myParameters),
+                std::move(entry.myParameterNames), std::move(entry.myId));
+        }
+
+        bool IsSkipping() const { return mySkipDepth >= 0; }
+        bool InParameters() const { return myParametersDepth >= 0; }
+        bool AtEntryLevel() const { return !myEntries.empty() && myDepth == myEntryDepth && !InParameters(); }
+
+        // A value (scalar or container) that is not part of any valid request
+        void Invalid() {
+            if (!myEntries.empty()) {
+                myEntries.back().myIsValid = false;
+            }
+        }
+
+        void NewEntry(int depth) {
+            myEntries.emplace_back();
+            myEntryDepth = depth;
+        }
+
+        bool OnStart(bool isObject) {
+            if (IsSkipping()) {
+                ++myDepth;
+                return true;
+            }
+
+            if (myDepth == 0 && !isObject) {
+                myIsBatch = true;
+            } else if (myDepth == (myIsBatch ? 1 : 0)) {
+                // a request (or whatever stands in its place)
+                NewEntry(myDepth + 1);
+                if (!isObject) {
+                    Invalid();
+                    mySkipDepth = myDepth;
+                }
+            } else if (InParameters()) {
+                myFrames.emplace_back(myArena, isObject);
+            } else if (AtEntryLevel()) {
+                if (myField == Field::PARAMS) {
+                    // by position or, for an object, by name
+                    myParametersDepth = myDepth + 1;
+                } else {
+                    if (myField != Field::OTHER) {
+                        Invalid();
+                    }
+                    mySkipDepth = myDepth;
+                }
+            }
+
+            ++myDepth;
+            return true;
+        }
+
+        bool OnEnd() {
+            --myDepth;
+
+            if (IsSkipping()) {
+                if (myDepth == mySkipDepth) {
+                    mySkipDepth = -1;
+                }
+                return true;
+            }
+
+            if (InParameters()) {
+                if (myDepth < myParametersDepth) {
+                    // end of the parameters array
+                    myParametersDepth = -1;
+                    return true;
+                }
+
+                Frame frame(std::move(myFrames.back()));
+                myFrames.pop_back();
+                if (frame.myIsStruct) {
+                    if (frame.myStruct.size() == 1) {
+                        auto& member = *frame.myStruct.begin();
+                        if (member.first == json::BINARY_NAME && member.second.IsString()) {
+                            // like JsonReader, the request faults when it is taken, not the parse
+                            const auto base64 = member.second.AsStringView();
+                            try {
+                                return AddParameter(json::MakeBinaryValue(base64.data(), base64.size()));
+                            } catch (const InvalidParametersFault&) {
+                                myEntries.back().myHasValidParameters = false;
+                                return AddParameter(Value());
+                            }
+                        }
+                    }
+                    return AddParameter(Value(std::move(frame.myStruct)));
+                }
+                return AddParameter(Value(std::move(frame.myArray)));
+            }
+
+            if (!myEntries.empty() && myDepth == myEntryDepth - 1) {
+                // end of a request object
+                auto& entry = myEntries.back();
+                if (!entry.myHasVersion || !entry.myHasMethod) {
+                    entry.myIsValid = false;
+                }
+                myEntryDepth = -1;
+            }
+            return true;
+        }
+
+        bool OnKey(const char* str, rapidjson::SizeType length) {
+            if (IsSkipping()) {
+                return true;
+            }
+
+            if (InParameters()) {
+                if (myFrames.empty()) {
+                    myEntries.back().myParameterNames.emplace_back(str, length);
+                } else {
+                    myFrames.back().myKey.assign(str, length);
+                }
+            } else if (AtEntryLevel()) {
+                const string_view key(str, length);
+                if (key == json::JSONRPC_NAME) {
+                    myField = Field::JSONRPC;
+                } else if (key == json::METHOD_NAME) {
+                    myField = Field::METHOD;
+                } else if (key == json::PARAMS_NAME) {
+                    myField = Field::PARAMS;
+                } else if (key == json::ID_NAME) {
+                    myField = Field::ID;
+                } else {
+                    myField = Field::OTHER;
+                }
+
+                // like FindMember, only the first of repeated members counts
+                const unsigned bit = 1u << static_cast<unsigned>(myField);
+                auto& entry = myEntries.back();
+                if (entry.mySeenFields & bit) {
+                    myField = Field::OTHER;
+                }
+                entry.mySeenFields |= bit;
+            }
+            return true;
+        }
+
+        bool OnString(const char* str, rapidjson::SizeType length) {
+            if (IsSkipping()) {
+                return true;
+            }
+
+            if (InParameters()) {
+                // only in-situ strings stay where they are, the others are in the parser's buffer
+                return AddParameter(json::MakeStringValue(str, length, myInsituText != nullptr, myArena, myDetectDateTime));
+            }
+
+            if (AtEntryLevel()) {
+                auto& entry = myEntries.back();
+                switch (myField) {
+                case Field::JSONRPC:
+                    entry.myHasVersion = string_view(str, length) == json::JSONRPC_VERSION_2_0;
+                    if (!entry.myHasVersion) {
+                        Invalid();
+                    }
+                    break;
+                case Field::METHOD:
+                    entry.myMethod.assign(str, length);
+                    entry.myHasMethod = true;
+                    break;
+                case Field::ID:
+                    entry.myId = Value(std::string(str, length));
+                    break;
+                case Field::PARAMS:
+                    Invalid();
+                    break;
+                case Field::OTHER:
+                    break;
+                }
+                return true;
+            }
+
+            // a string in place of a request
+            NewEntry(-1);
+            Invalid();
+            return true;
+        }
+
+        bool OnScalar(Value value, bool isDouble = false) {
+            if (IsSkipping()) {
+                return true;
+            }
+
+            if (InParameters()) {
+                return AddParameter(std::move(value));
+            }
+
+            if (AtEntryLevel()) {
+                if (myField == Field::ID && !isDouble && (value.IsNil() || value.IsInteger32() || value.IsInteger64())) {
+                    myEntries.back().myId = std::move(value);
+                } else if (myField != Field::OTHER) {
+                    Invalid();
+                }
+                return true;
+            }
+
+            // a scalar in place of a request
+            NewEntry(-1);
+            Invalid();
+            return true;
+        }
+
+        bool AddParameter(Value value) {
+            if (myFrames.empty()) {
+                myEntries.back().myParameters.emplace_back(std::move(value));
+            } else if (myFrames.back().myIsStruct) {
+                auto& frame = myFrames.back();
+                frame.myStruct.emplace(std::move(frame.myKey), std::move(value));
+                frame.myKey.clear();
+            } else {
+                myFrames.back().myArray.emplace_back(std::move(value));
+            }
+            return true;
+        }
+
+        const char* myText;
+        char* myInsituText = nullptr;
+        util::Arena* myArena = nullptr;
+        bool myDetectDateTime = true;
+        std::unique_ptr<JsonReader> myDocumentReader;
+
+        bool myIsParsed = false;
+        bool myIsBatch = false;
+        std::vector<Entry> myEntries;
+
+        // parser state
+        int myDepth = 0;
+        int myEntryDepth = -1;
+        int myParametersDepth = -1;
+        int mySkipDepth = -1;
+        Field myField = Field::OTHER;
+        std::vector<Frame> myFrames;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_JSONSTREAMREADER_H
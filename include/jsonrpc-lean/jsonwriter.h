@@ -21,10 +21,13 @@
 #define JSONRPC_LEAN_JSONWRITER_H
 
 #include "writer.h"
+#include "cachedvalue.h"
 #include "json.h"
 #include "util.h"
 #include "value.h"
 #include "jsonformatteddata.h"
+#include "outputbuffer.h"
+#include "pool.h"
 
 #define RAPIDJSON_NO_SIZETYPEDEFINE
 namespace rapidjson { typedef ::std::size_t SizeType; }
@@ -34,16 +37,14 @@ namespace rapidjson { typedef ::std::size_t SizeType; }
 
 namespace jsonrpc {
 
-    class JsonWriter final : public Writer {
+    // Serializes to any rapidjson output stream; the stream is not owned
+    template<typename OutputStream>
+    class BasicJsonWriter : public Writer, public util::Pooled {
     public:
-        JsonWriter() : myRequestData(new JsonFormattedData()) {
+        explicit BasicJsonWriter(OutputStream& stream) : myWriter(stream, &myStackAllocator) {
         }
 
         // Writer
-        std::shared_ptr<FormattedData> GetData() override {
-            return std::static_pointer_cast<FormattedData>(myRequestData);
-        }
-
         void StartDocument() override {
             // Empty
         }
@@ -53,23 +54,23 @@ namespace jsonrpc {
         }
 
         void StartRequest(const std::string& methodName, const Value& id) override {
-            myRequestData->Writer.StartObject();
+            myWriter.StartObject();
 
-            myRequestData->Writer.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
-            myRequestData->Writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+            myWriter.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
+            myWriter.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
 
-            myRequestData->Writer.Key(json::METHOD_NAME, sizeof(json::METHOD_NAME) - 1);
-            myRequestData->Writer.String(methodName.data(), methodName.size(), true);
+            myWriter.Key(json::METHOD_NAME, sizeof(json::METHOD_NAME) - 1);
+            myWriter.String(methodName.data(), methodName.size(), true);
 
             WriteId(id);
 
-            myRequestData->Writer.Key(json::PARAMS_NAME, sizeof(json::PARAMS_NAME) - 1);
-            myRequestData->Writer.StartArray();
+            myWriter.Key(json::PARAMS_NAME, sizeof(json::PARAMS_NAME) - 1);
+            myWriter.StartArray();
         }
 
         void EndRequest() override {
-            myRequestData->Writer.EndArray();
-            myRequestData->Writer.EndObject();
+            myWriter.EndArray();
+            myWriter.EndObject();
         }
 
         void StartParameter() override {
@@ -81,121 +82,206 @@ namespace jsonrpc {
         }
 
         void StartResponse(const Value& id) override {
-            myRequestData->Writer.StartObject();
+            myWriter.StartObject();
 
-            myRequestData->Writer.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
-            myRequestData->Writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+            myWriter.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
+            myWriter.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
 
             WriteId(id);
 
-            myRequestData->Writer.Key(json::RESULT_NAME, sizeof(json::RESULT_NAME) - 1);
+            myWriter.Key(json::RESULT_NAME, sizeof(json::RESULT_NAME) - 1);
         }
 
         void EndResponse() override {
-            myRequestData->Writer.EndObject();
+            myWriter.EndObject();
         }
 
         void StartFaultResponse(const Value& id) override {
-            myRequestData->Writer.StartObject();
+            myWriter.StartObject();
 
-            myRequestData->Writer.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
-            myRequestData->Writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+            myWriter.Key(json::JSONRPC_NAME, sizeof(json::JSONRPC_NAME) - 1);
+            myWriter.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
 
             WriteId(id);
         }
 
         void EndFaultResponse() override {
-            myRequestData->Writer.EndObject();
+            myWriter.EndObject();
         }
 
         void WriteFault(int32_t code, const std::string& string) override {
-            myRequestData->Writer.Key(json::ERROR_NAME, sizeof(json::ERROR_NAME) - 1);
-            myRequestData->Writer.StartObject();
+            myWriter.Key(json::ERROR_NAME, sizeof(json::ERROR_NAME) - 1);
+            myWriter.StartObject();
+
+            myWriter.Key(json::ERROR_CODE_NAME, sizeof(json::ERROR_CODE_NAME) - 1);
+            myWriter.Int(code);
 
-            myRequestData->Writer.Key(json::ERROR_CODE_NAME, sizeof(json::ERROR_CODE_NAME) - 1);
-            myRequestData->Writer.Int(code);
+            myWriter.Key(json::ERROR_MESSAGE_NAME, sizeof(json::ERROR_MESSAGE_NAME) - 1);
+            myWriter.String(string.data(), string.size(), true);
 
-            myRequestData->Writer.Key(json::ERROR_MESSAGE_NAME, sizeof(json::ERROR_MESSAGE_NAME) - 1);
-            myRequestData->Writer.String(string.data(), string.size(), true);
+            myWriter.EndObject();
+        }
 
-            myRequestData->Writer.EndObject();
+        void StartBatch() override {
+            myWriter.StartArray();
+        }
+
+        void EndBatch() override {
+            myWriter.EndArray();
         }
 
         void StartArray() override {
-            myRequestData->Writer.StartArray();
+            myWriter.StartArray();
         }
 
         void EndArray() override {
-            myRequestData->Writer.EndArray();
+            myWriter.EndArray();
         }
 
         void StartStruct() override {
-            myRequestData->Writer.StartObject();
+            myWriter.StartObject();
         }
 
         void EndStruct() override {
-            myRequestData->Writer.EndObject();
+            myWriter.EndObject();
         }
 
         void StartStructElement(const std::string& name) override {
-            myRequestData->Writer.Key(name.data(), name.size(), true);
+            myWriter.Key(name.data(), name.size(), true);
         }
 
         void EndStructElement() override {
             // Empty
         }
 
+        // As {"$binary": "<base64>"}; the encoding needs no escaping and goes in as it is
         void WriteBinary(const char* data, size_t size) override {
-            myRequestData->Writer.String(data, size, true);
+            myWriter.StartObject();
+            myWriter.Key(json::BINARY_NAME, sizeof(json::BINARY_NAME) - 1);
+
+            myBinaryText.resize(util::Base64EncodedSize(size, false) + 2);
+            myBinaryText.front() = '"';
+            util::Base64Encode(data, size, &myBinaryText[1], false);
+            myBinaryText.back() = '"';
+            myWriter.RawValue(myBinaryText.data(), myBinaryText.size(), rapidjson::kStringType);
+
+            myWriter.EndObject();
         }
 
         void WriteNull() override {
-            myRequestData->Writer.Null();
+            myWriter.Null();
         }
 
         void Write(bool value) override {
-            myRequestData->Writer.Bool(value);
+            myWriter.Bool(value);
         }
 
         void Write(double value) override {
-            myRequestData->Writer.Double(value);
+            myWriter.Double(value);
         }
 
         void Write(int32_t value) override {
-            myRequestData->Writer.Int(value);
+            myWriter.Int(value);
         }
 
         void Write(int64_t value) override {
-            myRequestData->Writer.Int64(value);
+            myWriter.Int64(value);
         }
 
         void Write(const std::string& value) override {
-            myRequestData->Writer.String(value.data(), value.size(), true);
+            myWriter.String(value.data(), value.size(), true);
+        }
+
+        void Write(string_view value) override {
+            myWriter.String(value.data(), value.size(), true);
         }
 
         void Write(const tm& value) override {
-            Write(util::FormatIso8601DateTime(value));
+            char str[util::ISO8601_DATE_TIME_CAPACITY];
+            myWriter.String(str, static_cast<rapidjson::SizeType>(util::FormatIso8601DateTime(value, str)), true);
         }
 
+        bool WriteCached(const CachedValue& value) override;
+
     private:
         void WriteId(const Value& id) {
             if (id.IsString() || id.IsInteger32() || id.IsInteger64() || id.IsNil()) {
-                myRequestData->Writer.Key(json::ID_NAME, sizeof(json::ID_NAME) - 1);
+                myWriter.Key(json::ID_NAME, sizeof(json::ID_NAME) - 1);
                 if (id.IsString()) {
-                    myRequestData->Writer.String(id.AsString().data(), id.AsString().size(), true);
+                    myWriter.String(id.AsString().data(), id.AsString().size(), true);
                 } else if (id.IsInteger32()) {
-                    myRequestData->Writer.Int(id.AsInteger32());
+                    myWriter.Int(id.AsInteger32());
                 } else if (id.IsInteger64()) {
-                    myRequestData->Writer.Int64(id.AsInteger64());
+                    myWriter.Int64(id.AsInteger64());
                 } else {
-                    myRequestData->Writer.Null();
+                    myWriter.Null();
                 }
             }
         }
 
+        std::string myBinaryText;
+        util::CachedAllocator myStackAllocator;
+        rapidjson::Writer<OutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>, util::CachedAllocator> myWriter;
+    };
+
+    class JsonWriter final : public BasicJsonWriter<JsonFormattedData::Buffer> {
+    public:
+        JsonWriter() : JsonWriter(std::allocate_shared<JsonFormattedData>(util::PoolAllocator<JsonFormattedData>())) {
+        }
+
+        // Writer
+        std::shared_ptr<FormattedData> GetData() override {
+            return std::static_pointer_cast<FormattedData>(myRequestData);
+        }
+
+        size_t GetSize() override {
+            return myRequestData->GetSize();
+        }
+
+    private:
+        explicit JsonWriter(std::shared_ptr<JsonFormattedData> data)
+            : BasicJsonWriter(data->GetBuffer()), myRequestData(std::move(data)) {
+        }
+
         std::shared_ptr<JsonFormattedData> myRequestData;
     };
 
+    // Writes into an output owned by the caller (util::StringOutput, util::OutputBuffer), which
+    // must outlive the writer. GetData() refers to the output instead of copying it.
+    template<typename OutputStream>
+    class JsonBufferWriter final : public BasicJsonWriter<OutputStream> {
+    public:
+        explicit JsonBufferWriter(OutputStream& output)
+            : BasicJsonWriter<OutputStream>(output), myOutput(output) {
+        }
+
+        // Writer
+        std::shared_ptr<FormattedData> GetData() override {
+            return std::make_shared<FormattedDataView>(myOutput.GetData(), myOutput.GetSize());
+        }
+
+        size_t GetSize() override {
+            return myOutput.GetSize();
+        }
+
+    private:
+        OutputStream& myOutput;
+    };
+
+    // Encoded by a JsonWriter the first time. The value is never a key, so its rapidjson type
+    // does not matter.
+    template<typename OutputStream>
+    bool BasicJsonWriter<OutputStream>::WriteCached(const CachedValue& value) {
+        const auto text = value.GetEncoding(CachedValue::JSON, [](const Value& value, std::string& text) {
+            JsonWriter writer;
+            value.Write(writer);
+            auto data = writer.GetData();
+            text.assign(data->GetData(), data->GetSize());
+        });
+        myWriter.RawValue(text.data(), text.size(), rapidjson::kObjectType);
+        return true;
+    }
+
 } // namespace jsonrpc
 
 #endif // JSONRPC_LEAN_JSONWRITER_H
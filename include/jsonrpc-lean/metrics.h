@@ -0,0 +1,272 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_METRICS_H
+#define JSONRPC_LEAN_METRICS_H
+
+#include "response.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace jsonrpc {
+    namespace util {
+
+        // Log-linear histogram of durations in nanoseconds, as in HdrHistogram: every power of two
+        // is split into 16 buckets, so a value is known to within 1/16 (6.25%) of itself. Values from
+        // 2^36 ns (about 68 s) up all go to the last bucket.
+        class Histogram {
+        public:
+            static const unsigned SUB_BUCKET_BITS = 4;
+            static const unsigned SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+            static const unsigned MAX_BIT = 35;
+            static const size_t BUCKET_COUNT = (MAX_BIT - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+            Histogram() : myCounts(BUCKET_COUNT, 0) {}
+
+            static size_t GetBucket(uint64_t value) {
+                if (value < SUB_BUCKET_COUNT) {
+                    return static_cast<size_t>(value);
+                }
+                const unsigned bit = HighestBit(value);
+                if (bit > MAX_BIT) {
+                    return BUCKET_COUNT - 1;
+                }
+                const unsigned shift = bit - SUB_BUCKET_BITS;
+                return (shift + 1) * SUB_BUCKET_COUNT + static_cast<size_t>((value >> shift) & (SUB_BUCKET_COUNT - 1));
+            }
+
+            // Smallest and largest value that go to bucket
+            static uint64_t GetLowerBound(size_t bucket) {
+                if (bucket < SUB_BUCKET_COUNT) {
+                    return bucket;
+                }
+                const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKET_COUNT) - 1;
+                return (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+            }
+
+            static uint64_t GetUpperBound(size_t bucket) {
+                if (bucket < SUB_BUCKET_COUNT) {
+                    return bucket;
+                }
+                const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKET_COUNT) - 1;
+                return GetLowerBound(bucket) + (uint64_t(1) << shift) - 1;
+            }
+
+            void Add(uint64_t value) {
+                AddToBucket(GetBucket(value), 1, value);
+            }
+
+            void AddToBucket(size_t bucket, uint64_t count, uint64_t max) {
+                myCounts[bucket] += count;
+                myTotal += count;
+                myMax = std::max(myMax, max);
+            }
+
+            uint64_t GetCount() const { return myTotal; }
+            uint64_t GetMax() const { return myMax; }
+            uint64_t GetBucketCount(size_t bucket) const { return myCounts[bucket]; }
+
+            // The largest value of the bucket holding the given percentile (0 to 100), so that at
+            // least that share of the values is known to be smaller or equal; 0 if empty
+            uint64_t GetPercentile(double percentile) const {
+                if (myTotal == 0) {
+                    return 0;
+                }
+                const double wanted = std::min(std::max(percentile, 0.0), 100.0) / 100.0 * myTotal;
+                uint64_t rank = static_cast<uint64_t>(wanted);
+                if (rank < wanted || rank == 0) {
+                    ++rank;
+                }
+                uint64_t seen = 0;
+                for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+                    seen += myCounts[bucket];
+                    if (seen >= rank) {
+                        return std::min(GetUpperBound(bucket), myMax);
+                    }
+                }
+                return myMax;
+            }
+
+        private:
+            static unsigned HighestBit(uint64_t value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+                unsigned long index;
+                _BitScanReverse64(&index, value);
+                return static_cast<unsigned>(index);
+#else
+                return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+            }
+
+            std::vector<uint64_t> myCounts;
+            uint64_t myTotal = 0;
+            uint64_t myMax = 0;
+        };
+
+    } // namespace util
+
+    // Statistics of the calls to a method, see MethodMetrics::GetStatistics
+    struct MethodStatistics {
+        uint64_t myCallCount = 0;
+        uint64_t myFaultCount = 0;
+        std::map<int32_t, uint64_t> myFaultCounts; // by fault code
+        uint64_t myTotalNanoseconds = 0;
+        util::Histogram myLatency; // in nanoseconds
+    };
+
+    // Counts the calls of one method, their faults and their latency. Record may be called from any
+    // number of threads: every thread writes to one of a number of shards (its own as long as there
+    // are no more threads than shards), so that calls on different threads do not share a cache line.
+    // A shard holds a whole histogram (about 4 KB), so it is only allocated once a thread records a
+    // call to it: a method called from one thread costs one shard. Faults are also counted by code,
+    // under a lock.
+    class MethodMetrics {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        MethodMetrics() : myShardCount(GetShardCount()), myShards(new std::atomic<Shard*>[myShardCount]) {
+            for (size_t i = 0; i < myShardCount; ++i) {
+                myShards[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~MethodMetrics() {
+            for (size_t i = 0; i < myShardCount; ++i) {
+                delete myShards[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        MethodMetrics(const MethodMetrics&) = delete;
+        MethodMetrics& operator=(const MethodMetrics&) = delete;
+
+        // A call that started at start and ended now with response
+        void Record(Clock::time_point start, const Response& response) {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            const uint64_t nanoseconds = elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+
+            Shard& shard = GetShard();
+            shard.myCalls.fetch_add(1, std::memory_order_relaxed);
+            shard.myNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+            shard.myBuckets[util::Histogram::GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+            uint64_t max = shard.myMax.load(std::memory_order_relaxed);
+            while (nanoseconds > max && !shard.myMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+            }
+
+            if (response.IsFault()) {
+                shard.myFaults.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(myFaultMutex);
+                ++myFaultCounts[response.GetFaultCode()];
+            }
+        }
+
+        // The sum of the shards; calls recorded meanwhile may or may not be included
+        MethodStatistics GetStatistics() const {
+            MethodStatistics statistics;
+            uint64_t max = 0;
+            std::vector<const Shard*> shards;
+            for (size_t i = 0; i < myShardCount; ++i) {
+                if (const Shard* shard = myShards[i].load(std::memory_order_acquire)) {
+                    shards.push_back(shard);
+                }
+            }
+
+            for (const Shard* shard : shards) {
+                statistics.myCallCount += shard->myCalls.load(std::memory_order_relaxed);
+                statistics.myFaultCount += shard->myFaults.load(std::memory_order_relaxed);
+                statistics.myTotalNanoseconds += shard->myNanoseconds.load(std::memory_order_relaxed);
+                max = std::max(max, shard->myMax.load(std::memory_order_relaxed));
+            }
+            for (size_t bucket = 0; bucket < util::Histogram::BUCKET_COUNT; ++bucket) {
+                uint64_t count = 0;
+                for (const Shard* shard : shards) {
+                    count += shard->myBuckets[bucket].load(std::memory_order_relaxed);
+                }
+                if (count != 0) {
+                    statistics.myLatency.AddToBucket(bucket, count, std::min(max, util::Histogram::GetUpperBound(bucket)));
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(myFaultMutex);
+            statistics.myFaultCounts = myFaultCounts;
+            return statistics;
+        }
+
+    private:
+        // Padded instead of aligned (new does not align beyond max_align_t before C++17): the
+        // counters of one shard never share a cache line with those of the next
+        struct Shard {
+            char myPadding[64];
+            std::atomic<uint64_t> myCalls{ 0 };
+            std::atomic<uint64_t> myFaults{ 0 };
+            std::atomic<uint64_t> myNanoseconds{ 0 };
+            std::atomic<uint64_t> myMax{ 0 };
+            std::atomic<uint64_t> myBuckets[util::Histogram::BUCKET_COUNT] = {};
+        };
+
+        // The number of hardware threads rounded up to a power of two, but at most 16; with more
+        // threads some share a shard
+        static size_t GetShardCount() {
+            const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t count = 1;
+            while (count < threads && count < 16) {
+                count *= 2;
+            }
+            return count;
+        }
+
+        // The shard of the calling thread, allocated by the first call that needs it
+        Shard& GetShard() {
+            std::atomic<Shard*>& slot = myShards[GetThreadIndex() & (myShardCount - 1)];
+            Shard* shard = slot.load(std::memory_order_acquire);
+            if (shard == nullptr) {
+                std::unique_ptr<Shard> created(new Shard());
+                if (slot.compare_exchange_strong(shard, created.get(), std::memory_order_acq_rel)) {
+                    shard = created.release();
+                }
+            }
+            return *shard;
+        }
+
+        // Threads are numbered in the order they first record a call
+        static size_t GetThreadIndex() {
+            static std::atomic<size_t> nextIndex{ 0 };
+            static thread_local size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+
+        const size_t myShardCount;
+        std::unique_ptr<std::atomic<Shard*>[]> myShards; // nullptr until used
+
+        mutable std::mutex myFaultMutex;
+        std::map<int32_t, uint64_t> myFaultCounts;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_METRICS_H
@@ -0,0 +1,381 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_MSGPACK_H
+#define JSONRPC_LEAN_MSGPACK_H
+
+#include "fault.h"
+#include "util.h"
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+namespace jsonrpc {
+    namespace msgpack {
+
+        // Format bytes, see https://github.com/msgpack/msgpack/blob/master/spec.md
+        enum Code : uint8_t {
+            POSITIVE_FIXINT_MAX = 0x7f,
+            FIXMAP = 0x80,
+            FIXARRAY = 0x90,
+            FIXSTR = 0xa0,
+            NIL = 0xc0,
+            BOOL_FALSE = 0xc2,
+            BOOL_TRUE = 0xc3,
+            BIN8 = 0xc4,
+            BIN16 = 0xc5,
+            BIN32 = 0xc6,
+            EXT8 = 0xc7,
+            EXT16 = 0xc8,
+            EXT32 = 0xc9,
+            FLOAT32 = 0xca,
+            FLOAT64 = 0xcb,
+            UINT8 = 0xcc,
+            UINT16 = 0xcd,
+            UINT32 = 0xce,
+            UINT64 = 0xcf,
+            INT8 = 0xd0,
+            INT16 = 0xd1,
+            INT32 = 0xd2,
+            INT64 = 0xd3,
+            FIXEXT1 = 0xd4,
+            FIXEXT2 = 0xd5,
+            FIXEXT4 = 0xd6,
+            FIXEXT8 = 0xd7,
+            FIXEXT16 = 0xd8,
+            STR8 = 0xd9,
+            STR16 = 0xda,
+            STR32 = 0xdb,
+            ARRAY16 = 0xdc,
+            ARRAY32 = 0xdd,
+            MAP16 = 0xde,
+            MAP32 = 0xdf,
+            NEGATIVE_FIXINT_MIN = 0xe0,
+        };
+
+        // DATE_TIME values are timestamps (seconds since the epoch, the broken-down time taken as UTC)
+        const int8_t TIMESTAMP_TYPE = -1;
+
+        // Nesting deeper than this is refused rather than risking the stack
+        const size_t MAX_DEPTH = 512;
+
+        namespace detail {
+
+            // Days since 1970-01-01 of a proleptic Gregorian date, month 1 to 12
+            inline int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day) {
+                year -= month <= 2 ? 1 : 0;
+                const int64_t era = (year >= 0 ? year : year - 399) / 400;
+                const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+                const unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+                const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+                return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+            }
+
+            inline void CivilFromDays(int64_t days, int64_t& year, unsigned& month, unsigned& day) {
+                days += 719468;
+                const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+                const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+                const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+                const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+                const unsigned monthIndex = (5 * dayOfYear + 2) / 153;
+                day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+                month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+                year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2 ? 1 : 0);
+            }
+
+        } // namespace detail
+
+        inline int64_t ToTimestamp(const tm& dt) {
+            const int64_t days = detail::DaysFromCivil(dt.tm_year + 1900LL, dt.tm_mon + 1, dt.tm_mday);
+            return days * 86400 + dt.tm_hour * 3600 + dt.tm_min * 60 + dt.tm_sec;
+        }
+
+        inline tm FromTimestamp(int64_t seconds) {
+            int64_t days = seconds / 86400;
+            int64_t secondOfDay = seconds % 86400;
+            if (secondOfDay < 0) {
+                secondOfDay += 86400;
+                --days;
+            }
+
+            int64_t year;
+            unsigned month;
+            unsigned day;
+            detail::CivilFromDays(days, year, month, day);
+
+            tm dt = {};
+            dt.tm_year = static_cast<int>(year - 1900);
+            dt.tm_mon = static_cast<int>(month) - 1;
+            dt.tm_mday = static_cast<int>(day);
+            dt.tm_hour = static_cast<int>(secondOfDay / 3600);
+            dt.tm_min = static_cast<int>(secondOfDay / 60 % 60);
+            dt.tm_sec = static_cast<int>(secondOfDay % 60);
+            dt.tm_wday = static_cast<int>((days % 7 + 11) % 7); // 1970-01-01 was a Thursday
+            dt.tm_yday = util::detail::DaysBeforeMonth(dt.tm_mon) + dt.tm_mday - 1
+                + (month > 2 && util::detail::IsLeapYear(static_cast<int>(year)) ? 1 : 0);
+            dt.tm_isdst = -1;
+            return dt;
+        }
+
+        // Reads big-endian numbers and byte ranges, throwing a ParseErrorFault at the end of the data
+        class Cursor {
+        public:
+            Cursor(const char* data, size_t size)
+                : myPosition(reinterpret_cast<const uint8_t*>(data)),
+                myEnd(reinterpret_cast<const uint8_t*>(data) + size) {
+            }
+
+            bool AtEnd() const { return myPosition == myEnd; }
+            const char* GetPosition() const { return reinterpret_cast<const char*>(myPosition); }
+
+            uint8_t Peek() const {
+                Require(1);
+                return *myPosition;
+            }
+
+            template<typename T>
+            T Read() {
+                Require(sizeof(T));
+                T value = 0;
+                for (size_t i = 0; i < sizeof(T); ++i) {
+                    value = static_cast<T>((static_cast<uint64_t>(value) << 8) | myPosition[i]);
+                }
+                myPosition += sizeof(T);
+                return value;
+            }
+
+            const char* ReadBytes(size_t size) {
+                Require(size);
+                const char* bytes = GetPosition();
+                myPosition += size;
+                return bytes;
+            }
+
+        private:
+            void Require(size_t size) const {
+                if (static_cast<size_t>(myEnd - myPosition) < size) {
+                    throw ParseErrorFault("Parse error: unexpected end of MessagePack data");
+                }
+            }
+
+            const uint8_t* myPosition;
+            const uint8_t* myEnd;
+        };
+
+        // One decoded format: a scalar, the bytes of a string, binary or extension, or the size of
+        // an array or map (whose elements follow)
+        struct Item {
+            enum Type : uint8_t {
+                NIL,
+                BOOLEAN,
+                INTEGER,
+                DOUBLE, // also the unsigned integers above INT64_MAX
+                STRING,
+                BINARY,
+                EXTENSION,
+                ARRAY,
+                MAP,
+            };
+
+            Type myType = NIL;
+            bool myBoolean = false;
+            int8_t myExtensionType = 0;
+            int64_t myInteger = 0;
+            double myDouble = 0;
+            const char* myData = nullptr;
+            size_t mySize = 0; // bytes, or elements of an array or map
+        };
+
+        namespace detail {
+
+            inline Item MakeItem(Item::Type type) {
+                Item item;
+                item.myType = type;
+                return item;
+            }
+
+            inline Item MakeInteger(int64_t value) {
+                Item item = MakeItem(Item::INTEGER);
+                item.myInteger = value;
+                return item;
+            }
+
+            inline Item MakeBytes(Item::Type type, Cursor& cursor, size_t size) {
+                Item item = MakeItem(type);
+                item.mySize = size;
+                item.myData = cursor.ReadBytes(size);
+                return item;
+            }
+
+            inline Item MakeExtension(Cursor& cursor, size_t size) {
+                const int8_t type = static_cast<int8_t>(cursor.Read<uint8_t>());
+                Item item = MakeBytes(Item::EXTENSION, cursor, size);
+                item.myExtensionType = type;
+                return item;
+            }
+
+            inline Item MakeContainer(Item::Type type, size_t size) {
+                Item item = MakeItem(type);
+                item.mySize = size;
+                return item;
+            }
+
+        } // namespace detail
+
+        inline Item ReadItem(Cursor& cursor) {
+            const uint8_t code = cursor.Read<uint8_t>();
+            if (code <= POSITIVE_FIXINT_MAX) {
+                return detail::MakeInteger(code);
+            } else if (code >= NEGATIVE_FIXINT_MIN) {
+                return detail::MakeInteger(static_cast<int8_t>(code));
+            } else if ((code & 0xf0) == FIXMAP) {
+                return detail::MakeContainer(Item::MAP, code & 0x0f);
+            } else if ((code & 0xf0) == FIXARRAY) {
+                return detail::MakeContainer(Item::ARRAY, code & 0x0f);
+            } else if ((code & 0xe0) == FIXSTR) {
+                return detail::MakeBytes(Item::STRING, cursor, code & 0x1f);
+            }
+
+            switch (code) {
+            case NIL:
+                return detail::MakeItem(Item::NIL);
+            case BOOL_FALSE:
+            case BOOL_TRUE: {
+                Item item = detail::MakeItem(Item::BOOLEAN);
+                item.myBoolean = code == BOOL_TRUE;
+                return item;
+            }
+            case BIN8:
+                return detail::MakeBytes(Item::BINARY, cursor, cursor.Read<uint8_t>());
+            case BIN16:
+                return detail::MakeBytes(Item::BINARY, cursor, cursor.Read<uint16_t>());
+            case BIN32:
+                return detail::MakeBytes(Item::BINARY, cursor, cursor.Read<uint32_t>());
+            case EXT8:
+                return detail::MakeExtension(cursor, cursor.Read<uint8_t>());
+            case EXT16:
+                return detail::MakeExtension(cursor, cursor.Read<uint16_t>());
+            case EXT32:
+                return detail::MakeExtension(cursor, cursor.Read<uint32_t>());
+            case FLOAT32: {
+                const uint32_t bits = cursor.Read<uint32_t>();
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+                Item item = detail::MakeItem(Item::DOUBLE);
+                item.myDouble = value;
+                return item;
+            }
+            case FLOAT64: {
+                const uint64_t bits = cursor.Read<uint64_t>();
+                Item item = detail::MakeItem(Item::DOUBLE);
+                memcpy(&item.myDouble, &bits, sizeof(bits));
+                return item;
+            }
+            case UINT8:
+                return detail::MakeInteger(cursor.Read<uint8_t>());
+            case UINT16:
+                return detail::MakeInteger(cursor.Read<uint16_t>());
+            case UINT32:
+                return detail::MakeInteger(cursor.Read<uint32_t>());
+            case UINT64: {
+                const uint64_t value = cursor.Read<uint64_t>();
+                if (value <= static_cast<uint64_t>(INT64_MAX)) {
+                    return detail::MakeInteger(static_cast<int64_t>(value));
+                }
+                Item item = detail::MakeItem(Item::DOUBLE);
+                item.myDouble = static_cast<double>(value);
+                return item;
+            }
+            case INT8:
+                return detail::MakeInteger(static_cast<int8_t>(cursor.Read<uint8_t>()));
+            case INT16:
+                return detail::MakeInteger(static_cast<int16_t>(cursor.Read<uint16_t>()));
+            case INT32:
+                return detail::MakeInteger(static_cast<int32_t>(cursor.Read<uint32_t>()));
+            case INT64:
+                return detail::MakeInteger(static_cast<int64_t>(cursor.Read<uint64_t>()));
+            case FIXEXT1:
+                return detail::MakeExtension(cursor, 1);
+            case FIXEXT2:
+                return detail::MakeExtension(cursor, 2);
+            case FIXEXT4:
+                return detail::MakeExtension(cursor, 4);
+            case FIXEXT8:
+                return detail::MakeExtension(cursor, 8);
+            case FIXEXT16:
+                return detail::MakeExtension(cursor, 16);
+            case STR8:
+                return detail::MakeBytes(Item::STRING, cursor, cursor.Read<uint8_t>());
+            case STR16:
+                return detail::MakeBytes(Item::STRING, cursor, cursor.Read<uint16_t>());
+            case STR32:
+                return detail::MakeBytes(Item::STRING, cursor, cursor.Read<uint32_t>());
+            case ARRAY16:
+                return detail::MakeContainer(Item::ARRAY, cursor.Read<uint16_t>());
+            case ARRAY32:
+                return detail::MakeContainer(Item::ARRAY, cursor.Read<uint32_t>());
+            case MAP16:
+                return detail::MakeContainer(Item::MAP, cursor.Read<uint16_t>());
+            case MAP32:
+                return detail::MakeContainer(Item::MAP, cursor.Read<uint32_t>());
+            }
+
+            throw ParseErrorFault("Parse error: invalid MessagePack format");
+        }
+
+        // Skips count whole values (with everything nested in them), depth is their nesting level
+        inline void SkipItems(Cursor& cursor, size_t count, size_t depth = 0) {
+            if (depth > MAX_DEPTH) {
+                throw ParseErrorFault("Parse error: MessagePack data nested too deeply");
+            }
+            for (size_t i = 0; i < count; ++i) {
+                const Item item = ReadItem(cursor);
+                if (item.myType == Item::ARRAY) {
+                    SkipItems(cursor, item.mySize, depth + 1);
+                } else if (item.myType == Item::MAP) {
+                    SkipItems(cursor, 2 * item.mySize, depth + 1);
+                }
+            }
+        }
+
+        // The time of a timestamp extension (32 bit seconds, 30 bit nanoseconds and 34 bit seconds,
+        // or 32 bit nanoseconds and 64 bit seconds); nanoseconds are dropped
+        inline bool ReadTimestamp(const Item& item, tm& dt) {
+            if (item.myType != Item::EXTENSION || item.myExtensionType != TIMESTAMP_TYPE) {
+                return false;
+            }
+
+            Cursor cursor(item.myData, item.mySize);
+            switch (item.mySize) {
+            case 4:
+                dt = FromTimestamp(cursor.Read<uint32_t>());
+                return true;
+            case 8:
+                dt = FromTimestamp(static_cast<int64_t>(cursor.Read<uint64_t>() & 0x3ffffffffULL));
+                return true;
+            case 12:
+                cursor.Read<uint32_t>();
+                dt = FromTimestamp(static_cast<int64_t>(cursor.Read<uint64_t>()));
+                return true;
+            }
+            return false;
+        }
+
+    } // namespace msgpack
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_MSGPACK_H
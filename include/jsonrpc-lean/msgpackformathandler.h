@@ -0,0 +1,71 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_MSGPACKFORMATHANDLER_H
+#define JSONRPC_LEAN_MSGPACKFORMATHANDLER_H
+
+#include "formathandler.h"
+#include "fault.h"
+#include "msgpackreader.h"
+#include "msgpackwriter.h"
+
+#include <memory>
+
+namespace jsonrpc {
+
+    const char APPLICATION_MSGPACK[] = "application/msgpack";
+    const char APPLICATION_X_MSGPACK[] = "application/x-msgpack";
+
+    // The same JSON-RPC 2.0 objects as JsonFormatHandler, encoded as MessagePack; every Value type
+    // has a format of its own (BINARY as bin, DATE_TIME as a timestamp). Readers refer to the data
+    // they were created from, which must outlive them.
+    class MsgpackFormatHandler : public FormatHandler {
+    public:
+        // FormatHandler
+        bool CanHandleRequest(const std::string& contentType) override {
+            return contentType == APPLICATION_MSGPACK || contentType == APPLICATION_X_MSGPACK;
+        }
+
+        std::string GetContentType() override {
+            return APPLICATION_MSGPACK;
+        }
+
+        bool UsesId() override {
+            return true;
+        }
+
+        std::unique_ptr<Reader> CreateReader(const std::string& data) override {
+            return std::unique_ptr<Reader>(std::make_unique<MsgpackReader>(data.data(), data.size()));
+        }
+
+        // The size of the data cannot be told from a terminating NUL, MessagePack may contain them
+        std::unique_ptr<Reader> CreateInsituReader(char* /*data*/) override {
+            throw ParseErrorFault("Parse error: MessagePack data cannot be read in place");
+        }
+
+        // Nothing is modified, the reader only refers to data
+        std::unique_ptr<Reader> CreateInsituReader(char* data, size_t size) override {
+            return std::unique_ptr<Reader>(std::make_unique<MsgpackReader>(data, size));
+        }
+
+        std::unique_ptr<Writer> CreateWriter() override {
+            return std::unique_ptr<Writer>(std::make_unique<MsgpackWriter>());
+        }
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_MSGPACKFORMATHANDLER_H
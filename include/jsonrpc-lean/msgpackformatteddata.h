@@ -0,0 +1,46 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_MSGPACKFORMATTEDDATA_H
+#define JSONRPC_LEAN_MSGPACKFORMATTEDDATA_H
+
+#include "formatteddata.h"
+
+#include <string>
+
+namespace jsonrpc {
+
+    class MsgpackFormattedData final : public FormattedData {
+    public:
+        const char* GetData() override {
+            return myBuffer.data();
+        }
+
+        size_t GetSize() override {
+            return myBuffer.size();
+        }
+
+        std::string& GetBuffer() {
+            return myBuffer;
+        }
+
+    private:
+        std::string myBuffer;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_MSGPACKFORMATTEDDATA_H
@@ -0,0 +1,417 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_MSGPACKREADER_H
+#define JSONRPC_LEAN_MSGPACKREADER_H
+
+#include "reader.h"
+#include "arena.h"
+#include "fault.h"
+#include "json.h"
+#include "msgpack.h"
+#include "pool.h"
+#include "request.h"
+#include "response.h"
+#include "stringscan.h"
+#include "value.h"
+
+#include <string>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Reads MessagePack messages written by MsgpackWriter (or any other encoder of the same
+    // objects). The whole message is checked when the reader is created; the values are only
+    // decoded when asked for, straight from data, which must outlive the reader.
+    class MsgpackReader final : public Reader, public util::Pooled {
+    public:
+        MsgpackReader(const char* data, size_t size) : myData(data), mySize(size) {
+            msgpack::Cursor cursor(data, size);
+            const msgpack::Item item = msgpack::ReadItem(cursor);
+            if (item.myType == msgpack::Item::ARRAY) {
+                myIsBatch = true;
+                // every entry takes at least a byte, so a larger count cannot be right and must not
+                // size the reservation
+                if (item.mySize > static_cast<size_t>(data + size - cursor.GetPosition())) {
+                    throw ParseErrorFault("Parse error: unexpected end of MessagePack data");
+                }
+                myEntries.reserve(item.mySize);
+                for (size_t i = 0; i < item.mySize; ++i) {
+                    myEntries.push_back(cursor.GetPosition() - data);
+                    msgpack::SkipItems(cursor, 1, 1);
+                }
+            } else if (item.myType == msgpack::Item::MAP) {
+                msgpack::SkipItems(cursor, 2 * item.mySize, 1);
+            }
+
+            if (!cursor.AtEnd()) {
+                throw ParseErrorFault("Parse error: data after the MessagePack message");
+            }
+        }
+
+        // Reader
+        Request GetRequest() override {
+            return ReadRequest(0);
+        }
+
+        Response GetResponse() override {
+            return ReadResponse(0);
+        }
+
+        Value GetValue() override {
+            msgpack::Cursor cursor(myData, mySize);
+            return GetValue(cursor);
+        }
+
+        bool IsBatch() override {
+            return myIsBatch;
+        }
+
+        size_t GetBatchSize() override {
+            return myEntries.size();
+        }
+
+        Request GetRequest(size_t index) override {
+            if (index >= GetBatchSize()) {
+                throw InvalidRequestFault();
+            }
+            return ReadRequest(myEntries[index]);
+        }
+
+        Response GetResponse(size_t index) override {
+            if (index >= GetBatchSize()) {
+                throw InvalidRequestFault();
+            }
+            return ReadResponse(myEntries[index]);
+        }
+
+        void SetArena(util::Arena* arena) override {
+            myArena = arena;
+        }
+
+    private:
+        enum class Field {
+            JSONRPC,
+            METHOD,
+            PARAMS,
+            ID,
+            RESULT,
+            FAULT,
+            OTHER,
+        };
+
+        // The members of the object at offset, one at a time; like FindMember, only the first of
+        // repeated members counts, the values of the others are skipped
+        class Members {
+        public:
+            Members(const MsgpackReader& reader, size_t offset)
+                : myCursor(reader.myData + offset, reader.mySize - offset) {
+                const msgpack::Item item = msgpack::ReadItem(myCursor);
+                if (item.myType != msgpack::Item::MAP) {
+                    throw InvalidRequestFault();
+                }
+                myCount = item.mySize;
+            }
+
+            // The field of the next member, whose value is then read from GetCursor()
+            bool Next(Field& field) {
+                while (myCount > 0) {
+                    --myCount;
+                    const msgpack::Item key = msgpack::ReadItem(myCursor);
+                    if (key.myType != msgpack::Item::STRING) {
+                        throw InvalidRequestFault();
+                    }
+
+                    field = GetField(string_view(key.myData, key.mySize));
+                    const unsigned bit = 1u << static_cast<unsigned>(field);
+                    if (field != Field::OTHER && (mySeenFields & bit) == 0) {
+                        mySeenFields |= bit;
+                        return true;
+                    }
+                    msgpack::SkipItems(myCursor, 1);
+                }
+                return false;
+            }
+
+            bool Has(Field field) const {
+                return (mySeenFields & (1u << static_cast<unsigned>(field))) != 0;
+            }
+
+            msgpack::Cursor& GetCursor() { return myCursor; }
+
+        private:
+            static Field GetField(string_view key) {
+                if (key == json::JSONRPC_NAME) {
+                    return Field::JSONRPC;
+                } else if (key == json::METHOD_NAME) {
+                    return Field::METHOD;
+                } else if (key == json::PARAMS_NAME) {
+                    return Field::PARAMS;
+                } else if (key == json::ID_NAME) {
+                    return Field::ID;
+                } else if (key == json::RESULT_NAME) {
+                    return Field::RESULT;
+                } else if (key == json::ERROR_NAME) {
+                    return Field::FAULT;
+                }
+                return Field::OTHER;
+            }
+
+            msgpack::Cursor myCursor;
+            size_t myCount;
+            unsigned mySeenFields = 0;
+        };
+
+        Request ReadRequest(size_t offset) const {
+            Members members(*this, offset);
+
+            std::string method;
+            Value id;
+            Request::Parameters parameters;
+            Request::ParameterNames names;
+
+            Field field;
+            while (members.Next(field)) {
+                auto& cursor = members.GetCursor();
+                switch (field) {
+                case Field::JSONRPC:
+                    ValidateJsonrpcVersion(cursor);
+                    break;
+                case Field::METHOD: {
+                    const msgpack::Item item = msgpack::ReadItem(cursor);
+                    if (item.myType != msgpack::Item::STRING) {
+                        throw InvalidRequestFault();
+                    }
+                    method.assign(item.myData, item.mySize);
+                    break;
+                }
+                case Field::PARAMS: {
+                    const msgpack::Item item = msgpack::ReadItem(cursor);
+                    if (item.myType == msgpack::Item::ARRAY) {
+                        parameters.reserve(item.mySize);
+                        for (size_t i = 0; i < item.mySize; ++i) {
+                            parameters.emplace_back(GetValue(cursor));
+                        }
+                    } else if (item.myType == msgpack::Item::MAP) {
+                        // by name, kept as a flat list for the dispatcher to put in order
+                        for (size_t i = 0; i < item.mySize; ++i) {
+                            const msgpack::Item name = msgpack::ReadItem(cursor);
+                            if (name.myType != msgpack::Item::STRING) {
+                                throw InvalidRequestFault();
+                            }
+                            names.emplace_back(name.myData, name.mySize);
+                            parameters.emplace_back(GetValue(cursor));
+                        }
+                    } else {
+                        throw InvalidRequestFault();
+                    }
+                    break;
+                }
+                case Field::ID:
+                    id = GetId(cursor);
+                    break;
+                default:
+                    msgpack::SkipItems(cursor, 1);
+                    break;
+                }
+            }
+
+            if (!members.Has(Field::JSONRPC) || !members.Has(Field::METHOD)) {
+                throw InvalidRequestFault();
+            }
+            if (!members.Has(Field::ID)) {
+                // Notification
+                return Request(std::move(method), std::move(parameters), std::move(names), false);
+            }
+            return Request(std::move(method), std::move(parameters), std::move(names), std::move(id));
+        }
+
+        Response ReadResponse(size_t offset) const {
+            Members members(*this, offset);
+
+            Value id;
+            Value result;
+            int32_t code = 0;
+            std::string message;
+
+            Field field;
+            while (members.Next(field)) {
+                auto& cursor = members.GetCursor();
+                switch (field) {
+                case Field::JSONRPC:
+                    ValidateJsonrpcVersion(cursor);
+                    break;
+                case Field::ID:
+                    id = GetId(cursor);
+                    break;
+                case Field::RESULT:
+                    result = GetValue(cursor);
+                    break;
+                case Field::FAULT:
+                    GetError(cursor, code, message);
+                    break;
+                default:
+                    msgpack::SkipItems(cursor, 1);
+                    break;
+                }
+            }
+
+            if (!members.Has(Field::JSONRPC) || !members.Has(Field::ID)
+                || members.Has(Field::RESULT) == members.Has(Field::FAULT)) {
+                throw InvalidRequestFault();
+            }
+            if (members.Has(Field::FAULT)) {
+                return Response(code, std::move(message), std::move(id));
+            }
+            return Response(std::move(result), std::move(id));
+        }
+
+        static void ValidateJsonrpcVersion(msgpack::Cursor& cursor) {
+            const msgpack::Item item = msgpack::ReadItem(cursor);
+            if (item.myType != msgpack::Item::STRING
+                || string_view(item.myData, item.mySize) != json::JSONRPC_VERSION_2_0) {
+                throw InvalidRequestFault();
+            }
+        }
+
+        static void GetError(msgpack::Cursor& cursor, int32_t& code, std::string& message) {
+            const msgpack::Item error = msgpack::ReadItem(cursor);
+            if (error.myType != msgpack::Item::MAP) {
+                throw InvalidRequestFault();
+            }
+
+            bool hasCode = false;
+            bool hasMessage = false;
+            for (size_t i = 0; i < error.mySize; ++i) {
+                const msgpack::Item key = msgpack::ReadItem(cursor);
+                const string_view name = key.myType == msgpack::Item::STRING ? string_view(key.myData, key.mySize) : string_view();
+                if (!hasCode && name == json::ERROR_CODE_NAME) {
+                    const msgpack::Item item = msgpack::ReadItem(cursor);
+                    if (item.myType != msgpack::Item::INTEGER || static_cast<int32_t>(item.myInteger) != item.myInteger) {
+                        throw InvalidRequestFault();
+                    }
+                    code = static_cast<int32_t>(item.myInteger);
+                    hasCode = true;
+                } else if (!hasMessage && name == json::ERROR_MESSAGE_NAME) {
+                    const msgpack::Item item = msgpack::ReadItem(cursor);
+                    if (item.myType != msgpack::Item::STRING) {
+                        throw InvalidRequestFault();
+                    }
+                    message.assign(item.myData, item.mySize);
+                    hasMessage = true;
+                } else {
+                    msgpack::SkipItems(cursor, 1);
+                }
+            }
+
+            if (!hasCode || !hasMessage) {
+                throw InvalidRequestFault();
+            }
+        }
+
+        static Value GetId(msgpack::Cursor& cursor) {
+            const msgpack::Item item = msgpack::ReadItem(cursor);
+            switch (item.myType) {
+            case msgpack::Item::STRING:
+                return Value(std::string(item.myData, item.mySize));
+            case msgpack::Item::INTEGER:
+                return MakeInteger(item.myInteger);
+            case msgpack::Item::NIL:
+                return{};
+            default:
+                throw InvalidRequestFault();
+            }
+        }
+
+        static Value MakeInteger(int64_t value) {
+            if (static_cast<int32_t>(value) == value) {
+                return Value(static_cast<int32_t>(value));
+            }
+            return Value(value);
+        }
+
+        Value GetValue(msgpack::Cursor& cursor) const {
+            const msgpack::Item item = msgpack::ReadItem(cursor);
+            switch (item.myType) {
+            case msgpack::Item::NIL:
+                return Value();
+            case msgpack::Item::BOOLEAN:
+                return Value(item.myBoolean);
+            case msgpack::Item::INTEGER:
+                return MakeInteger(item.myInteger);
+            case msgpack::Item::DOUBLE:
+                return Value(item.myDouble);
+            case msgpack::Item::STRING:
+                return MakeString(item.myData, item.mySize);
+            case msgpack::Item::BINARY:
+                return Value(Binary(item.myData, item.mySize));
+            case msgpack::Item::EXTENSION: {
+                tm dt;
+                if (!msgpack::ReadTimestamp(item, dt)) {
+                    throw InvalidRequestFault("Unsupported MessagePack extension type");
+                }
+                return Value(dt, myArena);
+            }
+            case msgpack::Item::ARRAY: {
+                Value::Array array{ Value::Array::allocator_type(myArena) };
+                array.reserve(item.mySize);
+                for (size_t i = 0; i < item.mySize; ++i) {
+                    array.emplace_back(GetValue(cursor));
+                }
+                return Value(std::move(array));
+            }
+            case msgpack::Item::MAP: {
+                Value::Struct data{ Value::Struct::allocator_type(myArena) };
+                for (size_t i = 0; i < item.mySize; ++i) {
+                    const msgpack::Item key = msgpack::ReadItem(cursor);
+                    if (key.myType != msgpack::Item::STRING) {
+                        throw InvalidRequestFault();
+                    }
+                    std::string name(key.myData, key.mySize);
+                    data.emplace(std::move(name), GetValue(cursor));
+                }
+                return Value(std::move(data));
+            }
+            }
+
+            throw InternalErrorFault();
+        }
+
+        // Copied to the arena, or to the heap if there is none; unlike JSON strings, a string with a
+        // NUL is still a STRING since binary data has a format of its own
+        Value MakeString(const char* str, size_t size) const {
+            if (myArena != nullptr) {
+                char* copy = static_cast<char*>(myArena->Allocate(size, 1));
+                util::StringInfo info = util::CopyAndClassifyString(copy, str, size);
+                info.myHasNul = false;
+                return Value::Borrow(string_view(copy, size), info);
+            }
+
+            util::StringInfo info = util::ClassifyString(str, size);
+            info.myHasNul = false;
+            return Value(std::string(str, size), info);
+        }
+
+        const char* myData;
+        size_t mySize;
+        bool myIsBatch = false;
+        std::vector<size_t> myEntries;
+        util::Arena* myArena = nullptr;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_MSGPACKREADER_H
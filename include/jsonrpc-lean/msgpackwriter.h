@@ -0,0 +1,416 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_MSGPACKWRITER_H
+#define JSONRPC_LEAN_MSGPACKWRITER_H
+
+#include "writer.h"
+#include "cachedvalue.h"
+#include "json.h"
+#include "msgpack.h"
+#include "msgpackformatteddata.h"
+#include "pool.h"
+#include "smallvector.h"
+#include "value.h"
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace jsonrpc {
+
+    // Writes the JSON-RPC 2.0 objects (same member names as in JSON) and values as MessagePack.
+    // Arrays and maps are written before their size is known: each gets room for the largest
+    // header, which is replaced by the smallest one that fits once the container is complete.
+    class MsgpackWriter final : public Writer, public util::Pooled {
+    public:
+        MsgpackWriter()
+            : myData(std::allocate_shared<MsgpackFormattedData>(util::PoolAllocator<MsgpackFormattedData>())),
+            myBuffer(myData->GetBuffer()) {
+        }
+
+        // Writer
+        std::shared_ptr<FormattedData> GetData() override {
+            return std::static_pointer_cast<FormattedData>(myData);
+        }
+
+        size_t GetSize() override {
+            return myData->GetSize();
+        }
+
+        void StartDocument() override {
+            // Empty
+        }
+
+        void EndDocument() override {
+            // Empty
+        }
+
+        void StartRequest(const std::string& methodName, const Value& id) override {
+            CountValue();
+            WriteMapHeader(HasId(id) ? 4 : 3);
+
+            WriteKey(json::JSONRPC_NAME);
+            WriteString(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+
+            WriteKey(json::METHOD_NAME);
+            WriteString(methodName.data(), methodName.size());
+
+            WriteId(id);
+
+            WriteKey(json::PARAMS_NAME);
+            StartContainer(Container::ARRAY);
+        }
+
+        void EndRequest() override {
+            EndContainer();
+        }
+
+        void StartParameter() override {
+            // Empty
+        }
+
+        void EndParameter() override {
+            // Empty
+        }
+
+        void StartResponse(const Value& id) override {
+            CountValue();
+            WriteMapHeader(HasId(id) ? 3 : 2);
+
+            WriteKey(json::JSONRPC_NAME);
+            WriteString(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+
+            WriteId(id);
+
+            WriteKey(json::RESULT_NAME);
+            StartContainer(Container::OBJECT);
+        }
+
+        void EndResponse() override {
+            EndContainer();
+        }
+
+        void StartFaultResponse(const Value& id) override {
+            CountValue();
+            WriteMapHeader(HasId(id) ? 3 : 2);
+
+            WriteKey(json::JSONRPC_NAME);
+            WriteString(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+
+            WriteId(id);
+            StartContainer(Container::OBJECT);
+        }
+
+        void EndFaultResponse() override {
+            EndContainer();
+        }
+
+        void WriteFault(int32_t code, const std::string& string) override {
+            WriteKey(json::ERROR_NAME);
+            WriteMapHeader(2);
+
+            WriteKey(json::ERROR_CODE_NAME);
+            WriteInteger(code);
+
+            WriteKey(json::ERROR_MESSAGE_NAME);
+            WriteString(string.data(), string.size());
+        }
+
+        void StartBatch() override {
+            StartContainer(Container::ARRAY);
+        }
+
+        void EndBatch() override {
+            EndContainer();
+        }
+
+        void StartArray() override {
+            CountValue();
+            StartContainer(Container::ARRAY);
+        }
+
+        void EndArray() override {
+            EndContainer();
+        }
+
+        void StartStruct() override {
+            CountValue();
+            StartContainer(Container::MAP);
+        }
+
+        void EndStruct() override {
+            EndContainer();
+        }
+
+        void StartStructElement(const std::string& name) override {
+            assert(!myContainers.empty() && myContainers.back().myKind == Container::MAP);
+            ++myContainers.back().myCount;
+            WriteString(name.data(), name.size());
+        }
+
+        void EndStructElement() override {
+            // Empty
+        }
+
+        void WriteBinary(const char* data, size_t size) override {
+            CountValue();
+            if (size <= 0xff) {
+                Put(msgpack::BIN8);
+                Put(static_cast<uint8_t>(size));
+            } else if (size <= 0xffff) {
+                Put(msgpack::BIN16);
+                PutBigEndian(static_cast<uint16_t>(size));
+            } else {
+                Put(msgpack::BIN32);
+                PutBigEndian(static_cast<uint32_t>(size));
+            }
+            myBuffer.append(data, size);
+        }
+
+        void WriteNull() override {
+            CountValue();
+            Put(msgpack::NIL);
+        }
+
+        void Write(bool value) override {
+            CountValue();
+            Put(value ? msgpack::BOOL_TRUE : msgpack::BOOL_FALSE);
+        }
+
+        void Write(double value) override {
+            CountValue();
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            Put(msgpack::FLOAT64);
+            PutBigEndian(bits);
+        }
+
+        void Write(int32_t value) override {
+            CountValue();
+            WriteInteger(value);
+        }
+
+        void Write(int64_t value) override {
+            CountValue();
+            WriteInteger(value);
+        }
+
+        void Write(const std::string& value) override {
+            CountValue();
+            WriteString(value.data(), value.size());
+        }
+
+        void Write(string_view value) override {
+            CountValue();
+            WriteString(value.data(), value.size());
+        }
+
+        // As a timestamp extension: 32 bit seconds where they fit, otherwise 64 bit seconds
+        void Write(const tm& value) override {
+            CountValue();
+            const int64_t seconds = msgpack::ToTimestamp(value);
+            if (seconds >= 0 && seconds <= 0xffffffffLL) {
+                Put(msgpack::FIXEXT4);
+                Put(static_cast<uint8_t>(msgpack::TIMESTAMP_TYPE));
+                PutBigEndian(static_cast<uint32_t>(seconds));
+            } else {
+                Put(msgpack::EXT8);
+                Put(12);
+                Put(static_cast<uint8_t>(msgpack::TIMESTAMP_TYPE));
+                PutBigEndian(static_cast<uint32_t>(0));
+                PutBigEndian(static_cast<uint64_t>(seconds));
+            }
+        }
+
+        bool WriteCached(const CachedValue& value) override {
+            const auto bytes = value.GetEncoding(CachedValue::MSGPACK, [](const Value& value, std::string& bytes) {
+                MsgpackWriter writer;
+                value.Write(writer);
+                bytes = std::move(writer.myBuffer);
+            });
+            CountValue();
+            myBuffer.append(bytes.data(), bytes.size());
+            return true;
+        }
+
+    private:
+        struct Container {
+            enum Kind : uint8_t {
+                ARRAY, // counts its values
+                MAP, // counts its keys
+                OBJECT, // a request or response map, its size is written up front
+            };
+
+            size_t myOffset;
+            size_t myCount;
+            Kind myKind;
+        };
+
+        static const size_t MAX_HEADER_SIZE = 5;
+
+        void StartContainer(Container::Kind kind) {
+            myContainers.push_back(Container{ myBuffer.size(), 0, kind });
+            if (kind != Container::OBJECT) {
+                myBuffer.append(MAX_HEADER_SIZE, '\0');
+            }
+        }
+
+        void EndContainer() {
+            assert(!myContainers.empty());
+            const Container container = myContainers.back();
+            myContainers.pop_back();
+            if (container.myKind == Container::OBJECT) {
+                return;
+            }
+
+            uint8_t header[MAX_HEADER_SIZE];
+            const size_t count = container.myCount;
+            size_t headerSize;
+            if (count <= 15) {
+                header[0] = static_cast<uint8_t>((container.myKind == Container::ARRAY ? msgpack::FIXARRAY : msgpack::FIXMAP) | count);
+                headerSize = 1;
+            } else if (count <= 0xffff) {
+                header[0] = container.myKind == Container::ARRAY ? msgpack::ARRAY16 : msgpack::MAP16;
+                header[1] = static_cast<uint8_t>(count >> 8);
+                header[2] = static_cast<uint8_t>(count);
+                headerSize = 3;
+            } else {
+                header[0] = container.myKind == Container::ARRAY ? msgpack::ARRAY32 : msgpack::MAP32;
+                for (size_t i = 1; i < 5; ++i) {
+                    header[i] = static_cast<uint8_t>(count >> (8 * (4 - i)));
+                }
+                headerSize = 5;
+            }
+
+            // the elements move up to the header when it is smaller than the room kept for it
+            char* start = &myBuffer[container.myOffset];
+            if (headerSize < MAX_HEADER_SIZE) {
+                const size_t bodySize = myBuffer.size() - container.myOffset - MAX_HEADER_SIZE;
+                memmove(start + headerSize, start + MAX_HEADER_SIZE, bodySize);
+                myBuffer.resize(myBuffer.size() - (MAX_HEADER_SIZE - headerSize));
+            }
+            memcpy(start, header, headerSize);
+        }
+
+        void CountValue() {
+            if (!myContainers.empty() && myContainers.back().myKind == Container::ARRAY) {
+                ++myContainers.back().myCount;
+            }
+        }
+
+        static bool HasId(const Value& id) {
+            return id.IsString() || id.IsInteger32() || id.IsInteger64() || id.IsNil();
+        }
+
+        void WriteId(const Value& id) {
+            if (!HasId(id)) {
+                return;
+            }
+            WriteKey(json::ID_NAME);
+            if (id.IsString()) {
+                const auto str = id.AsStringView();
+                WriteString(str.data(), str.size());
+            } else if (id.IsNil()) {
+                Put(msgpack::NIL);
+            } else {
+                WriteInteger(id.AsInteger64());
+            }
+        }
+
+        template<size_t N>
+        void WriteKey(const char(&name)[N]) {
+            WriteString(name, N - 1);
+        }
+
+        void WriteMapHeader(size_t count) {
+            assert(count <= 15);
+            Put(static_cast<uint8_t>(msgpack::FIXMAP | count));
+        }
+
+        void WriteString(const char* data, size_t size) {
+            if (size <= 31) {
+                Put(static_cast<uint8_t>(msgpack::FIXSTR | size));
+            } else if (size <= 0xff) {
+                Put(msgpack::STR8);
+                Put(static_cast<uint8_t>(size));
+            } else if (size <= 0xffff) {
+                Put(msgpack::STR16);
+                PutBigEndian(static_cast<uint16_t>(size));
+            } else {
+                Put(msgpack::STR32);
+                PutBigEndian(static_cast<uint32_t>(size));
+            }
+            myBuffer.append(data, size);
+        }
+
+        // In the smallest format that holds the value
+        void WriteInteger(int64_t value) {
+            if (value >= 0) {
+                if (value <= msgpack::POSITIVE_FIXINT_MAX) {
+                    Put(static_cast<uint8_t>(value));
+                } else if (value <= 0xff) {
+                    Put(msgpack::UINT8);
+                    Put(static_cast<uint8_t>(value));
+                } else if (value <= 0xffff) {
+                    Put(msgpack::UINT16);
+                    PutBigEndian(static_cast<uint16_t>(value));
+                } else if (value <= 0xffffffffLL) {
+                    Put(msgpack::UINT32);
+                    PutBigEndian(static_cast<uint32_t>(value));
+                } else {
+                    Put(msgpack::UINT64);
+                    PutBigEndian(static_cast<uint64_t>(value));
+                }
+            } else if (value >= -32) {
+                Put(static_cast<uint8_t>(value));
+            } else if (value >= INT8_MIN) {
+                Put(msgpack::INT8);
+                Put(static_cast<uint8_t>(value));
+            } else if (value >= INT16_MIN) {
+                Put(msgpack::INT16);
+                PutBigEndian(static_cast<uint16_t>(value));
+            } else if (value >= INT32_MIN) {
+                Put(msgpack::INT32);
+                PutBigEndian(static_cast<uint32_t>(value));
+            } else {
+                Put(msgpack::INT64);
+                PutBigEndian(static_cast<uint64_t>(value));
+            }
+        }
+
+        void Put(uint8_t byte) {
+            myBuffer.push_back(static_cast<char>(byte));
+        }
+
+        template<typename T>
+        void PutBigEndian(T value) {
+            char bytes[sizeof(T)];
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                bytes[i] = static_cast<char>(value >> (8 * (sizeof(T) - 1 - i)));
+            }
+            myBuffer.append(bytes, sizeof(T));
+        }
+
+        std::shared_ptr<MsgpackFormattedData> myData;
+        std::string& myBuffer;
+        util::SmallVector<Container, 8> myContainers;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_MSGPACKWRITER_H
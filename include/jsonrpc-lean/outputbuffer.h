@@ -0,0 +1,192 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_OUTPUTBUFFER_H
+#define JSONRPC_LEAN_OUTPUTBUFFER_H
+
+#include "compat.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsonrpc {
+    namespace util {
+
+        // Output that is appended to a std::string owned by the caller. Reusing the same string
+        // (cleared) for every message keeps its capacity, so no reallocation happens once it has grown.
+        class StringOutput {
+        public:
+            typedef char Ch;
+
+            explicit StringOutput(std::string& target) : myTarget(target) {}
+
+            // rapidjson output stream
+            void Put(char c) { myTarget.push_back(c); }
+            void Flush() {}
+
+            void Append(const char* data, size_t size) { myTarget.append(data, size); }
+
+            const char* GetData() const { return myTarget.data(); }
+            size_t GetSize() const { return myTarget.size(); }
+
+        private:
+            std::string& myTarget;
+        };
+
+        // Output that is first written to a fixed buffer owned by the caller; what does not fit goes
+        // to overflow blocks of blockSize bytes chained after it. The result is a list of segments,
+        // e.g. for writev, so it is never copied to be made contiguous unless GetData() is called.
+        // Clear() keeps the overflow blocks for the next message.
+        class OutputBuffer {
+        public:
+            typedef char Ch;
+
+            explicit OutputBuffer(size_t blockSize = 4096)
+                : myBlockSize(blockSize) {
+            }
+
+            OutputBuffer(char* buffer, size_t capacity, size_t blockSize = 4096)
+                : myBuffer(buffer),
+                myCapacity(capacity),
+                mySegmentStart(buffer),
+                myCurrent(buffer),
+                myEnd(buffer + capacity),
+                myBlockSize(blockSize) {
+            }
+
+            OutputBuffer(const OutputBuffer&) = delete;
+            OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+            // rapidjson output stream
+            void Put(char c) {
+                if (myCurrent == myEnd) {
+                    NextSegment(1);
+                }
+                *myCurrent++ = c;
+            }
+
+            void Flush() {}
+
+            void Append(const char* data, size_t size) {
+                while (size > 0) {
+                    if (myCurrent == myEnd) {
+                        NextSegment(size);
+                    }
+                    const size_t count = std::min(size, static_cast<size_t>(myEnd - myCurrent));
+                    memcpy(myCurrent, data, count);
+                    myCurrent += count;
+                    data += count;
+                    size -= count;
+                }
+            }
+
+            size_t GetSize() const {
+                return myCompletedSize + (myCurrent - mySegmentStart);
+            }
+
+            size_t GetSegmentCount() const {
+                return mySegments.size() + (myCurrent != mySegmentStart ? 1 : 0);
+            }
+
+            string_view GetSegment(size_t index) const {
+                if (index < mySegments.size()) {
+                    return mySegments[index];
+                }
+                return string_view(mySegmentStart, myCurrent - mySegmentStart);
+            }
+
+            // Fills up to count iovec-like structures (anything with iov_base and iov_len) and
+            // returns how many were filled
+            template<typename IoVec>
+            size_t GetIoVecs(IoVec* iov, size_t count) const {
+                const size_t segments = std::min(count, GetSegmentCount());
+                for (size_t i = 0; i < segments; ++i) {
+                    const string_view segment = GetSegment(i);
+                    iov[i].iov_base = const_cast<char*>(segment.data());
+                    iov[i].iov_len = segment.size();
+                }
+                return segments;
+            }
+
+            // Contiguous contents; only copied if the output did not fit in one segment
+            const char* GetData() {
+                switch (GetSegmentCount()) {
+                case 0:
+                    return "";
+                case 1:
+                    return GetSegment(0).data();
+                default:
+                    myContiguous.clear();
+                    myContiguous.reserve(GetSize());
+                    for (size_t i = 0; i < GetSegmentCount(); ++i) {
+                        const string_view segment = GetSegment(i);
+                        myContiguous.append(segment.data(), segment.size());
+                    }
+                    return myContiguous.data();
+                }
+            }
+
+            void Clear() {
+                mySegments.clear();
+                myCompletedSize = 0;
+                myNextBlock = 0;
+                mySegmentStart = myCurrent = myBuffer;
+                myEnd = myBuffer + myCapacity;
+            }
+
+        private:
+            void NextSegment(size_t minSize) {
+                if (myCurrent != mySegmentStart) {
+                    mySegments.emplace_back(mySegmentStart, myCurrent - mySegmentStart);
+                    myCompletedSize += myCurrent - mySegmentStart;
+                }
+
+                // blocks left over from before the last Clear() are reused if they are big enough
+                if (myNextBlock == myBlocks.size() || myBlocks[myNextBlock].second < minSize) {
+                    const size_t size = minSize > myBlockSize ? minSize : myBlockSize;
+                    myBlocks.emplace(myBlocks.begin() + myNextBlock, std::unique_ptr<char[]>(new char[size]), size);
+                }
+
+                auto& block = myBlocks[myNextBlock++];
+                mySegmentStart = myCurrent = block.first.get();
+                myEnd = myCurrent + block.second;
+            }
+
+            char* myBuffer = nullptr;
+            size_t myCapacity = 0;
+
+            char* mySegmentStart = nullptr;
+            char* myCurrent = nullptr;
+            char* myEnd = nullptr;
+
+            std::vector<string_view> mySegments;
+            size_t myCompletedSize = 0;
+
+            std::vector<std::pair<std::unique_ptr<char[]>, size_t>> myBlocks;
+            size_t myNextBlock = 0;
+            size_t myBlockSize;
+
+            std::string myContiguous;
+        };
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_OUTPUTBUFFER_H
@@ -0,0 +1,223 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_POOL_H
+#define JSONRPC_LEAN_POOL_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+namespace jsonrpc {
+    namespace util {
+
+        // Per-thread free lists of memory blocks, one per power of two size class from 64 bytes to
+        // 64 KiB. Blocks freed on a thread are reused by the next allocations of that thread (a block
+        // may be freed on another thread than the one it came from); bigger sizes go to the heap.
+        class ThreadCache {
+        public:
+            static const size_t MIN_BLOCK_SIZE = 64;
+            static const size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+            static void* Allocate(size_t size) {
+                const size_t index = GetClass(size);
+                if (index == CLASS_COUNT) {
+                    return ::operator new(size);
+                }
+
+                State& state = GetState();
+                FreeBlock* block = state.myHeads[index];
+                if (block != nullptr) {
+                    state.myHeads[index] = block->myNext;
+                    --state.myCounts[index];
+                    return block;
+                }
+                return ::operator new(GetClassSize(index));
+            }
+
+            static void Deallocate(void* ptr, size_t size) {
+                if (ptr == nullptr) {
+                    return;
+                }
+
+                const size_t index = GetClass(size);
+                State& state = GetState();
+                if (index == CLASS_COUNT || !state.myIsOpen || state.myCounts[index] >= GetMaxCount(index)) {
+                    ::operator delete(ptr);
+                    return;
+                }
+
+                FreeBlock* block = static_cast<FreeBlock*>(ptr);
+                block->myNext = state.myHeads[index];
+                state.myHeads[index] = block;
+                ++state.myCounts[index];
+            }
+
+            // The usable size of a block allocated for size bytes
+            static size_t GetCapacity(size_t size) {
+                const size_t index = GetClass(size);
+                return index == CLASS_COUNT ? size : GetClassSize(index);
+            }
+
+        private:
+            static const size_t CLASS_COUNT = 11; // 64 B .. 64 KiB
+            static const size_t MAX_CACHED_BYTES = 256 * 1024; // per class and thread
+
+            struct FreeBlock {
+                FreeBlock* myNext;
+            };
+
+            // Plain data, so it stays usable while other thread_local objects are destroyed
+            struct State {
+                FreeBlock* myHeads[CLASS_COUNT];
+                size_t myCounts[CLASS_COUNT];
+                bool myIsOpen;
+            };
+
+            // Gives the cached blocks back when the thread exits
+            struct Reaper {
+                explicit Reaper(State& state) : myState(state) {}
+                ~Reaper() {
+                    myState.myIsOpen = false;
+                    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+                        while (myState.myHeads[i] != nullptr) {
+                            FreeBlock* next = myState.myHeads[i]->myNext;
+                            ::operator delete(myState.myHeads[i]);
+                            myState.myHeads[i] = next;
+                        }
+                        myState.myCounts[i] = 0;
+                    }
+                }
+                State& myState;
+            };
+
+            static State& GetState() {
+                static thread_local State state = { {}, {}, true };
+                static thread_local Reaper reaper(state);
+                (void)reaper;
+                return state;
+            }
+
+            static size_t GetClass(size_t size) {
+                size_t index = 0;
+                while (index < CLASS_COUNT && GetClassSize(index) < size) {
+                    ++index;
+                }
+                return index;
+            }
+
+            static size_t GetClassSize(size_t index) {
+                return MIN_BLOCK_SIZE << index;
+            }
+
+            static size_t GetMaxCount(size_t index) {
+                const size_t count = MAX_CACHED_BYTES / GetClassSize(index);
+                return count < 4 ? 4 : count;
+            }
+        };
+
+        // Base class for objects that are created and destroyed for every message: their memory is
+        // recycled through ThreadCache. Types deleted through a base pointer need a virtual destructor.
+        class Pooled {
+        public:
+            static void* operator new(size_t size) {
+                return ThreadCache::Allocate(size);
+            }
+
+            static void operator delete(void* ptr, size_t size) {
+                ThreadCache::Deallocate(ptr, size);
+            }
+        };
+
+        // Standard allocator over ThreadCache, e.g. for std::allocate_shared
+        template<typename T>
+        class PoolAllocator {
+        public:
+            typedef T value_type;
+
+            PoolAllocator() noexcept {}
+
+            template<typename U>
+            PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+            T* allocate(size_t n) {
+                return static_cast<T*>(ThreadCache::Allocate(n * sizeof(T)));
+            }
+
+            void deallocate(T* ptr, size_t n) noexcept {
+                ThreadCache::Deallocate(ptr, n * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const PoolAllocator<U>&) const { return true; }
+
+            template<typename U>
+            bool operator!=(const PoolAllocator<U>&) const { return false; }
+        };
+
+        // Allocator with the interface rapidjson expects (Malloc, Realloc, static Free), over ThreadCache.
+        // Used for the parse stacks, string buffers and document chunks of the JSON readers and writers.
+        class CachedAllocator {
+        public:
+            static const bool kNeedFree = true;
+
+            void* Malloc(size_t size) {
+                if (size == 0) {
+                    return nullptr;
+                }
+                Header* header = static_cast<Header*>(ThreadCache::Allocate(sizeof(Header) + size));
+                header->mySize = sizeof(Header) + size;
+                return header + 1;
+            }
+
+            void* Realloc(void* ptr, size_t originalSize, size_t newSize) {
+                if (ptr == nullptr) {
+                    return Malloc(newSize);
+                }
+                if (newSize == 0) {
+                    Free(ptr);
+                    return nullptr;
+                }
+
+                Header* header = static_cast<Header*>(ptr) - 1;
+                if (sizeof(Header) + newSize <= ThreadCache::GetCapacity(header->mySize)) {
+                    return ptr;
+                }
+
+                void* result = Malloc(newSize);
+                memcpy(result, ptr, originalSize < newSize ? originalSize : newSize);
+                Free(ptr);
+                return result;
+            }
+
+            static void Free(void* ptr) {
+                if (ptr != nullptr) {
+                    Header* header = static_cast<Header*>(ptr) - 1;
+                    ThreadCache::Deallocate(header, header->mySize);
+                }
+            }
+
+        private:
+            // keeps the returned memory aligned like the blocks themselves
+            struct alignas(std::max_align_t) Header {
+                size_t mySize; // as allocated
+            };
+        };
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_POOL_H
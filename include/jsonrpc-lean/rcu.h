@@ -0,0 +1,188 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_RCU_H
+#define JSONRPC_LEAN_RCU_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace jsonrpc {
+    namespace util {
+
+        // The read sections of one thread, for every RcuPointer. myGeneration is 0 outside of a read
+        // section, otherwise the generation (see RcuGeneration) when the outermost one started.
+        // The slots form a list that only grows; a slot is reused once its thread has exited.
+        struct RcuReaderSlot {
+            char myPadding[64];
+            std::atomic<uint64_t> myGeneration{ 0 };
+            size_t myDepth = 0;
+            std::atomic<bool> myIsUsed{ true };
+            RcuReaderSlot* myNext = nullptr;
+        };
+
+        inline std::atomic<RcuReaderSlot*>& RcuReaderSlots() {
+            static std::atomic<RcuReaderSlot*> slots{ nullptr };
+            return slots;
+        }
+
+        // Advanced by every publish; a value retired in generation g may still be read by the read
+        // sections that started before g
+        inline std::atomic<uint64_t>& RcuGeneration() {
+            static std::atomic<uint64_t> generation{ 1 };
+            return generation;
+        }
+
+        inline RcuReaderSlot& GetRcuReaderSlot() {
+            struct Owner {
+                Owner() {
+                    auto& slots = RcuReaderSlots();
+                    for (RcuReaderSlot* free = slots.load(std::memory_order_acquire); free != nullptr; free = free->myNext) {
+                        bool isUsed = false;
+                        if (!free->myIsUsed.load(std::memory_order_relaxed) &&
+                            free->myIsUsed.compare_exchange_strong(isUsed, true, std::memory_order_acquire)) {
+                            mySlot = free;
+                            return;
+                        }
+                    }
+
+                    // never deleted, the writers may be looking at it at any time
+                    mySlot = new RcuReaderSlot();
+                    RcuReaderSlot* head = slots.load(std::memory_order_relaxed);
+                    do {
+                        mySlot->myNext = head;
+                    } while (!slots.compare_exchange_weak(head, mySlot, std::memory_order_release, std::memory_order_relaxed));
+                }
+
+                ~Owner() {
+                    mySlot->myIsUsed.store(false, std::memory_order_release);
+                }
+
+                RcuReaderSlot* mySlot;
+            };
+
+            static thread_local Owner owner;
+            return *owner.mySlot;
+        }
+
+        // Read-copy-update pointer: readers see an immutable value without taking a lock, writers
+        // publish a new value and the old one is deleted once every reader that could still see
+        // it is done. A reader only writes to the slot of its own thread (see RcuReaderSlot), so
+        // readers on different threads do not contend. Publish does not wait for the readers: the
+        // old value is retired and deleted by a later Publish (or the destructor) once no read
+        // section that started before it was retired is left.
+        // Publish() calls must be serialized by the caller; read sections may nest and may publish.
+        template<typename T>
+        class RcuPointer {
+        public:
+            // Read section: the value, and whatever it owns, stays valid while the guard lives
+            class ReadGuard {
+            public:
+                ReadGuard(ReadGuard&& other) noexcept : mySlot(other.mySlot), myValue(other.myValue) {
+                    other.mySlot = nullptr;
+                }
+
+                ~ReadGuard() {
+                    if (mySlot != nullptr && --mySlot->myDepth == 0) {
+                        mySlot->myGeneration.store(0, std::memory_order_release);
+                    }
+                }
+
+                ReadGuard(const ReadGuard&) = delete;
+                ReadGuard& operator=(const ReadGuard&) = delete;
+                ReadGuard& operator=(ReadGuard&&) = delete;
+
+                const T* Get() const { return myValue; }
+                const T* operator->() const { return myValue; }
+                const T& operator*() const { return *myValue; }
+
+            private:
+                friend class RcuPointer;
+
+                ReadGuard(RcuReaderSlot& slot, const T* value) : mySlot(&slot), myValue(value) {}
+
+                RcuReaderSlot* mySlot;
+                const T* myValue;
+            };
+
+            explicit RcuPointer(std::unique_ptr<T> value = nullptr) : myValue(value.release()) {}
+
+            // No read section may be left
+            ~RcuPointer() {
+                delete myValue.load();
+                for (auto& retired : myRetired) {
+                    delete retired.second;
+                }
+            }
+
+            RcuPointer(const RcuPointer&) = delete;
+            RcuPointer& operator=(const RcuPointer&) = delete;
+
+            ReadGuard Read() const {
+                RcuReaderSlot& slot = GetRcuReaderSlot();
+                if (slot.myDepth++ == 0) {
+                    // seq_cst, so that a writer scanning the slots after its exchange either sees
+                    // this section or is seen by the load of myValue below; acquire, so that a
+                    // section starting in the generation of a Publish sees its value
+                    slot.myGeneration.store(RcuGeneration().load(std::memory_order_acquire));
+                }
+                return ReadGuard(slot, myValue.load());
+            }
+
+            // Replaces the value; the previous one is deleted once its readers are done
+            void Publish(std::unique_ptr<T> value) {
+                T* previous = myValue.exchange(value.release());
+                const uint64_t generation = RcuGeneration().fetch_add(1) + 1;
+                if (previous != nullptr) {
+                    myRetired.emplace_back(generation, previous);
+                }
+                Reclaim();
+            }
+
+        private:
+            // Deletes the retired values that no read section can see any more
+            void Reclaim() {
+                uint64_t oldest = UINT64_MAX;
+                for (RcuReaderSlot* slot = RcuReaderSlots().load(std::memory_order_acquire); slot != nullptr; slot = slot->myNext) {
+                    const uint64_t generation = slot->myGeneration.load();
+                    if (generation != 0 && generation < oldest) {
+                        oldest = generation;
+                    }
+                }
+
+                size_t kept = 0;
+                for (auto& retired : myRetired) {
+                    if (retired.first <= oldest) {
+                        delete retired.second;
+                    } else {
+                        myRetired[kept++] = retired;
+                    }
+                }
+                myRetired.resize(kept);
+            }
+
+            std::atomic<T*> myValue;
+            std::vector<std::pair<uint64_t, T*>> myRetired; // by the generation they were retired in
+        };
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_RCU_H
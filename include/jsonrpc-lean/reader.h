@@ -20,10 +20,18 @@
 #ifndef JSONRPC_LEAN_READER_H
 #define JSONRPC_LEAN_READER_H
 
+#include "fault.h"
+#include "request.h"
+#include "response.h"
+
+#include <cstddef>
+
 namespace jsonrpc {
 
-    class Request;
-    class Response;
+    namespace util {
+        class Arena;
+    } // namespace util
+
     class Value;
 
     class Reader {
@@ -33,6 +41,34 @@ namespace jsonrpc {
         virtual Request GetRequest() = 0;
         virtual Response GetResponse() = 0;
         virtual Value GetValue() = 0;
+
+        // Batch (a top-level array of requests)
+        // GetRequest(index) / GetResponse(index) throw a Fault if that single entry is not valid.
+        // A format without batches holds one entry, read by the calls without an index.
+        virtual bool IsBatch() { return false; }
+        virtual size_t GetBatchSize() { return 1; }
+
+        virtual Request GetRequest(size_t index) {
+            if (index != 0) {
+                throw InvalidRequestFault();
+            }
+            return GetRequest();
+        }
+
+        virtual Response GetResponse(size_t index) {
+            if (index != 0) {
+                throw InvalidRequestFault();
+            }
+            return GetResponse();
+        }
+
+        // Values read after this call may take their memory from arena (readers are free to
+        // ignore it), so they must not outlive it
+        virtual void SetArena(util::Arena* /*arena*/) {}
+
+        // Whether strings that look like ISO 8601 date-times are read as DATE_TIME values (the
+        // default) or left as strings
+        virtual void SetDateTimeDetection(bool /*detect*/) {}
     };
 
 } // namespace jsonrpc
@@ -20,9 +20,9 @@
 #ifndef JSONRPC_LEAN_REQUEST_H
 #define JSONRPC_LEAN_REQUEST_H
 
+#include "smallvector.h"
 #include "value.h"
 
-#include <deque>
 #include <string>
 
 namespace jsonrpc {
@@ -31,7 +31,11 @@ namespace jsonrpc {
 
     class Request {
     public:
-        typedef std::deque<Value> Parameters;
+        // Contiguous, and without allocation for up to 4 parameters
+        typedef util::SmallVector<Value, 4> Parameters;
+
+        // Named parameters (params given as an object): the name of each parameter, in order
+        typedef util::SmallVector<std::string, 4> ParameterNames;
 
         Request(std::string methodName, Parameters parameters, Value id)
             : myMethodName(std::move(methodName)),
@@ -40,10 +44,27 @@ namespace jsonrpc {
             // Empty
         }
 
+        Request(std::string methodName, Parameters parameters, ParameterNames parameterNames, Value id)
+            : myMethodName(std::move(methodName)),
+            myParameters(std::move(parameters)),
+            myParameterNames(std::move(parameterNames)),
+            myId(std::move(id)) {
+            // Empty
+        }
+
         const std::string& GetMethodName() const { return myMethodName; }
         const Parameters& GetParameters() const { return myParameters; }
+        Parameters& GetParameters() { return myParameters; }
+        const ParameterNames& GetParameterNames() const { return myParameterNames; }
+        bool HasNamedParameters() const { return !myParameterNames.empty(); }
         const Value& GetId() const { return myId; }
 
+        // Replaces the parameters with positional ones
+        void SetParameters(Parameters parameters) {
+            myParameters = std::move(parameters);
+            myParameterNames.clear();
+        }
+
         void Write(Writer& writer) const {
             Write(myMethodName, myParameters, myId, writer);
         }
@@ -63,6 +84,7 @@ namespace jsonrpc {
     private:
         std::string myMethodName;
         Parameters myParameters;
+        ParameterNames myParameterNames;
         Value myId;
     };
 
@@ -20,8 +20,11 @@
 #ifndef JSONRPC_LEAN_RESPONSE_H
 #define JSONRPC_LEAN_RESPONSE_H
 
+#include "cachedvalue.h"
 #include "value.h"
 
+#include <memory>
+
 namespace jsonrpc {
 
     class Writer;
@@ -34,6 +37,13 @@ namespace jsonrpc {
             myId(std::move(id)) {
         }
 
+        // A cached result, written from its cached encoding
+        Response(std::shared_ptr<const CachedValue> value, Value id) : myIsFault(false),
+            myFaultCode(0),
+            myId(std::move(id)),
+            myCachedResult(std::move(value)) {
+        }
+
         Response(int32_t faultCode, std::string faultString, Value id) : myIsFault(true),
             myFaultCode(faultCode),
             myFaultString(std::move(faultString)),
@@ -48,14 +58,29 @@ namespace jsonrpc {
                 writer.EndFaultResponse();
             } else {
                 writer.StartResponse(myId);
-                myResult.Write(writer);
+                if (!myCachedResult) {
+                    myResult.Write(writer);
+                } else if (!writer.WriteCached(*myCachedResult)) {
+                    myCachedResult->GetValue().Write(writer);
+                }
                 writer.EndResponse();
             }
             writer.EndDocument();
         }
 
-        Value& GetResult() { return myResult; }
+        // A cached result is copied on the first call
+        Value& GetResult() {
+            if (myCachedResult) {
+                myResult = Value(myCachedResult->GetValue());
+                myCachedResult.reset();
+            }
+            return myResult;
+        }
+
+        const std::shared_ptr<const CachedValue>& GetCachedResult() const { return myCachedResult; }
         bool IsFault() const { return myIsFault; }
+        int32_t GetFaultCode() const { return myFaultCode; }
+        const std::string& GetFaultString() const { return myFaultString; }
 
         void ThrowIfFault() const {
             if (!IsFault()) {
@@ -100,6 +125,7 @@ namespace jsonrpc {
         int32_t myFaultCode;
         std::string myFaultString;
         Value myId;
+        std::shared_ptr<const CachedValue> myCachedResult;
     };
 
 } // namespace jsonrpc
@@ -0,0 +1,321 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_RESPONSECACHE_H
+#define JSONRPC_LEAN_RESPONSECACHE_H
+
+#include "cachedvalue.h"
+#include "request.h"
+#include "value.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace jsonrpc {
+
+    // The results of one method by parameters, see MethodWrapper::SetCache. The cache holds at
+    // most capacity results. When it is full, the least recently used one is dropped. A result
+    // expires timeToLive after it was added; zero means never. The entries are spread over a
+    // number of shards by the hash of their parameters, each with its own lock, so that lookups
+    // on different threads rarely wait for each other.
+    //
+    // Parameters are the same when they have the same types and values, except that 32 and 64 bit
+    // integers of the same value are the same.
+    class ResponseCache {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        ResponseCache(size_t capacity, Clock::duration timeToLive)
+            : myShardCount(GetShardCount(capacity)),
+            myShardCapacity(std::max<size_t>(1, (capacity + myShardCount - 1) / myShardCount)),
+            myTimeToLive(timeToLive),
+            myShards(new Shard[myShardCount]) {
+        }
+
+        ResponseCache(const ResponseCache&) = delete;
+        ResponseCache& operator=(const ResponseCache&) = delete;
+
+        // The result for parameters, or nullptr; hash is Hash(parameters)
+        std::shared_ptr<const CachedValue> Find(uint64_t hash, const Request::Parameters& parameters) {
+            Shard& shard = GetShard(hash);
+            std::lock_guard<std::mutex> lock(shard.myMutex);
+            auto position = shard.myIndex.find(hash);
+            if (position == shard.myIndex.end() || !Equal(position->second->myParameters, parameters)) {
+                ++shard.myMissCount;
+                return nullptr;
+            }
+
+            auto entry = position->second;
+            if (IsExpired(*entry)) {
+                shard.myIndex.erase(position);
+                shard.myEntries.erase(entry);
+                ++shard.myMissCount;
+                return nullptr;
+            }
+
+            shard.myEntries.splice(shard.myEntries.begin(), shard.myEntries, entry);
+            ++shard.myHitCount;
+            return entry->myResult;
+        }
+
+        // Adds the result for parameters, replacing any result with the same hash
+        std::shared_ptr<const CachedValue> Insert(uint64_t hash, Request::Parameters parameters, Value result) {
+            auto cached = std::make_shared<const CachedValue>(std::move(result));
+            const auto expiry = myTimeToLive == Clock::duration::zero()
+                ? Clock::time_point::max() : Clock::now() + myTimeToLive;
+
+            Shard& shard = GetShard(hash);
+            std::lock_guard<std::mutex> lock(shard.myMutex);
+            auto position = shard.myIndex.find(hash);
+            if (position != shard.myIndex.end()) {
+                shard.myEntries.erase(position->second);
+                shard.myIndex.erase(position);
+            } else if (shard.myEntries.size() == myShardCapacity) {
+                shard.myIndex.erase(shard.myEntries.back().myHash);
+                shard.myEntries.pop_back();
+            }
+
+            shard.myEntries.push_front(Entry{ hash, std::move(parameters), cached, expiry });
+            shard.myIndex.emplace(hash, shard.myEntries.begin());
+            return cached;
+        }
+
+        void Clear() {
+            for (size_t i = 0; i < myShardCount; ++i) {
+                std::lock_guard<std::mutex> lock(myShards[i].myMutex);
+                myShards[i].myIndex.clear();
+                myShards[i].myEntries.clear();
+            }
+        }
+
+        // Number of results, including any that have expired but were not looked up since
+        size_t GetSize() const {
+            return Sum([](const Shard& shard) { return static_cast<uint64_t>(shard.myEntries.size()); });
+        }
+
+        uint64_t GetHitCount() const {
+            return Sum([](const Shard& shard) { return shard.myHitCount; });
+        }
+
+        uint64_t GetMissCount() const {
+            return Sum([](const Shard& shard) { return shard.myMissCount; });
+        }
+
+        static uint64_t Hash(const Request::Parameters& parameters) {
+            uint64_t hash = HASH_SEED;
+            hash = Mix(hash, parameters.size());
+            for (auto& parameter : parameters) {
+                hash = Hash(hash, parameter);
+            }
+            return hash;
+        }
+
+        static bool Equal(const Request::Parameters& a, const Request::Parameters& b) {
+            if (a.size() != b.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); ++i) {
+                if (!Equal(a[i], b[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static bool Equal(const Value& a, const Value& b) {
+            if ((a.IsInteger32() || a.IsInteger64()) && (b.IsInteger32() || b.IsInteger64())) {
+                return a.AsInteger64() == b.AsInteger64();
+            }
+            if (a.GetType() != b.GetType()) {
+                return false;
+            }
+
+            switch (a.GetType()) {
+            case Value::Type::ARRAY: {
+                auto& x = a.AsArray();
+                auto& y = b.AsArray();
+                return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(),
+                    [](const Value& i, const Value& j) { return Equal(i, j); });
+            }
+            case Value::Type::BINARY:
+            case Value::Type::STRING:
+                return a.AsStringView() == b.AsStringView();
+            case Value::Type::BOOLEAN:
+                return a.AsBoolean() == b.AsBoolean();
+            case Value::Type::DATE_TIME: {
+                auto& x = a.AsDateTime();
+                auto& y = b.AsDateTime();
+                return x.tm_year == y.tm_year && x.tm_mon == y.tm_mon && x.tm_mday == y.tm_mday
+                    && x.tm_hour == y.tm_hour && x.tm_min == y.tm_min && x.tm_sec == y.tm_sec;
+            }
+            case Value::Type::DOUBLE:
+                return a.AsDouble() == b.AsDouble();
+            case Value::Type::INTEGER_32:
+            case Value::Type::INTEGER_64:
+            case Value::Type::NIL:
+                break;
+            case Value::Type::STRUCT: {
+                auto& x = a.AsStruct();
+                auto& y = b.AsStruct();
+                return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(),
+                    [](const Value::Struct::value_type& i, const Value::Struct::value_type& j) {
+                        return i.first == j.first && Equal(i.second, j.second);
+                    });
+            }
+            }
+            return true;
+        }
+
+    private:
+        static const uint64_t HASH_SEED = 14695981039346656037ULL;
+        static const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+        struct Entry {
+            uint64_t myHash;
+            Request::Parameters myParameters;
+            std::shared_ptr<const CachedValue> myResult;
+            Clock::time_point myExpiry;
+        };
+
+        // Padded like the shards of MethodMetrics, so that the locks of two shards never share a
+        // cache line
+        struct Shard {
+            char myPadding[64];
+            std::mutex myMutex;
+            std::list<Entry> myEntries; // most recently used first
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> myIndex;
+            uint64_t myHitCount = 0;
+            uint64_t myMissCount = 0;
+        };
+
+        template<typename Count>
+        uint64_t Sum(Count count) const {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < myShardCount; ++i) {
+                std::lock_guard<std::mutex> lock(myShards[i].myMutex);
+                sum += count(myShards[i]);
+            }
+            return sum;
+        }
+
+        bool IsExpired(const Entry& entry) const {
+            return myTimeToLive != Clock::duration::zero() && Clock::now() >= entry.myExpiry;
+        }
+
+        Shard& GetShard(uint64_t hash) {
+            // the low bits pick the bucket within the shard
+            return myShards[(hash >> 48) & (myShardCount - 1)];
+        }
+
+        // A power of two, at least the number of hardware threads, at most 16 and at most capacity
+        static size_t GetShardCount(size_t capacity) {
+            const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t count = 1;
+            while (count < threads && count < 16 && count * 2 <= capacity) {
+                count *= 2;
+            }
+            return count;
+        }
+
+        static uint64_t Mix(uint64_t hash, uint64_t value) {
+            hash = (hash ^ value) * HASH_MULTIPLIER;
+            return hash ^ (hash >> 29);
+        }
+
+        // Eight bytes at a time
+        static uint64_t HashBytes(uint64_t hash, string_view bytes) {
+            hash = Mix(hash, bytes.size());
+            size_t i = 0;
+            for (; i + 8 <= bytes.size(); i += 8) {
+                uint64_t word;
+                memcpy(&word, bytes.data() + i, 8);
+                hash = Mix(hash, word);
+            }
+            if (i < bytes.size()) {
+                uint64_t word = 0;
+                memcpy(&word, bytes.data() + i, bytes.size() - i);
+                hash = Mix(hash, word);
+            }
+            return hash;
+        }
+
+        // Consistent with Equal: the type is hashed along with the value, except that both kinds of
+        // integers hash as 64 bits
+        static uint64_t Hash(uint64_t hash, const Value& value) {
+            const auto type = value.GetType() == Value::Type::INTEGER_32 ? Value::Type::INTEGER_64 : value.GetType();
+            hash = Mix(hash, static_cast<uint64_t>(type));
+
+            switch (value.GetType()) {
+            case Value::Type::ARRAY:
+                hash = Mix(hash, value.AsArray().size());
+                for (auto& element : value.AsArray()) {
+                    hash = Hash(hash, element);
+                }
+                break;
+            case Value::Type::BINARY:
+            case Value::Type::STRING:
+                hash = HashBytes(hash, value.AsStringView());
+                break;
+            case Value::Type::BOOLEAN:
+                hash = Mix(hash, value.AsBoolean() ? 1 : 0);
+                break;
+            case Value::Type::DATE_TIME: {
+                auto& dateTime = value.AsDateTime();
+                hash = Mix(hash, static_cast<uint64_t>(((dateTime.tm_year * 16 + dateTime.tm_mon) * 32 + dateTime.tm_mday)));
+                hash = Mix(hash, static_cast<uint64_t>(dateTime.tm_hour * 3600 + dateTime.tm_min * 60 + dateTime.tm_sec));
+                break;
+            }
+            case Value::Type::DOUBLE: {
+                // 0.0 and -0.0 are equal
+                const double number = value.AsDouble() == 0 ? 0.0 : value.AsDouble();
+                uint64_t bits;
+                memcpy(&bits, &number, sizeof(bits));
+                hash = Mix(hash, bits);
+                break;
+            }
+            case Value::Type::INTEGER_32:
+            case Value::Type::INTEGER_64:
+                hash = Mix(hash, static_cast<uint64_t>(value.AsInteger64()));
+                break;
+            case Value::Type::NIL:
+                break;
+            case Value::Type::STRUCT:
+                hash = Mix(hash, value.AsStruct().size());
+                for (auto& element : value.AsStruct()) {
+                    hash = HashBytes(hash, element.first);
+                    hash = Hash(hash, element.second);
+                }
+                break;
+            }
+            return hash;
+        }
+
+        const size_t myShardCount;
+        const size_t myShardCapacity;
+        const Clock::duration myTimeToLive;
+        std::unique_ptr<Shard[]> myShards;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_RESPONSECACHE_H
@@ -20,6 +20,7 @@
 #ifndef JSONRPC_LEAN_SERVER_H
 #define JSONRPC_LEAN_SERVER_H
 
+#include "arena.h"
 #include "request.h"
 #include "value.h"
 #include "fault.h"
@@ -31,14 +32,29 @@
 #include "formatteddata.h"
 #include "jsonformatteddata.h"
 #include "dispatcher.h"
+#include "outputbuffer.h"
+#include "trace.h"
 
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace jsonrpc {
 
+    // HandleRequest and its variants may be called from any number of threads at once, without a
+    // global lock; methods can be added to and removed from the Dispatcher meanwhile. Format
+    // handlers and the options below must be set up before requests are handled.
     class Server {
     public:
+        // Runs a task, possibly on another thread; used to dispatch batch entries in parallel
+        typedef std::function<void(std::function<void()>)> Executor;
+
         Server() {}
         ~Server() {}
 
@@ -53,45 +69,484 @@ namespace jsonrpc {
 
         Dispatcher& GetDispatcher() { return myDispatcher; }
 
+        // Opt-in: the entries of a batch request are handed to executor and run concurrently,
+        // so every method reachable through a batch must be safe to call from several threads.
+        // Without an executor (the default) batch entries are invoked one after another.
+        void SetBatchExecutor(Executor executor) {
+            myBatchExecutor = std::move(executor);
+        }
+
+        // Opt-in: the parameters of each request are allocated from an arena that lives as long as
+        // that HandleRequest call and is released with one free per block of blockSize bytes.
+        // Methods must not keep references to their parameters (copying a Value is fine).
+        // 0 (the default) allocates parameters from the heap.
+        void SetRequestArenaBlockSize(size_t blockSize) {
+            myArenaBlockSize = blockSize;
+        }
+
+        // Opt-in: the phases of every request (see TracePhase) are timed and reported to sink, which
+        // must outlive the requests. Without a sink (the default) nothing is timed.
+        void SetTraceSink(TraceSink* sink) {
+            myTraceSink = sink;
+        }
+
         // aContentType is here to allow future implementation of other rpc formats with minimal code changes
         // Will return NULL if no FormatHandler is found, otherwise will return a FormatedData
         // If aRequestData is a Notification (the client doesn't expect a response), the returned FormattedData will have an empty ->GetData() buffer and ->GetSize() will be 0
+        // If aRequestData is a batch, the responses are written as one batch; a batch made of notifications only produces an empty buffer as well
         std::shared_ptr<jsonrpc::FormattedData> HandleRequest(const std::string& aRequestData, const std::string& aContentType = "application/json") {
+            return HandleRequestInternal(aContentType, aRequestData.size(), [&aRequestData](FormatHandler& fmtHandler) {
+                return fmtHandler.CreateReader(aRequestData);
+            });
+        }
 
-            // first find the correct handler
+        // Same as HandleRequest, but aRequestData (null-terminated) is parsed in place and is modified.
+        // String parameters refer to aRequestData instead of being copied, if the FormatHandler supports it.
+        std::shared_ptr<jsonrpc::FormattedData> HandleRequestInsitu(char* aRequestData, const std::string& aContentType = "application/json") {
+            const size_t size = myTraceSink != nullptr ? strlen(aRequestData) : 0;
+            return HandleRequestInternal(aContentType, size, [aRequestData](FormatHandler& fmtHandler) {
+                return fmtHandler.CreateInsituReader(aRequestData);
+            });
+        }
+
+        // Same as HandleRequest, but the response is appended to aResponse, which can be reused
+        // (cleared) between requests so that it does not have to grow again. Nothing is appended for
+        // notifications. Returns false if no FormatHandler is found.
+        bool HandleRequestInto(const std::string& aRequestData, std::string& aResponse, const std::string& aContentType = "application/json") {
+            util::StringOutput output(aResponse);
+            return WriteResponseTo(output, aContentType, aRequestData.size(), [&aRequestData](FormatHandler& fmtHandler) {
+                return fmtHandler.CreateReader(aRequestData);
+            });
+        }
+
+        // Same as above, writing to the segments of aResponse (see util::OutputBuffer)
+        bool HandleRequestInto(const std::string& aRequestData, util::OutputBuffer& aResponse, const std::string& aContentType = "application/json") {
+            return WriteResponseTo(aResponse, aContentType, aRequestData.size(), [&aRequestData](FormatHandler& fmtHandler) {
+                return fmtHandler.CreateReader(aRequestData);
+            });
+        }
+
+        // Same as HandleRequestInto, but the aSize bytes of aRequestData, which must be followed by
+        // a NUL, are parsed in place as by HandleRequestInsitu
+        bool HandleRequestInsituInto(char* aRequestData, size_t aSize, std::string& aResponse, const std::string& aContentType = "application/json") {
+            util::StringOutput output(aResponse);
+            return WriteResponseTo(output, aContentType, aSize, [aRequestData, aSize](FormatHandler& fmtHandler) {
+                return fmtHandler.CreateInsituReader(aRequestData, aSize);
+            });
+        }
+
+        // Receives the response of HandleRequestAsync
+        typedef std::function<void(std::shared_ptr<FormattedData>)> ResponseHandler;
+
+        // Same as HandleRequest, but methods added with Dispatcher::AddAsyncMethod do not block the
+        // calling thread: aHandler gets the response (nullptr if no FormatHandler is found) once every
+        // method involved has completed. That may be before this returns, or later on another thread.
+        void HandleRequestAsync(const std::string& aRequestData, ResponseHandler aHandler, const std::string& aContentType = "application/json") {
+            FormatHandler *fmtHandler = FindFormatHandler(aContentType);
+            if (fmtHandler == nullptr) {
+                aHandler(nullptr);
+                return;
+            }
+
+            // the parameters only have to live until the methods have been started
+            util::Arena arena(myArenaBlockSize);
+            std::unique_ptr<Request> request;
+            Batch batch;
+            bool isBatch = false;
+            Tracer tracer(myTraceSink, aRequestData.size());
+
+            try {
+                auto reader = fmtHandler->CreateReader(aRequestData);
+                if (myArenaBlockSize != 0) {
+                    reader->SetArena(&arena);
+                }
+                isBatch = reader->IsBatch();
+                if (isBatch) {
+                    ReadBatch(std::move(reader), batch);
+                } else {
+                    request.reset(new Request(reader->GetRequest()));
+                    tracer.SetRequest(*request);
+                }
+                tracer.ReportParse();
+            } catch (const Fault& ex) {
+                tracer.ReportParse();
+                aHandler(Format(*fmtHandler, Response(ex.GetCode(), ex.GetString(), Value()), tracer));
+                return;
+            }
+
+            if (isBatch) {
+                HandleBatchAsync(*fmtHandler, batch, std::move(aHandler), std::move(tracer));
+                return;
+            }
+
+            if (!tracer.IsEnabled()) {
+                myDispatcher.InvokeAsync(*request,
+                    [fmtHandler, aHandler](Response response) {
+                        Tracer none(nullptr, 0);
+                        aHandler(Format(*fmtHandler, response, none));
+                    });
+                return;
+            }
+
+            auto state = std::make_shared<Tracer>(std::move(tracer));
+            myDispatcher.InvokeAsync(*request,
+                [fmtHandler, aHandler, state](Response response) {
+                    state->Report(TracePhase::DISPATCH);
+                    aHandler(Format(*fmtHandler, response, *state));
+                });
+        }
+
+    private:
+        FormatHandler* FindFormatHandler(const std::string& aContentType) const {
             FormatHandler *fmtHandler = nullptr;
             for (auto handler : myFormatHandlers) {
                 if (handler->CanHandleRequest(aContentType)) {
                     fmtHandler = handler;
                 }
             }
+            return fmtHandler;
+        }
+
+        typedef TraceEvent::Clock Clock;
+
+        // Reports the phases of one request to the trace sink, if there is one. Each phase starts
+        // where the previous one ended.
+        class Tracer {
+        public:
+            Tracer(TraceSink* sink, size_t requestSize) : mySink(sink), myRequestSize(requestSize) {
+                if (mySink != nullptr) {
+                    myRequestStart = myStart = Clock::now();
+                }
+            }
+
+            bool IsEnabled() const { return mySink != nullptr; }
+
+            void SetRequest(const Request& request) {
+                if (mySink != nullptr) {
+                    myMethodName = request.GetMethodName();
+                    myId = Value(request.GetId());
+                    myHasId = true;
+                }
+            }
+
+            void Report(TracePhase phase, size_t bytes = 0) {
+                if (mySink != nullptr) {
+                    const auto end = Clock::now();
+                    Report(mySink, phase, myStart, end, bytes, myMethodName, myHasId ? &myId : nullptr);
+                    myStart = end;
+                }
+            }
+
+            void ReportParse() {
+                Report(TracePhase::PARSE, myRequestSize);
+            }
+
+            // The whole request, when its response has been written
+            void ReportRequest() {
+                if (mySink != nullptr) {
+                    Report(mySink, TracePhase::REQUEST, myRequestStart, Clock::now(), myRequestSize, myMethodName, myHasId ? &myId : nullptr);
+                }
+            }
+
+            // The next phase starts now
+            void Restart() {
+                if (mySink != nullptr) {
+                    myStart = Clock::now();
+                }
+            }
+
+            // Size of what writer has written so far; 0 when not tracing
+            size_t GetOutputSize(Writer& writer) const {
+                return mySink != nullptr ? writer.GetSize() : 0;
+            }
+
+            TraceSink* GetSink() const { return mySink; }
+
+            static void Report(TraceSink* sink, TracePhase phase, Clock::time_point start, Clock::time_point end,
+                size_t bytes, string_view methodName, const Value* id) {
+                sink->OnEvent(TraceEvent{ phase, start, end - start, bytes, methodName, id });
+            }
+
+        private:
+            TraceSink* mySink;
+            size_t myRequestSize;
+            Clock::time_point myRequestStart;
+            Clock::time_point myStart;
+            std::string myMethodName;
+            Value myId;
+            bool myHasId = false;
+        };
+
+        template<typename CreateReader>
+        std::shared_ptr<jsonrpc::FormattedData> HandleRequestInternal(const std::string& aContentType, size_t aSize, CreateReader createReader) {
 
+            // first find the correct handler
+            FormatHandler *fmtHandler = FindFormatHandler(aContentType);
             if (fmtHandler == nullptr) {
                 // no FormatHandler able to handle this request type was found
                 return nullptr;
             }
-            
+
             auto writer = fmtHandler->CreateWriter();
+            WriteResponse(*fmtHandler, *writer, createReader, aSize);
+            return writer->GetData();
+        }
+
+        template<typename Output, typename CreateReader>
+        bool WriteResponseTo(Output& aResponse, const std::string& aContentType, size_t aSize, CreateReader createReader) {
+            FormatHandler *fmtHandler = FindFormatHandler(aContentType);
+            if (fmtHandler == nullptr) {
+                return false;
+            }
+
+            auto writer = fmtHandler->CreateWriter(aResponse);
+            if (writer) {
+                WriteResponse(*fmtHandler, *writer, createReader, aSize);
+            } else {
+                // the format can only write to its own buffer
+                writer = fmtHandler->CreateWriter();
+                WriteResponse(*fmtHandler, *writer, createReader, aSize);
+                auto data = writer->GetData();
+                aResponse.Append(data->GetData(), data->GetSize());
+            }
+            return true;
+        }
+
+        template<typename CreateReader>
+        void WriteResponse(FormatHandler& fmtHandler, Writer& writer, CreateReader& createReader, size_t requestSize) {
+            // declared before anything that may hold values allocated from it
+            util::Arena arena(myArenaBlockSize);
+            Tracer tracer(myTraceSink, requestSize);
 
             try {
-                auto reader = fmtHandler->CreateReader(aRequestData);
+                auto reader = createReader(fmtHandler);
+                if (myArenaBlockSize != 0) {
+                    reader->SetArena(&arena);
+                }
+                if (reader->IsBatch()) {
+                    HandleBatch(std::move(reader), writer, tracer);
+                    return;
+                }
+
                 Request request = reader->GetRequest();
                 reader.reset();
+                tracer.SetRequest(request);
+                tracer.ReportParse();
 
-                auto response = myDispatcher.Invoke(request.GetMethodName(), request.GetParameters(), request.GetId());
-                if (!response.GetId().IsBoolean() || response.GetId().AsBoolean() != false) {
-                    // if Id is false, this is a notification and we don't have to write a response
-                    response.Write(*writer);
-                }
+                auto response = myDispatcher.Invoke(request);
+                tracer.Report(TracePhase::DISPATCH);
+                WriteResponse(response, writer, tracer);
             } catch (const Fault& ex) {
-                Response(ex.GetCode(), ex.GetString(), Value()).Write(*writer);
+                tracer.ReportParse();
+                WriteResponse(Response(ex.GetCode(), ex.GetString(), Value()), writer, tracer);
             }
+        }
+
+        // Writes response unless it answers a notification, which ends the request
+        static void WriteResponse(const Response& response, Writer& writer, Tracer& tracer) {
+            if (!IsNotification(response)) {
+                const size_t start = tracer.GetOutputSize(writer);
+                response.Write(writer);
+                tracer.Report(TracePhase::WRITE, tracer.GetOutputSize(writer) - start);
+            }
+            tracer.ReportRequest();
+        }
 
+        static bool IsNotification(const Response& response) {
+            // if Id is false, this is a notification and we don't have to write a response
+            return response.GetId().IsBoolean() && response.GetId().AsBoolean() == false;
+        }
+
+        static std::shared_ptr<FormattedData> Format(FormatHandler& fmtHandler, const Response& response, Tracer& tracer) {
+            auto writer = fmtHandler.CreateWriter();
+            WriteResponse(response, *writer, tracer);
             return writer->GetData();
         }
-    private:
+
+        // one response slot per entry, in batch order; entries that are not valid requests
+        // get their fault right away, the others are filled in by the dispatcher
+        struct Batch {
+            std::vector<Response> responses;
+            std::vector<Request> requests;
+            std::vector<size_t> slots;
+        };
+
+        static void ReadBatch(std::unique_ptr<Reader> reader, Batch& batch) {
+            const size_t size = reader->GetBatchSize();
+            if (size == 0) {
+                throw InvalidRequestFault();
+            }
+
+            batch.responses.reserve(size);
+            batch.requests.reserve(size);
+            batch.slots.reserve(size);
+
+            for (size_t i = 0; i < size; ++i) {
+                try {
+                    batch.requests.emplace_back(reader->GetRequest(i));
+                    batch.slots.push_back(i);
+                    batch.responses.emplace_back(Value(), Value(false));
+                } catch (const Fault& ex) {
+                    batch.responses.emplace_back(ex.GetCode(), ex.GetString(), Value());
+                }
+            }
+        }
+
+        static void WriteBatch(const std::vector<Response>& responses, Writer& writer) {
+            bool started = false;
+            for (auto& response : responses) {
+                if (IsNotification(response)) {
+                    continue;
+                }
+                if (!started) {
+                    writer.StartBatch();
+                    started = true;
+                }
+                response.Write(writer);
+            }
+            if (started) {
+                writer.EndBatch();
+            }
+        }
+
+        void HandleBatch(std::unique_ptr<Reader> reader, Writer& writer, Tracer& tracer) {
+            Batch batch;
+            ReadBatch(std::move(reader), batch);
+            tracer.ReportParse();
+            auto& responses = batch.responses;
+            auto& requests = batch.requests;
+            auto& slots = batch.slots;
+
+            TraceSink* const sink = tracer.GetSink();
+            auto invoke = [&](size_t i) {
+                if (sink == nullptr) {
+                    responses[slots[i]] = myDispatcher.Invoke(requests[i]);
+                    return;
+                }
+                const auto start = Clock::now();
+                responses[slots[i]] = myDispatcher.Invoke(requests[i]);
+                Tracer::Report(sink, TracePhase::DISPATCH, start, Clock::now(), 0, requests[i].GetMethodName(), &requests[i].GetId());
+            };
+
+            if (myBatchExecutor && requests.size() > 1) {
+                std::mutex mutex;
+                std::condition_variable finished;
+                size_t pending = requests.size();
+
+                auto complete = [&]() {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--pending == 0) {
+                        finished.notify_one();
+                    }
+                };
+
+                // Whichever runs an entry first claims it: the executor may throw after it has
+                // queued or even run the task. A task that lost the claim touches nothing but the
+                // flags, which it shares, as it may run after this call has returned.
+                auto claimed = std::make_shared<std::vector<std::atomic<bool>>>(requests.size());
+                for (size_t i = 0; i < requests.size(); ++i) {
+                    try {
+                        myBatchExecutor([claimed, &invoke, &complete, i]() {
+                            if (!(*claimed)[i].exchange(true)) {
+                                invoke(i);
+                                complete();
+                            }
+                        });
+                    } catch (...) {
+                        // the executor refused the task, run it here instead unless it started
+                        if (!(*claimed)[i].exchange(true)) {
+                            invoke(i);
+                            complete();
+                        }
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&pending]() { return pending == 0; });
+            } else {
+                for (size_t i = 0; i < requests.size(); ++i) {
+                    invoke(i);
+                }
+            }
+
+            tracer.Restart();
+            const size_t start = tracer.GetOutputSize(writer);
+            WriteBatch(responses, writer);
+            tracer.Report(TracePhase::WRITE, tracer.GetOutputSize(writer) - start);
+            tracer.ReportRequest();
+        }
+
+        // The entries complete in any order and on any thread; the last one writes the batch
+        void HandleBatchAsync(FormatHandler& fmtHandler, Batch& batch, ResponseHandler aHandler, Tracer tracer) {
+            struct State {
+                explicit State(Tracer tracer) : myTracer(std::move(tracer)) {}
+
+                std::mutex myMutex;
+                std::vector<Response> myResponses;
+                size_t myPending;
+                FormatHandler* myFormatHandler;
+                ResponseHandler myHandler;
+                Tracer myTracer;
+
+                void Complete(size_t slot, Response response) {
+                    {
+                        std::lock_guard<std::mutex> lock(myMutex);
+                        myResponses[slot] = std::move(response);
+                    }
+                    Complete();
+                }
+
+                void Complete() {
+                    {
+                        std::lock_guard<std::mutex> lock(myMutex);
+                        if (--myPending != 0) {
+                            return;
+                        }
+                    }
+                    auto writer = myFormatHandler->CreateWriter();
+                    myTracer.Restart();
+                    WriteBatch(myResponses, *writer);
+                    myTracer.Report(TracePhase::WRITE, myTracer.GetOutputSize(*writer));
+                    myTracer.ReportRequest();
+                    myHandler(writer->GetData());
+                }
+            };
+
+            auto state = std::make_shared<State>(std::move(tracer));
+            state->myResponses = std::move(batch.responses);
+            state->myPending = batch.requests.size() + 1; // held until every entry has been started
+            state->myFormatHandler = &fmtHandler;
+            state->myHandler = std::move(aHandler);
+
+            TraceSink* const sink = state->myTracer.GetSink();
+            for (size_t i = 0; i < batch.requests.size(); ++i) {
+                auto& request = batch.requests[i];
+                const size_t slot = batch.slots[i];
+                if (sink == nullptr) {
+                    myDispatcher.InvokeAsync(request,
+                        [state, slot](Response response) {
+                            state->Complete(slot, std::move(response));
+                        });
+                    continue;
+                }
+
+                // the request may be gone when the method completes
+                auto entry = std::make_shared<std::pair<std::string, Value>>(request.GetMethodName(), Value(request.GetId()));
+                const auto start = Clock::now();
+                myDispatcher.InvokeAsync(request,
+                    [state, slot, sink, entry, start](Response response) {
+                        Tracer::Report(sink, TracePhase::DISPATCH, start, Clock::now(), 0, entry->first, &entry->second);
+                        state->Complete(slot, std::move(response));
+                    });
+            }
+            state->Complete();
+        }
+
         Dispatcher myDispatcher;
         std::vector<FormatHandler*> myFormatHandlers;
+        Executor myBatchExecutor;
+        size_t myArenaBlockSize = 0;
+        TraceSink* myTraceSink = nullptr;
     };
 
 } // namespace jsonrpc
@@ -0,0 +1,398 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_SMALLVECTOR_H
+#define JSONRPC_LEAN_SMALLVECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace jsonrpc {
+    namespace util {
+
+        // Contiguous sequence that keeps up to N elements in place and only goes to the heap when it
+        // grows past that. Besides the vector interface it has the deque members the library used
+        // to offer (push_front, emplace_front, pop_front), but as with std::vector, growing or
+        // inserting invalidates references to the elements. Unlike std::vector it only needs T to
+        // be move assignable and (explicitly) copy or move constructible.
+        template<typename T, size_t N>
+        class SmallVector {
+        public:
+            typedef T value_type;
+            typedef size_t size_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef T& reference;
+            typedef const T& const_reference;
+            typedef T* pointer;
+            typedef const T* const_pointer;
+            typedef T* iterator;
+            typedef const T* const_iterator;
+            typedef std::reverse_iterator<iterator> reverse_iterator;
+            typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+            SmallVector() noexcept : myData(GetInlineData()) {}
+
+            SmallVector(std::initializer_list<T> values) : SmallVector() {
+                assign(values.begin(), values.end());
+            }
+
+            explicit SmallVector(size_type count) : SmallVector() {
+                resize(count);
+            }
+
+            SmallVector(size_type count, const T& value) : SmallVector() {
+                assign(count, value);
+            }
+
+            template<typename InputIterator, typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+            SmallVector(InputIterator first, InputIterator last) : SmallVector() {
+                assign(first, last);
+            }
+
+            SmallVector(const SmallVector& other) : SmallVector() {
+                assign(other.begin(), other.end());
+            }
+
+            SmallVector(SmallVector&& other) noexcept : SmallVector() {
+                MoveFrom(other);
+            }
+
+            ~SmallVector() {
+                clear();
+                FreeHeapData();
+            }
+
+            SmallVector& operator=(const SmallVector& other) {
+                if (this != &other) {
+                    assign(other.begin(), other.end());
+                }
+                return *this;
+            }
+
+            SmallVector& operator=(SmallVector&& other) noexcept {
+                if (this != &other) {
+                    clear();
+                    FreeHeapData();
+                    MoveFrom(other);
+                }
+                return *this;
+            }
+
+            SmallVector& operator=(std::initializer_list<T> values) {
+                assign(values.begin(), values.end());
+                return *this;
+            }
+
+            void assign(size_type count, const T& value) {
+                clear();
+                reserve(count);
+                for (size_type i = 0; i < count; ++i) {
+                    emplace_back(value);
+                }
+            }
+
+            template<typename InputIterator, typename = typename std::enable_if<!std::is_integral<InputIterator>::value>::type>
+            void assign(InputIterator first, InputIterator last) {
+                clear();
+                Reserve(first, last, typename std::iterator_traits<InputIterator>::iterator_category());
+                for (; first != last; ++first) {
+                    emplace_back(*first);
+                }
+            }
+
+            void assign(std::initializer_list<T> values) {
+                assign(values.begin(), values.end());
+            }
+
+            // Element access
+
+            reference operator[](size_type index) { return myData[index]; }
+            const_reference operator[](size_type index) const { return myData[index]; }
+
+            reference at(size_type index) {
+                CheckIndex(index);
+                return myData[index];
+            }
+
+            const_reference at(size_type index) const {
+                CheckIndex(index);
+                return myData[index];
+            }
+
+            reference front() { return myData[0]; }
+            const_reference front() const { return myData[0]; }
+            reference back() { return myData[mySize - 1]; }
+            const_reference back() const { return myData[mySize - 1]; }
+
+            pointer data() noexcept { return myData; }
+            const_pointer data() const noexcept { return myData; }
+
+            // Iterators
+
+            iterator begin() noexcept { return myData; }
+            const_iterator begin() const noexcept { return myData; }
+            const_iterator cbegin() const noexcept { return myData; }
+            iterator end() noexcept { return myData + mySize; }
+            const_iterator end() const noexcept { return myData + mySize; }
+            const_iterator cend() const noexcept { return myData + mySize; }
+
+            reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+            const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+            const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+            reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+            const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+            const_reverse_iterator crend() const noexcept { return rend(); }
+
+            // Capacity
+
+            bool empty() const noexcept { return mySize == 0; }
+            size_type size() const noexcept { return mySize; }
+            size_type capacity() const noexcept { return myCapacity; }
+            size_type max_size() const noexcept { return size_type(-1) / sizeof(T); }
+
+            void reserve(size_type capacity) {
+                if (capacity > myCapacity) {
+                    Reallocate(capacity);
+                }
+            }
+
+            void shrink_to_fit() {}
+
+            // Modifiers
+
+            void clear() noexcept {
+                Destroy(myData, myData + mySize);
+                mySize = 0;
+            }
+
+            void push_back(const T& value) { emplace_back(value); }
+            void push_back(T&& value) { emplace_back(std::move(value)); }
+
+            template<typename... Args>
+            reference emplace_back(Args&&... args) {
+                if (mySize == myCapacity) {
+                    // the new element is built first, args may refer to an element of this vector
+                    return GrowAndEmplaceBack(std::forward<Args>(args)...);
+                }
+                new (myData + mySize) T(std::forward<Args>(args)...);
+                return myData[mySize++];
+            }
+
+            void pop_back() {
+                myData[--mySize].~T();
+            }
+
+            void push_front(const T& value) { emplace(begin(), value); }
+            void push_front(T&& value) { emplace(begin(), std::move(value)); }
+
+            template<typename... Args>
+            reference emplace_front(Args&&... args) {
+                return *emplace(begin(), std::forward<Args>(args)...);
+            }
+
+            void pop_front() {
+                erase(begin());
+            }
+
+            iterator insert(const_iterator position, const T& value) { return emplace(position, value); }
+            iterator insert(const_iterator position, T&& value) { return emplace(position, std::move(value)); }
+
+            template<typename... Args>
+            iterator emplace(const_iterator position, Args&&... args) {
+                const size_type index = position - begin();
+                if (index == mySize) {
+                    emplace_back(std::forward<Args>(args)...);
+                    return myData + index;
+                }
+
+                T value(std::forward<Args>(args)...);
+                emplace_back(std::move(back()));
+                std::move_backward(myData + index, myData + mySize - 2, myData + mySize - 1);
+                myData[index] = std::move(value);
+                return myData + index;
+            }
+
+            iterator erase(const_iterator position) {
+                return erase(position, position + 1);
+            }
+
+            iterator erase(const_iterator first, const_iterator last) {
+                iterator from = myData + (first - begin());
+                iterator to = myData + (last - begin());
+                if (from != to) {
+                    iterator newEnd = std::move(to, end(), from);
+                    Destroy(newEnd, end());
+                    mySize = newEnd - myData;
+                }
+                return from;
+            }
+
+            void resize(size_type count) {
+                if (count < mySize) {
+                    erase(begin() + count, end());
+                    return;
+                }
+                reserve(count);
+                while (mySize < count) {
+                    emplace_back();
+                }
+            }
+
+            void resize(size_type count, const T& value) {
+                if (count < mySize) {
+                    erase(begin() + count, end());
+                    return;
+                }
+                reserve(count);
+                while (mySize < count) {
+                    emplace_back(value);
+                }
+            }
+
+            void swap(SmallVector& other) noexcept {
+                SmallVector temp(std::move(other));
+                other = std::move(*this);
+                *this = std::move(temp);
+            }
+
+        private:
+            T* GetInlineData() noexcept {
+                return reinterpret_cast<T*>(&myInlineData);
+            }
+
+            bool IsInline() const noexcept {
+                return myData == reinterpret_cast<const T*>(&myInlineData);
+            }
+
+            static T* Allocate(size_type capacity) {
+                return static_cast<T*>(::operator new(capacity * sizeof(T)));
+            }
+
+            void FreeHeapData() noexcept {
+                if (!IsInline()) {
+                    ::operator delete(myData);
+                    myData = GetInlineData();
+                    myCapacity = N;
+                }
+            }
+
+            static void Destroy(T* first, T* last) noexcept {
+                for (; first != last; ++first) {
+                    first->~T();
+                }
+            }
+
+            // Moves the elements of other here, which must be empty and inline
+            void MoveFrom(SmallVector& other) noexcept {
+                if (!other.IsInline()) {
+                    myData = other.myData;
+                    mySize = other.mySize;
+                    myCapacity = other.myCapacity;
+                    other.myData = other.GetInlineData();
+                    other.mySize = 0;
+                    other.myCapacity = N;
+                    return;
+                }
+
+                for (size_type i = 0; i < other.mySize; ++i) {
+                    new (myData + i) T(std::move(other.myData[i]));
+                }
+                mySize = other.mySize;
+                other.clear();
+            }
+
+            size_type GetGrownCapacity(size_type minCapacity) const {
+                return std::max(minCapacity, 2 * myCapacity);
+            }
+
+            void MoveTo(T* data) noexcept {
+                for (size_type i = 0; i < mySize; ++i) {
+                    new (data + i) T(std::move(myData[i]));
+                }
+                Destroy(myData, myData + mySize);
+            }
+
+            void Reallocate(size_type capacity) {
+                T* data = Allocate(capacity);
+                MoveTo(data);
+                FreeHeapData();
+                myData = data;
+                myCapacity = capacity;
+            }
+
+            template<typename... Args>
+            reference GrowAndEmplaceBack(Args&&... args) {
+                const size_type capacity = GetGrownCapacity(mySize + 1);
+                T* data = Allocate(capacity);
+                try {
+                    new (data + mySize) T(std::forward<Args>(args)...);
+                }
+                catch (...) {
+                    ::operator delete(data);
+                    throw;
+                }
+                MoveTo(data);
+                FreeHeapData();
+                myData = data;
+                myCapacity = capacity;
+                return myData[mySize++];
+            }
+
+            template<typename Iterator>
+            void Reserve(Iterator first, Iterator last, std::forward_iterator_tag) {
+                reserve(static_cast<size_type>(std::distance(first, last)));
+            }
+
+            template<typename Iterator>
+            void Reserve(Iterator, Iterator, std::input_iterator_tag) {}
+
+            void CheckIndex(size_type index) const {
+                if (index >= mySize) {
+                    throw std::out_of_range("SmallVector index out of range");
+                }
+            }
+
+            T* myData;
+            size_type mySize = 0;
+            size_type myCapacity = N;
+            typename std::aligned_storage<N * sizeof(T), alignof(T)>::type myInlineData;
+        };
+
+        template<typename T, size_t N>
+        bool operator==(const SmallVector<T, N>& lhs, const SmallVector<T, N>& rhs) {
+            return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+        }
+
+        template<typename T, size_t N>
+        bool operator!=(const SmallVector<T, N>& lhs, const SmallVector<T, N>& rhs) {
+            return !(lhs == rhs);
+        }
+
+        template<typename T, size_t N>
+        void swap(SmallVector<T, N>& lhs, SmallVector<T, N>& rhs) noexcept {
+            lhs.swap(rhs);
+        }
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_SMALLVECTOR_H
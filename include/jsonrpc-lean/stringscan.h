@@ -0,0 +1,108 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_STRINGSCAN_H
+#define JSONRPC_LEAN_STRINGSCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSONRPC_LEAN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace jsonrpc {
+    namespace util {
+
+        // What a string contains, found in a single pass over it
+        struct StringInfo {
+            bool myHasNul = false; // read as BINARY
+            bool myIsAscii = true; // no byte above 0x7f
+        };
+
+        namespace detail {
+
+            // Scans 8 bytes at a time in a general purpose register
+            inline void ScanScalar(const char* data, size_t size, bool& hasNul, uint64_t& highBits) {
+                const uint64_t ones = 0x0101010101010101ULL;
+                const uint64_t highs = 0x8080808080808080ULL;
+                uint64_t zeroBytes = 0;
+
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    uint64_t word;
+                    memcpy(&word, data + i, sizeof(word));
+                    zeroBytes |= (word - ones) & ~word & highs;
+                    highBits |= word & highs;
+                }
+                for (; i < size; ++i) {
+                    const uint8_t byte = static_cast<uint8_t>(data[i]);
+                    zeroBytes |= byte == 0 ? 0x80 : 0;
+                    highBits |= byte & 0x80;
+                }
+                hasNul = hasNul || zeroBytes != 0;
+            }
+
+            // With copy set, data is also copied to copy along the way
+            inline StringInfo Scan(const char* data, size_t size, char* copy) {
+                bool hasNul = false;
+                uint64_t highBits = 0;
+                size_t i = 0;
+
+#ifdef JSONRPC_LEAN_SSE2
+                const __m128i zero = _mm_setzero_si128();
+                __m128i nulBytes = zero;
+                __m128i bytes = zero;
+                for (; i + 16 <= size; i += 16) {
+                    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                    if (copy != nullptr) {
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(copy + i), chunk);
+                    }
+                    nulBytes = _mm_or_si128(nulBytes, _mm_cmpeq_epi8(chunk, zero));
+                    bytes = _mm_or_si128(bytes, chunk);
+                }
+                hasNul = _mm_movemask_epi8(nulBytes) != 0;
+                highBits = static_cast<uint64_t>(_mm_movemask_epi8(bytes));
+#endif
+
+                if (copy != nullptr && i < size) {
+                    memcpy(copy + i, data + i, size - i);
+                }
+                ScanScalar(data + i, size - i, hasNul, highBits);
+
+                StringInfo info;
+                info.myHasNul = hasNul;
+                info.myIsAscii = highBits == 0;
+                return info;
+            }
+
+        } // namespace detail
+
+        inline StringInfo ClassifyString(const char* data, size_t size) {
+            return detail::Scan(data, size, nullptr);
+        }
+
+        // Copies size bytes from data to copy and classifies them in the same pass
+        inline StringInfo CopyAndClassifyString(char* copy, const char* data, size_t size) {
+            return detail::Scan(data, size, copy);
+        }
+
+    } // namespace util
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_STRINGSCAN_H
@@ -0,0 +1,163 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef JSONRPC_LEAN_TRACE_H
+#define JSONRPC_LEAN_TRACE_H
+
+#include "compat.h"
+#include "value.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace jsonrpc {
+
+    // Phases of handling a request, see Server::SetTraceSink
+    enum class TracePhase {
+        PARSE,    // reading the request (a whole batch at once)
+        DISPATCH, // running the method
+        WRITE,    // writing the response (a whole batch at once)
+        REQUEST   // all of the above
+    };
+
+    inline const char* GetTracePhaseName(TracePhase phase) {
+        switch (phase) {
+        case TracePhase::PARSE:
+            return "parse";
+        case TracePhase::DISPATCH:
+            return "dispatch";
+        case TracePhase::WRITE:
+            return "write";
+        case TracePhase::REQUEST:
+            break;
+        }
+        return "request";
+    }
+
+    struct TraceEvent {
+        typedef std::chrono::steady_clock Clock;
+
+        TracePhase myPhase;
+        Clock::time_point myStart;
+        Clock::duration myDuration;
+        // PARSE and REQUEST: size of the request data, WRITE: size of the response, DISPATCH: 0
+        size_t myBytes;
+        // Empty for a batch, or a request that could not be read
+        string_view myMethodName;
+        // nullptr for a batch, or a request that could not be read
+        const Value* myId;
+    };
+
+    // Receives the phases of the requests handled by a Server, on the threads that ran them (so
+    // from any number of threads at once). The event and what it refers to are only valid during
+    // the call.
+    class TraceSink {
+    public:
+        virtual ~TraceSink() {}
+        virtual void OnEvent(const TraceEvent& event) = 0;
+    };
+
+    // Collects the events in the Chrome trace event format ("complete" events with the method, id
+    // and bytes as arguments, on one track per thread), which chrome://tracing and Perfetto load.
+    class ChromeTraceSink final : public TraceSink {
+    public:
+        ChromeTraceSink() : myOrigin(TraceEvent::Clock::now()) {}
+
+        void OnEvent(const TraceEvent& event) override {
+            typedef std::chrono::duration<double, std::micro> Microseconds;
+            const double start = std::chrono::duration_cast<Microseconds>(event.myStart - myOrigin).count();
+            const double duration = std::chrono::duration_cast<Microseconds>(event.myDuration).count();
+
+            char buffer[160];
+            snprintf(buffer, sizeof(buffer),
+                "{\"name\":\"%s\",\"cat\":\"jsonrpc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu,\"args\":{\"bytes\":%zu",
+                GetTracePhaseName(event.myPhase), start, duration, GetThreadIndex(), event.myBytes);
+
+            std::string text(buffer);
+            if (!event.myMethodName.empty()) {
+                text += ",\"method\":";
+                AppendString(text, event.myMethodName);
+            }
+            if (event.myId != nullptr) {
+                AppendId(text, *event.myId);
+            }
+            text += "}}";
+
+            std::lock_guard<std::mutex> lock(myMutex);
+            if (!myEvents.empty()) {
+                myEvents += ',';
+            }
+            myEvents += text;
+        }
+
+        // The events so far, as a JSON trace file
+        std::string GetJson() const {
+            std::lock_guard<std::mutex> lock(myMutex);
+            return "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" + myEvents + "]}";
+        }
+
+        void Clear() {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myEvents.clear();
+        }
+
+    private:
+        static void AppendString(std::string& text, string_view value) {
+            text += '"';
+            for (char c : value) {
+                if (c == '"' || c == '\\') {
+                    text += '\\';
+                    text += c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned>(c));
+                    text += escape;
+                } else {
+                    text += c;
+                }
+            }
+            text += '"';
+        }
+
+        static void AppendId(std::string& text, const Value& id) {
+            if (id.IsInteger32() || id.IsInteger64()) {
+                text += ",\"id\":";
+                text += std::to_string(id.AsInteger64());
+            } else if (id.IsString()) {
+                text += ",\"id\":";
+                AppendString(text, id.AsStringView());
+            }
+        }
+
+        // Threads are numbered in the order they first report an event
+        static size_t GetThreadIndex() {
+            static std::atomic<size_t> nextIndex{ 1 };
+            static thread_local size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+
+        const TraceEvent::Clock::time_point myOrigin;
+        mutable std::mutex myMutex;
+        std::string myEvents;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_TRACE_H
@@ -20,12 +20,13 @@
 #ifndef JSONRPC_LEAN_UTIL_H
 #define JSONRPC_LEAN_UTIL_H
 
+#include "base64simd.h"
+
 #include <stdint.h>
 #include <string.h>
 #include <cassert>
 #include <ctime>
-#include <sstream>
-#include <iomanip>
+#include <string>
 
 struct tm;
 
@@ -76,114 +77,309 @@ namespace {
 namespace jsonrpc {
     namespace util {
 
+        // Size of a date-time in DATE_TIME_FORMAT (YYYYMMDDTHH:MM:SS), and of a buffer that holds
+        // any date-time FormatIso8601DateTime can write
+        const size_t ISO8601_DATE_TIME_SIZE = 17;
+        const size_t ISO8601_DATE_TIME_CAPACITY = 64;
+
+        namespace detail {
+
+            inline char* FormatDigits(char* out, int value, int digits) {
+                for (int i = digits - 1; i >= 0; --i) {
+                    out[i] = static_cast<char>('0' + value % 10);
+                    value /= 10;
+                }
+                return out + digits;
+            }
+
+            // -1 if text does not start with the given number of digits
+            inline int ParseDigits(const char* text, int digits) {
+                int value = 0;
+                for (int i = 0; i < digits; ++i) {
+                    const unsigned digit = static_cast<unsigned char>(text[i]) - '0';
+                    if (digit > 9) {
+                        return -1;
+                    }
+                    value = value * 10 + static_cast<int>(digit);
+                }
+                return value;
+            }
+
+            inline bool IsLeapYear(int year) {
+                return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+            }
+
+            // Days before the first of month (0-11) in a year that is not a leap year
+            inline int DaysBeforeMonth(int month) {
+                static const int days[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+                return days[month];
+            }
+
+            // 0 is Sunday (Sakamoto's method)
+            inline int DayOfWeek(int year, int month, int day) {
+                static const int offsets[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+                if (month < 2) {
+                    --year;
+                }
+                return (year + year / 4 - year / 100 + year / 400 + offsets[month] + day) % 7;
+            }
+
+        } // namespace detail
+
+        // Writes dt in DATE_TIME_FORMAT to buffer (ISO8601_DATE_TIME_CAPACITY chars) and returns the size
+        inline size_t FormatIso8601DateTime(const tm& dt, char* buffer) {
+            const int year = dt.tm_year + 1900;
+            if (year < 0 || year > 9999
+                || dt.tm_mon < 0 || dt.tm_mon > 98 || dt.tm_mday < 0 || dt.tm_mday > 99
+                || dt.tm_hour < 0 || dt.tm_hour > 99 || dt.tm_min < 0 || dt.tm_min > 99
+                || dt.tm_sec < 0 || dt.tm_sec > 99) {
+                // not representable with fixed width fields
+                return strftime(buffer, ISO8601_DATE_TIME_CAPACITY, DATE_TIME_FORMAT, &dt);
+            }
+
+            char* out = detail::FormatDigits(buffer, year, 4);
+            out = detail::FormatDigits(out, dt.tm_mon + 1, 2);
+            out = detail::FormatDigits(out, dt.tm_mday, 2);
+            *out++ = 'T';
+            out = detail::FormatDigits(out, dt.tm_hour, 2);
+            *out++ = ':';
+            out = detail::FormatDigits(out, dt.tm_min, 2);
+            *out++ = ':';
+            out = detail::FormatDigits(out, dt.tm_sec, 2);
+            return out - buffer;
+        }
+
         inline std::string FormatIso8601DateTime(const tm& dt) {
-            char str[128];
-            return std::string(str, strftime(str, sizeof(str), DATE_TIME_FORMAT, &dt));
+            char str[ISO8601_DATE_TIME_CAPACITY];
+            return std::string(str, FormatIso8601DateTime(dt, str));
         }
 
-        inline bool ParseIso8601DateTime(const char* text, tm& dt) {
-            if (!text) {
+        // Recognizes exactly DATE_TIME_FORMAT (YYYYMMDDTHH:MM:SS); called for every string that is
+        // read, so anything else is turned down after a few comparisons, without allocating
+        inline bool ParseIso8601DateTime(const char* text, size_t size, tm& dt) {
+            if (size != ISO8601_DATE_TIME_SIZE || text[8] != 'T' || text[11] != ':' || text[14] != ':') {
                 return false;
             }
-            memset(&dt, 0, sizeof(dt));
-            std::istringstream ss(text);
-            ss >> std::get_time(&dt, DATE_TIME_FORMAT);
 
-            if (ss.fail()) {
+            const int year = detail::ParseDigits(text, 4);
+            const int month = detail::ParseDigits(text + 4, 2);
+            const int day = detail::ParseDigits(text + 6, 2);
+            const int hour = detail::ParseDigits(text + 9, 2);
+            const int minute = detail::ParseDigits(text + 12, 2);
+            const int second = detail::ParseDigits(text + 15, 2);
+            if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31
+                || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
                 return false;
             }
+
+            memset(&dt, 0, sizeof(dt));
+            dt.tm_year = year - 1900;
+            dt.tm_mon = month - 1;
+            dt.tm_mday = day;
+            dt.tm_hour = hour;
+            dt.tm_min = minute;
+            dt.tm_sec = second;
+            dt.tm_wday = detail::DayOfWeek(year, month - 1, day);
+            dt.tm_yday = detail::DaysBeforeMonth(month - 1) + day - 1 + (month > 2 && detail::IsLeapYear(year) ? 1 : 0);
             dt.tm_isdst = -1;
             return true;
         }
 
-        inline std::string Base64Encode(const std::string& data); // forward declaration
+        inline bool ParseIso8601DateTime(const char* text, tm& dt) {
+            return text != nullptr && ParseIso8601DateTime(text, strlen(text), dt);
+        }
 
-        inline std::string Base64Encode(const char* data, size_t size) {
-            const size_t lineLength = 76;
-            static_assert(lineLength % 4 == 0, "invalid line length");
+        const size_t BASE_64_LINE_LENGTH = 76;
 
-            if (size == 0) {
-                return{};
+        // Characters needed for the encoding of size bytes, with line breaks (CRLF every
+        // BASE_64_LINE_LENGTH characters) if wrap is set
+        inline size_t Base64EncodedSize(size_t size, bool wrap = true) {
+            const size_t encodedSize = 4 * ((size + 2) / 3);
+            if (!wrap || encodedSize == 0) {
+                return encodedSize;
             }
+            return encodedSize + 2 * ((encodedSize - 1) / BASE_64_LINE_LENGTH);
+        }
 
-            const size_t encodedSize = 4 * ((size + 2) / 3);
-            std::string str(encodedSize + 2 * ((encodedSize - 1) / lineLength), '\0');
+        // Upper bound of the bytes decoded from size characters
+        inline size_t Base64DecodedMaxSize(size_t size) {
+            return 3 * ((size + 3) / 4);
+        }
+
+        namespace detail {
+
+            // Encodes whole groups of 3 bytes, using the vectorized blocks where there are enough
+            // bytes to load; readable is how many bytes from data on may be read
+            inline size_t Base64EncodeGroups(const char* data, size_t size, size_t readable, char* out) {
+                size_t in = 0;
+                const auto encode = GetBase64Kernels().myEncode;
+                if (encode != nullptr) {
+                    in = encode(data, size, readable, out);
+                    out += in / 3 * 4;
+                }
+                for (; in + 3 <= size; in += 3) {
+                    *out++ = Base64Char0(data[in]);
+                    *out++ = Base64Char1(data[in], data[in + 1]);
+                    *out++ = Base64Char2(data[in + 1], data[in + 2]);
+                    *out++ = Base64Char3(data[in + 2]);
+                }
+                return in;
+            }
+
+        } // namespace detail
+
+        // Encodes size bytes from data to out, which must have room for Base64EncodedSize(size, wrap)
+        // characters, and returns how many were written
+        inline size_t Base64Encode(const char* data, size_t size, char* out, bool wrap) {
+            static_assert(BASE_64_LINE_LENGTH % 4 == 0, "invalid line length");
+            const size_t lineBytes = BASE_64_LINE_LENGTH / 4 * 3;
 
+            char* const begin = out;
             size_t in = 0;
-            size_t out = 0;
-            for (size_t wrap = lineLength; in + 3 <= size; in += 3, wrap -= 4) {
-                if (wrap == 0) {
-                    str[out++] = '\r';
-                    str[out++] = '\n';
-                    wrap = lineLength;
+            if (wrap) {
+                for (; in + lineBytes < size; in += lineBytes) {
+                    detail::Base64EncodeGroups(data + in, lineBytes, size - in, out);
+                    out += BASE_64_LINE_LENGTH;
+                    *out++ = '\r';
+                    *out++ = '\n';
                 }
-                str[out++] = Base64Char0(data[in]);
-                str[out++] = Base64Char1(data[in], data[in + 1]);
-                str[out++] = Base64Char2(data[in + 1], data[in + 2]);
-                str[out++] = Base64Char3(data[in + 2]);
             }
+            const size_t encoded = detail::Base64EncodeGroups(data + in, size - in, size - in, out);
+            in += encoded;
+            out += encoded / 3 * 4;
 
             if (in < size) {
-                str[out++] = Base64Char0(data[in]);
+                *out++ = Base64Char0(data[in]);
                 if (in + 1 < size) {
-                    str[out++] = Base64Char1(data[in], data[in + 1]);
-                    str[out++] = Base64Char2(data[in + 1], 0);
+                    *out++ = Base64Char1(data[in], data[in + 1]);
+                    *out++ = Base64Char2(data[in + 1], 0);
                 } else {
-                    str[out++] = Base64Char1(data[in], 0);
-                    str[out++] = '=';
+                    *out++ = Base64Char1(data[in], 0);
+                    *out++ = '=';
                 }
-                str[out++] = '=';
+                *out++ = '=';
             }
 
-            assert(str.size() == out);
+            assert(static_cast<size_t>(out - begin) == Base64EncodedSize(size, wrap));
+            return out - begin;
+        }
+
+        inline std::string Base64Encode(const std::string& data, bool wrap = true); // forward declaration
+
+        inline std::string Base64Encode(const char* data, size_t size, bool wrap = true) {
+            std::string str(Base64EncodedSize(size, wrap), '\0');
+            if (!str.empty()) {
+                Base64Encode(data, size, &str[0], wrap);
+            }
             return str;
         }
 
-        inline std::string Base64Decode(const std::string& str); // forward declaration
+        namespace detail {
+
+            const size_t BASE_64_INVALID = static_cast<size_t>(-1);
+
+            // See Base64Decode; with strict set, only whitespace is skipped and '=' may only pad the
+            // end, anything else returns BASE_64_INVALID
+            inline size_t Base64Decode(const char* str, size_t size, char* out, bool strict) {
+                const size_t capacity = Base64DecodedMaxSize(size);
+                const auto decode = GetBase64Kernels().myDecode;
+
+                size_t written = 0;
+                uint32_t bits = 0;
+                size_t bitCount = 0;
+                size_t padding = 0;
+
+                size_t in = 0;
+                while (in < size) {
+                    // clean input goes to the vectorized decoder, what it turns down is decoded one
+                    // character at a time, up to the next group of 4 after the characters it skips
+                    bool skipped = false;
+                    if (decode != nullptr) {
+                        const size_t decoded = decode(str + in, size - in, out + written, capacity - written);
+                        in += decoded;
+                        written += decoded / 4 * 3;
+                    }
 
-        inline std::string Base64Decode(const char* str, size_t size) {
-            const size_t maxDecodedSize = 3 * ((size + 3) / 4);
-
-            std::string data(maxDecodedSize, '\0');
-
-            size_t out = 0;
-            uint32_t bits = 0;
-            size_t bitCount = 0;
-
-            for (size_t in = 0; in < size; ++in) {
-                const int value = BASE_64_LUT[static_cast<uint8_t>(str[in])];
-                if (value != -1) {
-                    bits = (bits << 6) | value;
-                    bitCount += 6;
-                    if (bitCount == 24) {
-                        data[out++] = bits >> 16;
-                        data[out++] = bits >> 8;
-                        data[out++] = bits;
-
-                        bits = 0;
-                        bitCount = 0;
+                    for (; in < size; ++in) {
+                        const int value = BASE_64_LUT[static_cast<uint8_t>(str[in])];
+                        if (value == -1) {
+                            if (strict) {
+                                const char c = str[in];
+                                if (c == '=') {
+                                    ++padding;
+                                } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                                    return BASE_64_INVALID;
+                                }
+                            }
+                            skipped = true;
+                        } else if (padding != 0) {
+                            return BASE_64_INVALID;
+                        } else if (skipped && bitCount == 0 && decode != nullptr) {
+                            break;
+                        } else {
+                            bits = (bits << 6) | value;
+                            bitCount += 6;
+                            if (bitCount == 24) {
+                                out[written++] = bits >> 16;
+                                out[written++] = bits >> 8;
+                                out[written++] = bits;
+
+                                bits = 0;
+                                bitCount = 0;
+                            }
+                        }
                     }
                 }
-            }
 
-            if (bitCount >= 12) {
-                bits = bits >> (bitCount % 8);
-                if (bitCount == 18) {
-                    data[out++] = bits >> 8;
+                // a lone character in the last group carries no whole byte; padding, if any, must
+                // complete that group
+                if (strict && (bitCount == 6 || (padding != 0 && (bitCount < 12 || padding != (24 - bitCount) / 6)))) {
+                    return BASE_64_INVALID;
+                }
+
+                if (bitCount >= 12) {
+                    bits = bits >> (bitCount % 8);
+                    if (bitCount == 18) {
+                        out[written++] = bits >> 8;
+                    }
+                    out[written++] = bits;
                 }
-                data[out++] = bits;
+
+                assert(capacity >= written);
+                return written;
             }
 
-            assert(data.size() >= out);
-            data.resize(out);
+        } // namespace detail
+
+        // Decodes size characters from str to out, which must have room for Base64DecodedMaxSize(size)
+        // bytes, and returns how many were written. Characters outside the alphabet (line breaks,
+        // padding) are skipped.
+        inline size_t Base64Decode(const char* str, size_t size, char* out) {
+            return detail::Base64Decode(str, size, out, false);
+        }
+
+        // Same as Base64Decode, but str must be base64: only whitespace is skipped, padding may
+        // only complete the last group, and anything else makes it return false
+        inline bool Base64DecodeStrict(const char* str, size_t size, char* out, size_t& written) {
+            written = detail::Base64Decode(str, size, out, true);
+            return written != detail::BASE_64_INVALID;
+        }
+
+        inline std::string Base64Decode(const std::string& str); // forward declaration
+
+        inline std::string Base64Decode(const char* str, size_t size) {
+            std::string data(Base64DecodedMaxSize(size), '\0');
+            if (!data.empty()) {
+                data.resize(Base64Decode(str, size, &data[0]));
+            }
             return data;
         }
 
     } // namespace util
 } // namespace jsonrpc
 
-inline std::string jsonrpc::util::Base64Encode(const std::string& data) {
-    return Base64Encode(data.data(), data.size());
+inline std::string jsonrpc::util::Base64Encode(const std::string& data, bool wrap) {
+    return Base64Encode(data.data(), data.size(), wrap);
 }
 
 inline std::string jsonrpc::util::Base64Decode(const std::string& str) {
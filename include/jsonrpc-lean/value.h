@@ -20,14 +20,22 @@
 #ifndef JSONRPC_LEAN_VALUE_H
 #define JSONRPC_LEAN_VALUE_H
 
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <iosfwd>
 #include <map>
+#include <new>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <ostream>
 
+#include "arena.h"
+#include "binary.h"
+#include "compat.h"
+#include "stringscan.h"
 #include "util.h"
 #include "fault.h"
 #include "writer.h"
@@ -36,14 +44,28 @@ struct tm;
 
 namespace jsonrpc {
 
+    // What Value::AsType<T>() returns: a reference into the Value, except for scalars and views
+    template<typename T>
+    struct ValueAsType {
+        typedef const T& Type;
+    };
+
+    template<> struct ValueAsType<bool> { typedef bool Type; };
+    template<> struct ValueAsType<double> { typedef double Type; };
+    template<> struct ValueAsType<int32_t> { typedef int32_t Type; };
+    template<> struct ValueAsType<int64_t> { typedef int64_t Type; };
+    template<> struct ValueAsType<string_view> { typedef string_view Type; };
+
     class Value {
     public:
-        typedef std::vector<Value> Array;
+        // Array and Struct take their memory from the global heap unless they are given an
+        // arena backed allocator, e.g. Array(Array::allocator_type(&arena)), see arena.h
+        typedef std::vector<Value, util::ArenaAllocator<Value>> Array;
         typedef tm DateTime;
         typedef std::string String;
-        typedef std::map<std::string, Value> Struct;
+        typedef std::map<std::string, Value, std::less<std::string>, util::ArenaAllocator<std::pair<const std::string, Value>>> Struct;
 
-        enum class Type {
+        enum class Type : uint8_t {
             ARRAY,
             BINARY,
             BOOLEAN,
@@ -58,39 +80,74 @@ namespace jsonrpc {
 
         Value() : myType(Type::NIL) {}
 
+        // An arena backed Array or Struct is itself placed in the same arena
         Value(Array value) : myType(Type::ARRAY) {
-            as.myArray = new Array(std::move(value));
+            as.myArray = Create<Array>(value.get_allocator().GetArena(), std::move(value));
         }
 
         Value(bool value) : myType(Type::BOOLEAN) { as.myBoolean = value; }
 
-        Value(const DateTime& value) : myType(Type::DATE_TIME) {
-            as.myDateTime = new DateTime(value);
+        Value(const DateTime& value, util::Arena* arena = nullptr) : myType(Type::DATE_TIME) {
+            as.myDateTime = Create<DateTime>(arena, value);
             as.myDateTime->tm_isdst = -1;
         }
 
         Value(double value) : myType(Type::DOUBLE) { as.myDouble = value; }
 
-        Value(int32_t value) : myType(Type::INTEGER_32) {
-            as.myInteger32 = value;
-            as.myInteger64 = value;
-            as.myDouble = value;
-        }
+        Value(int32_t value) : myType(Type::INTEGER_32) { as.myInteger32 = value; }
 
-        Value(int64_t value) : myType(Type::INTEGER_64) {
-            as.myInteger32 = static_cast<int32_t>(value);
-            as.myInteger64 = value;
-            as.myDouble = static_cast<double>(value);
-        }
+        Value(int64_t value) : myType(Type::INTEGER_64) { as.myInteger64 = value; }
 
         Value(const char* value) : Value(String(value)) {}
 
+        // Up to SHORT_STRING_CAPACITY characters are stored in place, so short strings don't
+        // allocate at all. With binary set the characters are taken over by a Binary.
         Value(String value, bool binary = false) : myType(binary ? Type::BINARY : Type::STRING) {
-            as.myString = new String(std::move(value));
+            if (binary) {
+                as.myBinary = new BinaryData(Binary(std::move(value)));
+            } else if (value.size() <= SHORT_STRING_CAPACITY) {
+                SetShortString(value);
+            } else {
+                myStringStorage = StringStorage::LONG;
+                as.myLongString = new String(std::move(value));
+            }
+        }
+
+        // Shares the buffer, copies of the Value do too
+        Value(Binary value) : myType(Type::BINARY) {
+            as.myBinary = new BinaryData(std::move(value));
+        }
+
+        // A string that was already classified (see util::ClassifyString), BINARY if it has a NUL
+        Value(String value, util::StringInfo info) : Value(std::move(value), info.myHasNul) {
+            SetStringInfo(info);
         }
 
         Value(Struct value) : myType(Type::STRUCT) {
-            as.myStruct = new Struct(std::move(value));
+            as.myStruct = Create<Struct>(value.get_allocator().GetArena(), std::move(value));
+        }
+
+        // A STRING value that refers to value instead of copying it, the referenced characters
+        // must outlive the returned Value and every move of it. Copying the Value (explicit copy
+        // constructor) makes an owning copy. A BINARY value is always copied to its own Binary.
+        static Value Borrow(string_view value, bool binary = false) {
+            if (binary) {
+                return Value(Binary(value.data(), value.size()));
+            }
+
+            Value result;
+            result.myType = Type::STRING;
+            result.myStringStorage = StringStorage::BORROWED;
+            result.as.myStringRef.myData = value.data();
+            result.as.myStringRef.mySize = value.size();
+            new (&result.as.myStringRef.myCopy) std::atomic<String*>(nullptr);
+            return result;
+        }
+
+        static Value Borrow(string_view value, util::StringInfo info) {
+            Value result = Borrow(value, info.myHasNul);
+            result.SetStringInfo(info);
+            return result;
         }
 
         ~Value() {
@@ -119,12 +176,20 @@ namespace jsonrpc {
             }
         }
 
-        explicit Value(const Value& other) : myType(other.myType), as(other.as) {
+        explicit Value(const Value& other) : myType(other.myType), myStringFlags(other.myStringFlags.load(std::memory_order_relaxed)) {
             switch (myType) {
             case Type::BOOLEAN:
+                as.myBoolean = other.as.myBoolean;
+                break;
             case Type::DOUBLE:
+                as.myDouble = other.as.myDouble;
+                break;
             case Type::INTEGER_32:
+                as.myInteger32 = other.as.myInteger32;
+                break;
             case Type::INTEGER_64:
+                as.myInteger64 = other.as.myInteger64;
+                break;
             case Type::NIL:
                 break;
 
@@ -135,9 +200,18 @@ namespace jsonrpc {
                 as.myDateTime = new DateTime(other.AsDateTime());
                 break;
             case Type::BINARY:
-            case Type::STRING:
-                as.myString = new String(other.AsString());
+                as.myBinary = new BinaryData(other.as.myBinary->myBuffer);
+                break;
+            case Type::STRING: {
+                auto str = other.AsStringView();
+                if (str.size() <= SHORT_STRING_CAPACITY) {
+                    SetShortString(str);
+                } else {
+                    myStringStorage = StringStorage::LONG;
+                    as.myLongString = new String(str.data(), str.size());
+                }
                 break;
+            }
             case Type::STRUCT:
                 as.myStruct = new Struct(other.AsStruct());
                 break;
@@ -146,18 +220,14 @@ namespace jsonrpc {
 
         Value& operator=(const Value&) = delete;
 
-        Value(Value&& other) noexcept : myType(other.myType), as(other.as) {
-            other.myType = Type::NIL;
+        Value(Value&& other) noexcept : myType(Type::NIL) {
+            MoveFrom(other);
         }
 
         Value& operator=(Value&& other) noexcept {
             if (this != &other) {
                 Reset();
-
-                myType = other.myType;
-                as = other.as;
-
-                other.myType = Type::NIL;
+                MoveFrom(other);
             }
             return *this;
         }
@@ -180,9 +250,14 @@ namespace jsonrpc {
             throw InvalidParametersFault();
         }
 
-        const String& AsBinary() const { return AsString(); }
+        const Binary& AsBinary() const {
+            if (IsBinary()) {
+                return as.myBinary->myBuffer;
+            }
+            throw InvalidParametersFault();
+        }
 
-        const bool& AsBoolean() const {
+        bool AsBoolean() const {
             if (IsBoolean()) {
                 return as.myBoolean;
             }
@@ -196,37 +271,102 @@ namespace jsonrpc {
             throw InvalidParametersFault();
         }
 
-        const double& AsDouble() const {
-            if (IsDouble() || IsInteger32() || IsInteger64()) {
+        double AsDouble() const {
+            if (IsDouble()) {
                 return as.myDouble;
+            } else if (IsInteger32()) {
+                return as.myInteger32;
+            } else if (IsInteger64()) {
+                return static_cast<double>(as.myInteger64);
             }
             throw InvalidParametersFault();
         }
 
-        const int32_t& AsInteger32() const {
+        int32_t AsInteger32() const {
             if (IsInteger32()) {
                 return as.myInteger32;
             } else if (IsInteger64()
-                && static_cast<int64_t>(as.myInteger32) == as.myInteger64) {
-                return as.myInteger32;
+                && static_cast<int64_t>(static_cast<int32_t>(as.myInteger64)) == as.myInteger64) {
+                return static_cast<int32_t>(as.myInteger64);
             }
             throw InvalidParametersFault();
         }
 
-        const int64_t& AsInteger64() const {
-            if (IsInteger32() || IsInteger64()) {
+        int64_t AsInteger64() const {
+            if (IsInteger32()) {
+                return as.myInteger32;
+            } else if (IsInteger64()) {
                 return as.myInteger64;
             }
             throw InvalidParametersFault();
         }
 
+        // For a short or borrowed string (see Borrow) or a BINARY value the first call makes a
+        // copy, use AsStringView (or AsBinary) to avoid it. Safe to call from several threads at
+        // once: one copy is kept, the others are dropped.
         const String& AsString() const {
-            if (IsString() || IsBinary()) {
-                return *as.myString;
+            if (IsBinary()) {
+                return GetCopy(as.myBinary->myCopy, as.myBinary->myBuffer.GetView());
+            }
+            if (IsString()) {
+                switch (myStringStorage) {
+                case StringStorage::SHORT:
+                    return GetCopy(as.myShortString.myCopy, AsStringView());
+                case StringStorage::LONG:
+                    return *as.myLongString;
+                case StringStorage::BORROWED:
+                    return GetCopy(as.myStringRef.myCopy, AsStringView());
+                }
             }
             throw InvalidParametersFault();
         }
 
+        string_view AsStringView() const {
+            if (IsBinary()) {
+                return as.myBinary->myBuffer.GetView();
+            }
+            if (IsString()) {
+                switch (myStringStorage) {
+                case StringStorage::SHORT:
+                    return string_view(as.myShortString.myData, myShortStringSize);
+                case StringStorage::LONG:
+                    return string_view(as.myLongString->data(), as.myLongString->size());
+                case StringStorage::BORROWED:
+                    return string_view(as.myStringRef.myData, as.myStringRef.mySize);
+                }
+            }
+            throw InvalidParametersFault();
+        }
+
+        bool IsBorrowed() const { return IsString() && myStringStorage == StringStorage::BORROWED; }
+
+        // What AsString returns if it has it without making a copy, otherwise nullptr
+        const String* GetStoredString() const {
+            if (IsString() && myStringStorage == StringStorage::LONG) {
+                return as.myLongString;
+            }
+            if (IsBinary()) {
+                return as.myBinary->myCopy.load(std::memory_order_acquire);
+            }
+            if (IsString()) {
+                return (myStringStorage == StringStorage::SHORT ? as.myShortString.myCopy : as.myStringRef.myCopy).load(std::memory_order_acquire);
+            }
+            return nullptr;
+        }
+
+        // Whether a STRING or BINARY value has no byte above 0x7f; known right away for the strings
+        // made by the readers, scanned (once) on the first call for the others. Threads that call
+        // it at once may each scan, with the same result.
+        bool IsAscii() const {
+            const auto str = AsStringView();
+            uint8_t flags = myStringFlags.load(std::memory_order_relaxed);
+            if ((flags & STRING_CLASSIFIED) == 0) {
+                SetStringInfo(util::ClassifyString(str.data(), str.size()));
+                flags = myStringFlags.load(std::memory_order_relaxed);
+            }
+            return (flags & STRING_ASCII) != 0;
+        }
+
         const Struct& AsStruct() const {
             if (IsStruct()) {
                 return *as.myStruct;
@@ -235,7 +375,7 @@ namespace jsonrpc {
         }
 
         template<typename T>
-        inline const T& AsType() const;
+        inline typename ValueAsType<T>::Type AsType() const;
 
         Type GetType() const { return myType; }
 
@@ -249,7 +389,7 @@ namespace jsonrpc {
                 writer.EndArray();
                 break;
             case Type::BINARY:
-                writer.WriteBinary(as.myString->data(), as.myString->size());
+                writer.WriteBinary(as.myBinary->myBuffer.GetData(), as.myBinary->myBuffer.GetSize());
                 break;
             case Type::BOOLEAN:
                 writer.Write(as.myBoolean);
@@ -270,7 +410,7 @@ namespace jsonrpc {
                 writer.WriteNull();
                 break;
             case Type::STRING:
-                writer.Write(*as.myString);
+                writer.Write(AsStringView());
                 break;
             case Type::STRUCT:
                 writer.StartStruct();
@@ -288,20 +428,159 @@ namespace jsonrpc {
         inline const Value& operator[](const Struct::key_type& key) const;
 
     private:
+        // What libstdc++ keeps in place too, so that a String copy of a short string does not
+        // allocate either
+        static const size_t SHORT_STRING_CAPACITY = 15;
+
+        enum StringFlags : uint8_t {
+            STRING_CLASSIFIED = 1,
+            STRING_ASCII = 2,
+        };
+
+        enum class StringStorage : uint8_t {
+            SHORT,   // in place
+            LONG,    // in a String of its own
+            BORROWED // see Borrow
+        };
+
+        void SetStringInfo(util::StringInfo info) const {
+            myStringFlags.store(STRING_CLASSIFIED | (info.myIsAscii ? STRING_ASCII : 0), std::memory_order_relaxed);
+        }
+
+        void SetShortString(string_view value) {
+            myStringStorage = StringStorage::SHORT;
+            myShortStringSize = static_cast<uint8_t>(value.size());
+            if (!value.empty()) {
+                memcpy(as.myShortString.myData, value.data(), value.size());
+            }
+            new (&as.myShortString.myCopy) std::atomic<String*>(nullptr);
+        }
+
+        // The String made by AsString; whichever thread installs one first wins
+        static const String& GetCopy(std::atomic<String*>& copy, string_view value) {
+            String* existing = copy.load(std::memory_order_acquire);
+            if (existing == nullptr) {
+                String* made = new String(value.data(), value.size());
+                if (copy.compare_exchange_strong(existing, made, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    existing = made;
+                } else {
+                    delete made;
+                }
+            }
+            return *existing;
+        }
+
+        // Out of line, so that the buffer and its copy don't make every Value larger
+        struct BinaryData {
+            explicit BinaryData(Binary buffer) : myBuffer(std::move(buffer)) {}
+            ~BinaryData() { delete myCopy.load(std::memory_order_relaxed); }
+
+            Binary myBuffer;
+            mutable std::atomic<String*> myCopy{ nullptr }; // made by AsString
+        };
+
+        template<typename T, typename... Args>
+        T* Create(util::Arena* arena, Args&&... args) {
+            if (arena != nullptr) {
+                myIsInArena = true;
+                return new (arena->Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            }
+            return new T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        void Destroy(T* value) {
+            if (myIsInArena) {
+                value->~T();
+            } else {
+                delete value;
+            }
+        }
+
+        void MoveFrom(Value& other) noexcept {
+            myType = other.myType;
+            myStringStorage = other.myStringStorage;
+            myShortStringSize = other.myShortStringSize;
+            myIsInArena = other.myIsInArena;
+            myStringFlags.store(other.myStringFlags.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+            switch (myType) {
+            case Type::ARRAY:
+                as.myArray = other.as.myArray;
+                break;
+            case Type::BINARY:
+                as.myBinary = other.as.myBinary;
+                break;
+            case Type::BOOLEAN:
+                as.myBoolean = other.as.myBoolean;
+                break;
+            case Type::DATE_TIME:
+                as.myDateTime = other.as.myDateTime;
+                break;
+            case Type::DOUBLE:
+                as.myDouble = other.as.myDouble;
+                break;
+            case Type::INTEGER_32:
+                as.myInteger32 = other.as.myInteger32;
+                break;
+            case Type::INTEGER_64:
+                as.myInteger64 = other.as.myInteger64;
+                break;
+            case Type::NIL:
+                break;
+            case Type::STRING:
+                switch (myStringStorage) {
+                case StringStorage::SHORT:
+                    memcpy(as.myShortString.myData, other.as.myShortString.myData, SHORT_STRING_CAPACITY);
+                    new (&as.myShortString.myCopy) std::atomic<String*>(other.as.myShortString.myCopy.load(std::memory_order_relaxed));
+                    break;
+                case StringStorage::LONG:
+                    as.myLongString = other.as.myLongString;
+                    break;
+                case StringStorage::BORROWED:
+                    as.myStringRef.myData = other.as.myStringRef.myData;
+                    as.myStringRef.mySize = other.as.myStringRef.mySize;
+                    new (&as.myStringRef.myCopy) std::atomic<String*>(other.as.myStringRef.myCopy.load(std::memory_order_relaxed));
+                    break;
+                }
+                break;
+            case Type::STRUCT:
+                as.myStruct = other.as.myStruct;
+                break;
+            }
+
+            // nothing left for other to free
+            other.myType = Type::NIL;
+            other.myIsInArena = false;
+            other.myStringFlags.store(0, std::memory_order_relaxed);
+        }
+
         void Reset() {
             switch (myType) {
             case Type::ARRAY:
-                delete as.myArray;
+                Destroy(as.myArray);
                 break;
             case Type::DATE_TIME:
-                delete as.myDateTime;
+                Destroy(as.myDateTime);
                 break;
             case Type::BINARY:
+                delete as.myBinary;
+                break;
             case Type::STRING:
-                delete as.myString;
+                switch (myStringStorage) {
+                case StringStorage::SHORT:
+                    delete as.myShortString.myCopy.load(std::memory_order_relaxed);
+                    break;
+                case StringStorage::LONG:
+                    delete as.myLongString;
+                    break;
+                case StringStorage::BORROWED:
+                    delete as.myStringRef.myCopy.load(std::memory_order_relaxed);
+                    break;
+                }
                 break;
             case Type::STRUCT:
-                delete as.myStruct;
+                Destroy(as.myStruct);
                 break;
 
             case Type::BOOLEAN:
@@ -313,59 +592,88 @@ namespace jsonrpc {
             }
 
             myType = Type::NIL;
+            myIsInArena = false;
+            myStringFlags.store(0, std::memory_order_relaxed);
         }
 
+        // One tag byte plus flags next to a 24 byte union in which every scalar is packed into
+        // 8 bytes and a short string is held in place; 32 bytes in all on 64 bit platforms
         Type myType;
-        union {
+        StringStorage myStringStorage = StringStorage::SHORT;
+        uint8_t myShortStringSize = 0;
+        bool myIsInArena = false;
+        mutable std::atomic<uint8_t> myStringFlags{ 0 };
+        union Storage {
+            Storage() {}
+            ~Storage() {}
+
             Array* myArray;
+            BinaryData* myBinary;
             bool myBoolean;
             DateTime* myDateTime;
-            String* myString;
+            double myDouble;
+            int32_t myInteger32;
+            int64_t myInteger64;
+            String* myLongString;
             Struct* myStruct;
             struct {
-                double myDouble;
-                int32_t myInteger32;
-                int64_t myInteger64;
-            };
+                char myData[SHORT_STRING_CAPACITY];
+                mutable std::atomic<String*> myCopy;
+            } myShortString;
+            struct {
+                const char* myData;
+                size_t mySize;
+                mutable std::atomic<String*> myCopy;
+            } myStringRef;
         } as;
     };
 
-    template<> inline const Value::Array& Value::AsType<typename Value::Array>() const {
+    static_assert(sizeof(void*) != 8 || sizeof(Value) == 32, "Value is meant to take 32 bytes");
+
+    template<> inline ValueAsType<typename Value::Array>::Type Value::AsType<typename Value::Array>() const {
         return AsArray();
     }
 
-    template<> inline const bool& Value::AsType<bool>() const {
+    template<> inline ValueAsType<Binary>::Type Value::AsType<Binary>() const {
+        return AsBinary();
+    }
+
+    template<> inline ValueAsType<bool>::Type Value::AsType<bool>() const {
         return AsBoolean();
     }
 
-    template<> inline const Value::DateTime& Value::AsType<typename Value::DateTime>() const {
+    template<> inline ValueAsType<typename Value::DateTime>::Type Value::AsType<typename Value::DateTime>() const {
         return AsDateTime();
     }
 
-    template<> inline const double& Value::AsType<double>() const {
+    template<> inline ValueAsType<double>::Type Value::AsType<double>() const {
         return AsDouble();
     }
 
-    template<> inline const int32_t& Value::AsType<int32_t>() const {
+    template<> inline ValueAsType<int32_t>::Type Value::AsType<int32_t>() const {
         return AsInteger32();
     }
 
-    template<> inline const int64_t& Value::AsType<int64_t>() const {
+    template<> inline ValueAsType<int64_t>::Type Value::AsType<int64_t>() const {
         return AsInteger64();
     }
 
-    template<> inline const Value::String& Value::AsType<typename Value::String>() const {
+    template<> inline ValueAsType<typename Value::String>::Type Value::AsType<typename Value::String>() const {
         return AsString();
     }
 
-    template<> inline const Value::Struct& Value::AsType<typename Value::Struct>() const {
+    template<> inline ValueAsType<typename Value::Struct>::Type Value::AsType<typename Value::Struct>() const {
         return AsStruct();
     }
 
-    template<> inline const Value& Value::AsType<Value>() const {
+    template<> inline ValueAsType<Value>::Type Value::AsType<Value>() const {
         return *this;
     }
 
+    template<> inline ValueAsType<string_view>::Type Value::AsType<string_view>() const {
+        return AsStringView();
+    }
+
     inline const Value& Value::operator[](Array::size_type i) const {
         return AsArray().at(i);
     };
@@ -388,9 +696,11 @@ namespace jsonrpc {
             os << ']';
             break;
         }
-        case Value::Type::BINARY:
-            os << util::Base64Encode(value.AsBinary());
+        case Value::Type::BINARY: {
+            auto binary = value.AsStringView();
+            os << util::Base64Encode(binary.data(), binary.size());
             break;
+        }
         case Value::Type::BOOLEAN:
             os << value.AsBoolean();
             break;
@@ -410,7 +720,7 @@ namespace jsonrpc {
             os << "<nil>";
             break;
         case Value::Type::STRING:
-            os << '"' << value.AsString() << '"';
+            os << '"' << value.AsStringView() << '"';
             break;
         case Value::Type::STRUCT: {
             os << '{';
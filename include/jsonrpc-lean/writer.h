@@ -22,12 +22,15 @@
 
 #include <string>
 #include <memory>
+#include "compat.h"
+#include "fault.h"
 #include "formatteddata.h"
 
 struct tm;
 
 namespace jsonrpc {
 
+    class CachedValue;
     class Value;
 
     class Writer {
@@ -37,6 +40,11 @@ namespace jsonrpc {
         // Result
         virtual std::shared_ptr<FormattedData> GetData() = 0;
 
+        // Bytes written so far; writers override this when GetData would have to allocate or copy
+        virtual size_t GetSize() {
+            return GetData()->GetSize();
+        }
+
         // Document
         virtual void StartDocument() = 0;
         virtual void EndDocument() = 0;
@@ -55,6 +63,16 @@ namespace jsonrpc {
         virtual void EndFaultResponse() = 0;
         virtual void WriteFault(int32_t code, const std::string& string) = 0;
 
+        // Batch; a format without batches can not write one (its readers never read one, so a
+        // server never answers with one)
+        virtual void StartBatch() {
+            throw InternalErrorFault("Batches are not supported by this format");
+        }
+
+        virtual void EndBatch() {
+            throw InternalErrorFault("Batches are not supported by this format");
+        }
+
         // Values
         virtual void StartArray() = 0;
         virtual void EndArray() = 0;
@@ -70,6 +88,15 @@ namespace jsonrpc {
         virtual void Write(int64_t value) = 0;
         virtual void Write(const std::string& value) = 0;
         virtual void Write(const tm& value) = 0;
+
+        // Formats that can write a string without copying it override this
+        virtual void Write(string_view value) {
+            Write(std::string(value.data(), value.size()));
+        }
+
+        // Writes the bytes value was encoded to before, if the format can; otherwise returns false
+        // and the value is written as usual
+        virtual bool WriteCached(const CachedValue& /*value*/) { return false; }
     };
 
 } // namespace jsonrpc
@@ -0,0 +1,180 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Loopback test of EpollServer: clients connect over TCP and a Unix domain socket, pipeline
+// framed requests (several per write, and one split over two writes) and check that the
+// responses come back complete and in order. Exits with 1 on the first failure.
+
+#include "../include/jsonrpc-lean/epollserver.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+    using namespace jsonrpc;
+
+    const int RECEIVE_TIMEOUT_MILLISECONDS = 5000;
+    const size_t MAX_MESSAGE_SIZE = 64 * 1024;
+
+    void Check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            std::exit(1);
+        }
+    }
+
+    int ConnectTcp(uint16_t port) {
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        Check(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0, "connect over TCP");
+        return fd;
+    }
+
+    int ConnectUnix(const std::string& path) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        Check(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0, "connect over " + path);
+        return fd;
+    }
+
+    void SendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const ssize_t size = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            Check(size > 0, "send");
+            sent += size;
+        }
+    }
+
+    // Reads lines until count were received; fails on a timeout or if the server closes first
+    std::vector<std::string> ReceiveLines(int fd, size_t count) {
+        std::vector<std::string> lines;
+        std::string pending;
+        while (lines.size() < count) {
+            pollfd ready = { fd, POLLIN, 0 };
+            Check(poll(&ready, 1, RECEIVE_TIMEOUT_MILLISECONDS) == 1, "response within the timeout");
+
+            char buffer[4096];
+            const ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+            Check(size > 0, "connection open until every response arrived");
+            pending.append(buffer, size);
+
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                lines.push_back(pending.substr(0, newline));
+                pending.erase(0, newline + 1);
+            }
+        }
+        Check(pending.empty() && lines.size() == count, "no response beyond the expected ones");
+        return lines;
+    }
+
+    std::string AddRequest(int id, int a, int b) {
+        return "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":" + std::to_string(id)
+            + ",\"params\":[" + std::to_string(a) + "," + std::to_string(b) + "]}\n";
+    }
+
+    std::string AddResponse(int id, int sum) {
+        return "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(id) + ",\"result\":" + std::to_string(sum) + "}";
+    }
+
+    void TestPipelined(int fd, const std::string& name) {
+        // many requests in one write, a notification among them (which gets no response)
+        std::string requests;
+        const int REQUEST_COUNT = 100;
+        for (int i = 0; i < REQUEST_COUNT; ++i) {
+            requests += AddRequest(i, i, 2 * i);
+            if (i == REQUEST_COUNT / 2) {
+                requests += "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[1,2]}\n";
+            }
+        }
+        SendAll(fd, requests);
+
+        const auto responses = ReceiveLines(fd, REQUEST_COUNT);
+        for (int i = 0; i < REQUEST_COUNT; ++i) {
+            Check(responses[i] == AddResponse(i, 3 * i), name + ": response " + std::to_string(i) + " is " + responses[i]);
+        }
+
+        // a request split over two writes, followed by a complete one in the second
+        const std::string split = AddRequest(1000, 20, 22);
+        SendAll(fd, split.substr(0, split.size() / 2));
+        pollfd ready = { fd, POLLIN, 0 };
+        Check(poll(&ready, 1, 100) == 0, name + ": no response to half a request");
+        SendAll(fd, split.substr(split.size() / 2) + AddRequest(1001, 1, 1));
+
+        const auto rest = ReceiveLines(fd, 2);
+        Check(rest[0] == AddResponse(1000, 42), name + ": split request, got " + rest[0]);
+        Check(rest[1] == AddResponse(1001, 2), name + ": request after the split one, got " + rest[1]);
+    }
+
+} // namespace
+
+int main() {
+    Server server;
+    JsonFormatHandler jsonFormatHandler;
+    server.RegisterFormatHandler(jsonFormatHandler);
+    server.GetDispatcher().AddMethod("add", [](int32_t a, int32_t b) { return a + b; });
+
+    const std::string unixPath = "/tmp/jsonrpc-test-epollserver-" + std::to_string(getpid());
+
+    EpollServer epollServer(server);
+    epollServer.SetThreadCount(2);
+    epollServer.SetMaxMessageSize(MAX_MESSAGE_SIZE);
+    const uint16_t port = epollServer.ListenTcp("127.0.0.1", 0);
+    epollServer.ListenUnix(unixPath);
+    epollServer.Start();
+
+    // several clients at once, so that both reactors get some
+    std::vector<int> clients;
+    for (int i = 0; i < 4; ++i) {
+        clients.push_back(ConnectTcp(port));
+    }
+    clients.push_back(ConnectUnix(unixPath));
+
+    for (size_t i = 0; i < clients.size(); ++i) {
+        TestPipelined(clients[i], "client " + std::to_string(i));
+    }
+
+    // an unreadable frame closes its connection (possibly before all of it was sent, so the send
+    // may fail), the others are still served
+    const std::string oversized(MAX_MESSAGE_SIZE + 1, 'x');
+    send(clients[0], oversized.data(), oversized.size(), MSG_NOSIGNAL);
+    char byte;
+    pollfd ready = { clients[0], POLLIN, 0 };
+    Check(poll(&ready, 1, RECEIVE_TIMEOUT_MILLISECONDS) == 1 && recv(clients[0], &byte, 1, 0) <= 0,
+        "oversized message closes its connection");
+    SendAll(clients[1], AddRequest(7, 3, 4));
+    Check(ReceiveLines(clients[1], 1)[0] == AddResponse(7, 7), "other connections are still served");
+
+    for (int fd : clients) {
+        close(fd);
+    }
+    epollServer.Stop();
+
+    std::printf("epollserver: all tests passed\n");
+    return 0;
+}
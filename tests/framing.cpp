@@ -0,0 +1,333 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Test of FrameReader and FramedConnection: streams in each framing are fed in randomly split
+// chunks (through the receive buffer and through Consume) and must give back the same messages,
+// broken streams must be refused. Exits with 1 on the first failure.
+
+#include "../include/jsonrpc-lean/framing.h"
+#include "../include/jsonrpc-lean/msgpackformathandler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    using namespace jsonrpc;
+
+    const Framing FRAMINGS[] = { Framing::NEWLINE, Framing::CONTENT_LENGTH, Framing::LENGTH_PREFIX };
+
+    void Check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            std::exit(1);
+        }
+    }
+
+    std::string GetName(Framing framing) {
+        switch (framing) {
+        case Framing::NEWLINE:
+            return "NEWLINE";
+        case Framing::CONTENT_LENGTH:
+            return "CONTENT_LENGTH";
+        case Framing::LENGTH_PREFIX:
+            return "LENGTH_PREFIX";
+        }
+        return "?";
+    }
+
+    // Frames message by hand, so that the reader is not only tested against FrameWriter; an empty
+    // message is framed too
+    std::string Frame(Framing framing, const std::string& message) {
+        switch (framing) {
+        case Framing::NEWLINE:
+            return message + "\n";
+        case Framing::CONTENT_LENGTH:
+            return "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\ncontent-length:  "
+                + std::to_string(message.size()) + " \r\n\r\n" + message;
+        case Framing::LENGTH_PREFIX: {
+            const size_t size = message.size();
+            const char prefix[] = { static_cast<char>(size >> 24), static_cast<char>(size >> 16),
+                static_cast<char>(size >> 8), static_cast<char>(size) };
+            return std::string(prefix, 4) + message;
+        }
+        }
+        return message;
+    }
+
+    // Feeds stream to feed(data, size) in chunks of 1 to maxChunk bytes; false if feed returned false
+    template<typename Feed>
+    bool FeedSplit(const std::string& stream, std::mt19937& random, size_t maxChunk, Feed feed) {
+        std::uniform_int_distribution<size_t> chunkSize(1, maxChunk);
+        for (size_t position = 0; position < stream.size(); ) {
+            const size_t size = std::min(chunkSize(random), stream.size() - position);
+            if (!feed(stream.data() + position, size)) {
+                return false;
+            }
+            position += size;
+        }
+        return true;
+    }
+
+    // Feeds data to reader through its receive buffer, as a transport would
+    template<typename Handler>
+    bool Receive(FrameReader& reader, const char* data, size_t size, Handler&& handler) {
+        while (size > 0) {
+            size_t capacity;
+            char* buffer = reader.GetReceiveBuffer(capacity);
+            const size_t count = std::min(size, capacity);
+            memcpy(buffer, data, count);
+            if (!reader.Received(count, handler)) {
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    // Every message comes out once and whole, however the stream is split, and empty frames are
+    // skipped
+    void TestSplits() {
+        std::vector<std::string> messages = {
+            "{\"jsonrpc\":\"2.0\",\"method\":\"a\"}",
+            "",
+            "x",
+            std::string(100000, 'y'),
+            "",
+            "{\"last\":true}",
+        };
+        std::vector<std::string> expected;
+        for (auto& message : messages) {
+            if (!message.empty()) {
+                expected.push_back(message);
+            }
+        }
+
+        std::mt19937 random(1);
+        for (Framing framing : FRAMINGS) {
+            std::string stream;
+            for (int repeat = 0; repeat < 10; ++repeat) {
+                for (auto& message : messages) {
+                    stream += Frame(framing, message);
+                }
+            }
+
+            for (int trial = 0; trial < 20; ++trial) {
+                const std::string name = GetName(framing) + " trial " + std::to_string(trial);
+                FrameReader reader(framing);
+                std::vector<std::string> received;
+                auto handler = [&received](char* data, size_t size) {
+                    Check(data[size] == '\0', "message followed by a NUL");
+                    received.emplace_back(data, size);
+                    return true;
+                };
+
+                // small chunks cut every header at every place, big ones hold several messages
+                const size_t maxChunk = trial < 5 ? 1 : trial < 10 ? 7 : 70000;
+                const bool isFed = FeedSplit(stream, random, maxChunk, [&](const char* data, size_t size) {
+                    return trial % 2 == 0 ? reader.Consume(data, size, handler) : Receive(reader, data, size, handler);
+                });
+                Check(isFed, name + ": stream accepted");
+                Check(reader.GetPendingSize() == 0, name + ": nothing left pending");
+                Check(received.size() == expected.size() * 10, name + ": message count");
+                for (size_t i = 0; i < received.size(); ++i) {
+                    Check(received[i] == expected[i % expected.size()], name + ": message " + std::to_string(i));
+                }
+            }
+        }
+
+        // a CRLF line end is not part of the message
+        FrameReader reader(Framing::NEWLINE);
+        std::string received;
+        Check(reader.Consume("abc\r\n", 5, [&received](char* data, size_t size) { received.assign(data, size); return true; })
+            && received == "abc", "NEWLINE: CRLF line end");
+    }
+
+    // Whether stream is refused, fed whole or one byte at a time
+    bool IsRefused(Framing framing, const std::string& stream, size_t maxMessageSize = FrameReader::DEFAULT_MAX_MESSAGE_SIZE) {
+        auto handler = [](char*, size_t) { return true; };
+
+        FrameReader whole(framing, maxMessageSize);
+        const bool isWholeRefused = !whole.Consume(stream.data(), stream.size(), handler);
+
+        FrameReader split(framing, maxMessageSize);
+        bool isSplitRefused = false;
+        for (size_t i = 0; i < stream.size() && !isSplitRefused; ++i) {
+            isSplitRefused = !Receive(split, stream.data() + i, 1, handler);
+        }
+
+        Check(isWholeRefused == isSplitRefused, GetName(framing) + ": same verdict whole and split");
+        return isWholeRefused;
+    }
+
+    void TestBrokenStreams() {
+        const size_t maxMessageSize = 100;
+        const std::string fits(maxMessageSize, 'a');
+        const std::string tooBig(maxMessageSize + 1, 'a');
+
+        // oversize messages and headers
+        Check(!IsRefused(Framing::NEWLINE, fits + "\n", maxMessageSize), "NEWLINE: message of the maximum size");
+        Check(IsRefused(Framing::NEWLINE, tooBig + "\n", maxMessageSize), "NEWLINE: message above the maximum size");
+        Check(IsRefused(Framing::NEWLINE, tooBig, maxMessageSize), "NEWLINE: unfinished line above the maximum size");
+        Check(!IsRefused(Framing::CONTENT_LENGTH, Frame(Framing::CONTENT_LENGTH, fits), maxMessageSize),
+            "CONTENT_LENGTH: message of the maximum size");
+        Check(IsRefused(Framing::CONTENT_LENGTH, "Content-Length: 101\r\n\r\n", maxMessageSize),
+            "CONTENT_LENGTH: length above the maximum size");
+        Check(IsRefused(Framing::CONTENT_LENGTH, "Content-Length: 99999999999999999999999999\r\n\r\n"),
+            "CONTENT_LENGTH: length that overflows");
+        Check(IsRefused(Framing::CONTENT_LENGTH, "X-Padding: " + std::string(FrameReader::MAX_HEADER_SIZE, 'p')),
+            "CONTENT_LENGTH: header above MAX_HEADER_SIZE");
+        Check(!IsRefused(Framing::LENGTH_PREFIX, Frame(Framing::LENGTH_PREFIX, fits), maxMessageSize),
+            "LENGTH_PREFIX: message of the maximum size");
+        Check(IsRefused(Framing::LENGTH_PREFIX, std::string("\0\0\0\x65", 4), maxMessageSize),
+            "LENGTH_PREFIX: length above the maximum size");
+        Check(IsRefused(Framing::LENGTH_PREFIX, "\xff\xff\xff\xff"), "LENGTH_PREFIX: length of 4 GB");
+
+        // malformed Content-Length headers
+        const char* const malformed[] = {
+            "\r\n\r\n",
+            "Content-Type: application/json\r\n\r\n{}",
+            "Content-Length: \r\n\r\n",
+            "Content-Length: x\r\n\r\n",
+            "Content-Length: 2x\r\n\r\n{}",
+            "Content-Length: -2\r\n\r\n{}",
+            "Content-Length: 2\r\nContent-Length: 2\r\n\r\n{}",
+            "Content-Length 2\r\n\r\n{}",
+            "Content-Lengths: 2\r\n\r\n{}",
+        };
+        for (const char* header : malformed) {
+            Check(IsRefused(Framing::CONTENT_LENGTH, header), std::string("CONTENT_LENGTH: malformed header ") + header);
+        }
+
+        // once refused, the stream stays refused
+        FrameReader reader(Framing::CONTENT_LENGTH);
+        auto handler = [](char*, size_t) { return true; };
+        Check(!reader.Consume("Content-Length: x\r\n\r\n", 21, handler), "CONTENT_LENGTH: malformed header refused");
+        const std::string valid = Frame(Framing::CONTENT_LENGTH, "{}");
+        Check(!reader.Consume(valid.data(), valid.size(), handler), "CONTENT_LENGTH: nothing read after a refused header");
+
+        // and so does a stream whose handler failed
+        FrameReader failed(Framing::NEWLINE);
+        int calls = 0;
+        auto failing = [&calls](char*, size_t) { ++calls; return false; };
+        Check(!failed.Consume("a\nb\n", 4, failing) && calls == 1, "NEWLINE: stops at the handler that failed");
+        Check(!failed.Consume("c\n", 2, failing) && calls == 1, "NEWLINE: nothing read after the handler failed");
+    }
+
+    // Requests through a FramedConnection get the same responses as straight from the server
+    void TestJsonConnection(Server& server) {
+        const std::string requests[] = {
+            "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":1,\"params\":[\"a line\"]}",
+            "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"params\":[\"a notification\"]}",
+            "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":2,\"params\":[\"" + std::string(50000, 'z') + "\"]}",
+            "[{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":3,\"params\":[\"batch\"]}]",
+            "{not json",
+        };
+
+        std::mt19937 random(2);
+        for (Framing framing : FRAMINGS) {
+            std::string stream;
+            std::string expected;
+            for (int repeat = 0; repeat < 5; ++repeat) {
+                for (auto& request : requests) {
+                    stream += Frame(framing, request);
+                    std::string response;
+                    server.HandleRequestInto(request, response);
+                    FrameWriter::Write(framing, response.data(), response.size(), expected);
+                }
+            }
+
+            for (int trial = 0; trial < 10; ++trial) {
+                const std::string name = GetName(framing) + " connection trial " + std::to_string(trial);
+                FramedConnection connection(server, framing);
+                std::string output;
+                const bool isFed = FeedSplit(stream, random, trial < 5 ? 7 : 70000, [&](const char* data, size_t size) {
+                    if (trial % 2 == 0) {
+                        return connection.Consume(data, size, output);
+                    }
+                    size_t capacity;
+                    char* buffer = connection.GetReceiveBuffer(capacity);
+                    const size_t count = std::min(size, capacity);
+                    memcpy(buffer, data, count);
+                    return connection.Received(count, output)
+                        && (count == size || connection.Consume(data + count, size - count, output));
+                });
+                Check(isFed, name + ": stream accepted");
+                Check(output == expected, name + ": responses");
+            }
+        }
+
+        // no FormatHandler for the content type
+        FramedConnection unknown(server, Framing::NEWLINE, "text/plain");
+        std::string output;
+        Check(!unknown.Consume("{}\n", 3, output) && output.empty(), "unknown content type refused");
+    }
+
+    // MessagePack may contain NULs and newlines, it is read in place with its size
+    void TestMsgpackConnection(Server& server) {
+        const std::string payload("a\0b\nc", 5);
+        std::string stream;
+        for (int id = 0; id < 10; ++id) {
+            MsgpackWriter writer;
+            Request::Parameters parameters;
+            parameters.emplace_back(payload);
+            Request("echo", std::move(parameters), Value(id)).Write(writer);
+            auto data = writer.GetData();
+            FrameWriter::Write(Framing::LENGTH_PREFIX, data->GetData(), data->GetSize(), stream);
+        }
+
+        std::mt19937 random(3);
+        FramedConnection connection(server, Framing::LENGTH_PREFIX, APPLICATION_MSGPACK);
+        std::string output;
+        Check(FeedSplit(stream, random, 13, [&](const char* data, size_t size) { return connection.Consume(data, size, output); }),
+            "MessagePack stream accepted");
+
+        FrameReader responses(Framing::LENGTH_PREFIX);
+        int32_t id = 0;
+        const bool isRead = responses.Consume(output.data(), output.size(), [&id, &payload](char* data, size_t size) {
+            Response response = MsgpackReader(data, size).GetResponse();
+            Check(response.GetId().AsInteger32() == id, "MessagePack response " + std::to_string(id) + " in order");
+            Check(response.GetResult().AsStringView() == string_view(payload.data(), payload.size()),
+                "MessagePack response " + std::to_string(id) + " has the NUL and the newline");
+            ++id;
+            return true;
+        });
+        Check(isRead && id == 10 && responses.GetPendingSize() == 0, "every MessagePack response");
+    }
+
+} // namespace
+
+int main() {
+    TestSplits();
+    TestBrokenStreams();
+
+    Server server;
+    JsonFormatHandler jsonFormatHandler;
+    MsgpackFormatHandler msgpackFormatHandler;
+    server.RegisterFormatHandler(jsonFormatHandler);
+    server.RegisterFormatHandler(msgpackFormatHandler);
+    server.GetDispatcher().AddMethod("echo", [](const std::string& text) { return text; });
+
+    TestJsonConnection(server);
+    TestMsgpackConnection(server);
+
+    std::printf("framing: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,281 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// This library is free software; you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or (at your
+// option) any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+// Test of the MessagePack writer and reader: values are written and read back, the headers and
+// formats the writer picks are checked byte by byte, and damaged or hostile messages must fail
+// with a ParseErrorFault. Exits with 1 on the first failure.
+
+#include "../include/jsonrpc-lean/msgpackformathandler.h"
+#include "../include/jsonrpc-lean/response.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+    using namespace jsonrpc;
+
+    void Check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            std::exit(1);
+        }
+    }
+
+    std::string Bytes(std::initializer_list<uint8_t> bytes) {
+        return std::string(bytes.begin(), bytes.end());
+    }
+
+    // The MessagePack of a value on its own, as the writer puts it in a message
+    std::string Encode(const Value& value) {
+        MsgpackWriter writer;
+        value.Write(writer);
+        auto data = writer.GetData();
+        return std::string(data->GetData(), data->GetSize());
+    }
+
+    std::string EncodeResponse(const Value& result) {
+        MsgpackWriter writer;
+        Response(Value(result), Value(1)).Write(writer);
+        auto data = writer.GetData();
+        return std::string(data->GetData(), data->GetSize());
+    }
+
+    Value Decode(const std::string& data) {
+        return MsgpackReader(data.data(), data.size()).GetValue();
+    }
+
+    Value DecodeResponse(const std::string& data) {
+        return std::move(MsgpackReader(data.data(), data.size()).GetResponse().GetResult());
+    }
+
+    // Whether reading data fails with a ParseErrorFault, and nothing else
+    bool IsParseError(const std::string& data) {
+        try {
+            MsgpackReader reader(data.data(), data.size());
+            reader.GetValue();
+        } catch (const ParseErrorFault&) {
+            return true;
+        } catch (...) {
+            return false;
+        }
+        return false;
+    }
+
+    tm MakeDateTime(int year, int month, int day, int hour, int minute, int second) {
+        tm dt = {};
+        dt.tm_year = year - 1900;
+        dt.tm_mon = month - 1;
+        dt.tm_mday = day;
+        dt.tm_hour = hour;
+        dt.tm_min = minute;
+        dt.tm_sec = second;
+        return dt;
+    }
+
+    bool SameDateTime(const tm& a, const tm& b) {
+        return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday
+            && a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec;
+    }
+
+    Value MakeArray(size_t size) {
+        Value::Array array;
+        for (size_t i = 0; i < size; ++i) {
+            array.emplace_back(static_cast<int32_t>(i % 100));
+        }
+        return Value(std::move(array));
+    }
+
+    Value MakeStruct(size_t size) {
+        Value::Struct data;
+        for (size_t i = 0; i < size; ++i) {
+            data.emplace("k" + std::to_string(i), Value(static_cast<int32_t>(i % 100)));
+        }
+        return Value(std::move(data));
+    }
+
+    // The header is the smallest that holds the count, and the elements follow it directly
+    void TestContainers() {
+        struct Case {
+            size_t mySize;
+            std::string myArrayHeader;
+            std::string myMapHeader;
+        };
+        const Case cases[] = {
+            { 0, Bytes({ 0x90 }), Bytes({ 0x80 }) },
+            { 15, Bytes({ 0x9f }), Bytes({ 0x8f }) },
+            { 16, Bytes({ 0xdc, 0x00, 0x10 }), Bytes({ 0xde, 0x00, 0x10 }) },
+            { 65535, Bytes({ 0xdc, 0xff, 0xff }), Bytes({ 0xde, 0xff, 0xff }) },
+            { 65536, Bytes({ 0xdd, 0x00, 0x01, 0x00, 0x00 }), Bytes({ 0xdf, 0x00, 0x01, 0x00, 0x00 }) },
+        };
+
+        for (auto& c : cases) {
+            const std::string name = std::to_string(c.mySize) + " elements";
+
+            const std::string array = Encode(MakeArray(c.mySize));
+            Check(array.compare(0, c.myArrayHeader.size(), c.myArrayHeader) == 0, "array header of " + name);
+            Check(array.size() == c.myArrayHeader.size() + c.mySize, "array size of " + name);
+            const Value arrayValue = Decode(array);
+            Check(arrayValue.IsArray() && arrayValue.AsArray().size() == c.mySize, "array read back of " + name);
+            for (size_t i = 0; i < c.mySize; ++i) {
+                Check(arrayValue.AsArray()[i].AsInteger32() == static_cast<int32_t>(i % 100), "array element of " + name);
+            }
+
+            const std::string map = Encode(MakeStruct(c.mySize));
+            Check(map.compare(0, c.myMapHeader.size(), c.myMapHeader) == 0, "map header of " + name);
+            const Value mapValue = Decode(map);
+            Check(mapValue.IsStruct() && mapValue.AsStruct().size() == c.mySize, "map read back of " + name);
+            for (size_t i = 0; i < c.mySize; ++i) {
+                auto member = mapValue.AsStruct().find("k" + std::to_string(i));
+                Check(member != mapValue.AsStruct().end() && member->second.AsInteger32() == static_cast<int32_t>(i % 100),
+                    "map member of " + name);
+            }
+        }
+
+        // shrunk headers nested in each other and in the response
+        Value::Struct nested;
+        nested.emplace("a", MakeArray(16));
+        nested.emplace("b", MakeArray(15));
+        nested.emplace("c", MakeStruct(65536));
+        Value::Array outer;
+        outer.emplace_back(std::move(nested));
+        outer.emplace_back(MakeArray(65535));
+        const Value result = DecodeResponse(EncodeResponse(Value(std::move(outer))));
+        Check(result.AsArray().size() == 2, "nested containers");
+        auto& inner = result.AsArray()[0].AsStruct();
+        Check(inner.at("a").AsArray().size() == 16 && inner.at("a").AsArray()[15].AsInteger32() == 15, "nested array of 16");
+        Check(inner.at("b").AsArray().size() == 15 && inner.at("b").AsArray()[14].AsInteger32() == 14, "nested array of 15");
+        Check(inner.at("c").AsStruct().size() == 65536, "nested map of 65536");
+        Check(result.AsArray()[1].AsArray().size() == 65535 && result.AsArray()[1].AsArray()[65534].AsInteger32() == 34,
+            "array of 65535 after the nested ones");
+    }
+
+    // 32 bit seconds where they fit, the 96 bit form otherwise; the reader also takes the 64 bit form
+    void TestTimestamps() {
+        struct Case {
+            tm myDateTime;
+            std::string myEncoding;
+        };
+        const Case cases[] = {
+            { MakeDateTime(1970, 1, 1, 0, 0, 0), Bytes({ 0xd6, 0xff, 0, 0, 0, 0 }) },
+            { MakeDateTime(2106, 2, 7, 6, 28, 15), Bytes({ 0xd6, 0xff, 0xff, 0xff, 0xff, 0xff }) },
+            { MakeDateTime(2106, 2, 7, 6, 28, 16), Bytes({ 0xc7, 12, 0xff, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0 }) },
+            { MakeDateTime(1969, 12, 31, 23, 59, 59),
+                Bytes({ 0xc7, 12, 0xff, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }) },
+            { MakeDateTime(1900, 3, 1, 12, 0, 0),
+                Bytes({ 0xc7, 12, 0xff, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0x7c, 0xa3, 0xf2, 0xc0 }) },
+        };
+
+        for (auto& c : cases) {
+            const std::string name = "timestamp " + std::to_string(c.myDateTime.tm_year + 1900);
+            const std::string encoding = Encode(Value(c.myDateTime));
+            Check(encoding == c.myEncoding, name + " encoding");
+            const Value value = Decode(encoding);
+            Check(value.IsDateTime() && SameDateTime(value.AsDateTime(), c.myDateTime), name + " read back");
+        }
+
+        // 30 bit nanoseconds (dropped) and 34 bit seconds: 2106-02-07 06:28:16 and 1 ns
+        const Value value = Decode(Bytes({ 0xd7, 0xff, 0, 0, 0, 0x05, 0, 0, 0, 0 }));
+        Check(value.IsDateTime() && SameDateTime(value.AsDateTime(), MakeDateTime(2106, 2, 7, 6, 28, 16)),
+            "timestamp 64 read back");
+    }
+
+    void TestBinary() {
+        struct Case {
+            size_t mySize;
+            std::string myHeader;
+        };
+        const Case cases[] = {
+            { 0, Bytes({ 0xc4, 0 }) },
+            { 255, Bytes({ 0xc4, 0xff }) },
+            { 256, Bytes({ 0xc5, 0x01, 0x00 }) },
+            { 65535, Bytes({ 0xc5, 0xff, 0xff }) },
+            { 65536, Bytes({ 0xc6, 0x00, 0x01, 0x00, 0x00 }) },
+        };
+
+        for (auto& c : cases) {
+            const std::string name = "binary of " + std::to_string(c.mySize) + " bytes";
+            std::string bytes(c.mySize, '\0');
+            for (size_t i = 0; i < c.mySize; ++i) {
+                bytes[i] = static_cast<char>(i * 7);
+            }
+
+            const std::string encoding = Encode(Value(Binary(bytes.data(), bytes.size())));
+            Check(encoding.size() == c.myHeader.size() + c.mySize && encoding.compare(0, c.myHeader.size(), c.myHeader) == 0,
+                name + " encoding");
+            const Value value = DecodeResponse(EncodeResponse(Value(Binary(bytes.data(), bytes.size()))));
+            Check(value.IsBinary() && value.AsStringView() == string_view(bytes.data(), bytes.size()), name + " read back");
+        }
+    }
+
+    // Every cut short message fails to parse
+    void TestTruncated() {
+        Value::Struct data;
+        data.emplace("array", MakeArray(20));
+        data.emplace("binary", Value(Binary("\x01\x02\x03", 3)));
+        data.emplace("date", Value(MakeDateTime(1960, 5, 4, 3, 2, 1)));
+        data.emplace("double", Value(0.5));
+        data.emplace("integer", Value(int64_t(1) << 40));
+        data.emplace("string", Value("a string that takes more than 31 bytes"));
+        const std::string message = EncodeResponse(Value(std::move(data)));
+        Check(!DecodeResponse(message).AsStruct().empty(), "the whole message is read");
+
+        for (size_t size = 0; size < message.size(); ++size) {
+            Check(IsParseError(message.substr(0, size)), "message cut to " + std::to_string(size) + " bytes");
+        }
+        Check(IsParseError(message + '\0'), "data after the message");
+    }
+
+    void TestDepth() {
+        Value nested;
+        for (size_t i = 0; i < msgpack::MAX_DEPTH - 1; ++i) {
+            Value::Array array;
+            array.emplace_back(std::move(nested));
+            nested = Value(std::move(array));
+        }
+
+        // the response is the first level, so the result takes all but one
+        const Value result = DecodeResponse(EncodeResponse(nested));
+        Check(result.IsArray(), "nesting up to MAX_DEPTH");
+
+        Value::Array array;
+        array.emplace_back(std::move(nested));
+        Check(IsParseError(EncodeResponse(Value(std::move(array)))), "nesting beyond MAX_DEPTH");
+    }
+
+    // Counts far beyond the data must fail before anything is allocated for them
+    void TestCountBomb() {
+        Check(IsParseError(Bytes({ 0xdd, 0xff, 0xff, 0xff, 0xff })), "ARRAY32 count bomb");
+        Check(IsParseError(Bytes({ 0xdd, 0xff, 0xff, 0xff, 0xff, 0x80, 0x80 })), "ARRAY32 count bomb with some entries");
+        Check(IsParseError(Bytes({ 0xdd, 0x00, 0x00, 0x00, 0x02, 0x80 })), "ARRAY32 with fewer entries than its count");
+        Check(IsParseError(Bytes({ 0xdf, 0xff, 0xff, 0xff, 0xff })), "MAP32 count bomb");
+        Check(IsParseError(Bytes({ 0xc6, 0xff, 0xff, 0xff, 0xff })), "BIN32 size beyond the data");
+    }
+
+} // namespace
+
+int main() {
+    TestContainers();
+    TestTimestamps();
+    TestBinary();
+    TestTruncated();
+    TestDepth();
+    TestCountBomb();
+
+    std::printf("msgpack: all tests passed\n");
+    return 0;
+}